@@ -0,0 +1,154 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+// Compares the aggregation kernels of `inventory_mirror` at each SIMD level
+// with the equivalent SQL queries on an in-memory SQLite database. Both sides
+// hold the same items.
+
+#include "aggregate.hpp"
+#include "bench.hpp"
+#include "inventory.hpp"
+
+#include <sqlite3.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr int32_t num_items = 1'000'000;
+
+constexpr size_t num_sql_runs = 10;
+
+constexpr size_t num_kernel_runs = 200;
+
+const inventory_query query{10, 100, 10};
+
+/// Fills an in-memory SQLite database with `items`.
+sqlite3* open_sql_db(const std::vector<item>& items) {
+  sqlite3* db = nullptr;
+  if (sqlite3_open(":memory:", &db) != SQLITE_OK)
+    return nullptr;
+  const char* init = "CREATE TABLE items ("
+                     "id INTEGER PRIMARY KEY,"
+                     "name TEXT NOT NULL,"
+                     "price INTEGER NOT NULL,"
+                     "available INTEGER NOT NULL);"
+                     "BEGIN";
+  sqlite3_stmt* stmt = nullptr;
+  if (sqlite3_exec(db, init, nullptr, nullptr, nullptr) != SQLITE_OK
+      || sqlite3_prepare_v2(db, "INSERT INTO items VALUES (?, ?, ?, ?)", -1,
+                            &stmt, nullptr)
+           != SQLITE_OK) {
+    sqlite3_close(db);
+    return nullptr;
+  }
+  for (const auto& value : items) {
+    sqlite3_bind_int(stmt, 1, value.id);
+    sqlite3_bind_text(stmt, 2, value.name.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 3, value.price);
+    sqlite3_bind_int(stmt, 4, value.available);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+  if (sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) != SQLITE_OK) {
+    sqlite3_close(db);
+    return nullptr;
+  }
+  return db;
+}
+
+/// Runs a query that returns a single integer. Binds `arg` to the first
+/// parameter, if any.
+int64_t sql_scalar(sqlite3* db, const char* sql, int32_t arg = 0) {
+  sqlite3_stmt* stmt = nullptr;
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    return -1;
+  int64_t result = -1;
+  if (sqlite3_bind_parameter_count(stmt) > 0)
+    sqlite3_bind_int(stmt, 1, arg);
+  if (sqlite3_step(stmt) == SQLITE_ROW)
+    result = sqlite3_column_int64(stmt, 0);
+  sqlite3_finalize(stmt);
+  return result;
+}
+
+/// Computes the histogram of `available` with a `GROUP BY` query.
+std::vector<uint64_t> sql_histogram(sqlite3* db) {
+  const char* sql = "SELECT MIN(available / ?1, ?2 - 1), COUNT(*)"
+                    " FROM items GROUP BY 1";
+  auto result = std::vector<uint64_t>(query.buckets);
+  sqlite3_stmt* stmt = nullptr;
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    return result;
+  sqlite3_bind_int(stmt, 1, query.bucket_width);
+  sqlite3_bind_int(stmt, 2, query.buckets);
+  while (sqlite3_step(stmt) == SQLITE_ROW)
+    result[sqlite3_column_int(stmt, 0)] = sqlite3_column_int64(stmt, 1);
+  sqlite3_finalize(stmt);
+  return result;
+}
+
+} // namespace
+
+int main() {
+  // Generate the same items for both sides.
+  auto rng = std::minstd_rand{42};
+  auto items = std::vector<item>{};
+  items.reserve(num_items);
+  for (int32_t id = 1; id <= num_items; ++id)
+    items.push_back(item{id, static_cast<int32_t>(rng() % 10'000) + 1,
+                         static_cast<int32_t>(rng() % 2'000),
+                         "item-" + std::to_string(id)});
+  auto* db = open_sql_db(items);
+  if (db == nullptr) {
+    std::fprintf(stderr, "failed to populate the database\n");
+    return EXIT_FAILURE;
+  }
+  auto mirror = inventory_mirror{};
+  mirror.reset(items, 0);
+  items.clear();
+  // Make sure that both sides agree before measuring anything.
+  auto expected = mirror.compute(query, kernels_for(simd_level::scalar));
+  auto sql_value = sql_scalar(db, "SELECT SUM(price * available) FROM items");
+  auto sql_below = sql_scalar(
+    db, "SELECT COUNT(*) FROM items WHERE available < ?", query.threshold);
+  if (sql_value != expected.stock_value
+      || sql_below != static_cast<int64_t>(expected.below_threshold)
+      || sql_histogram(db) != expected.histogram) {
+    std::fprintf(stderr, "SQL and kernels disagree\n");
+    return EXIT_FAILURE;
+  }
+  std::printf("best SIMD level: %s\n",
+              to_string(detect_simd_level()).c_str());
+  bench::report("stock value (SQL)",
+                bench::ns_per_op(num_sql_runs, [&](size_t) {
+                  bench::do_not_optimize(sql_scalar(
+                    db, "SELECT SUM(price * available) FROM items"));
+                }));
+  bench::report("below threshold (SQL)",
+                bench::ns_per_op(num_sql_runs, [&](size_t) {
+                  bench::do_not_optimize(sql_scalar(
+                    db, "SELECT COUNT(*) FROM items WHERE available < ?",
+                    query.threshold));
+                }));
+  bench::report("histogram (SQL)",
+                bench::ns_per_op(num_sql_runs, [&](size_t) {
+                  bench::do_not_optimize(sql_histogram(db));
+                }));
+  for (auto level : {simd_level::scalar, simd_level::sse4, simd_level::avx2}) {
+    const auto& kernels = kernels_for(level);
+    if (kernels.level != level)
+      continue;
+    auto name = to_string(level);
+    bench::report("all totals (" + name + ")",
+                  bench::ns_per_op(num_kernel_runs, [&](size_t) {
+                    bench::do_not_optimize(mirror.compute(query, kernels));
+                  }));
+  }
+  sqlite3_close(db);
+  return EXIT_SUCCESS;
+}
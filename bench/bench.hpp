@@ -0,0 +1,39 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+// Minimal helpers for the micro-benchmarks in this directory.
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <string_view>
+
+namespace bench {
+
+/// Prevents the compiler from optimizing away a computed value.
+template <class T>
+void do_not_optimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/// Runs `fn` `runs` times and returns the average time per call in
+/// nanoseconds.
+template <class F>
+double ns_per_op(size_t runs, F&& fn) {
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  for (size_t i = 0; i < runs; ++i)
+    fn(i);
+  auto elapsed = clock::now() - start;
+  auto ns = std::chrono::duration<double, std::nano>{elapsed}.count();
+  return ns / static_cast<double>(runs);
+}
+
+/// Prints a single result line in a `name  time  ops/s` format.
+inline void report(std::string_view name, double ns) {
+  std::printf("%-40.*s %12.1f ns/op %14.0f ops/s\n",
+              static_cast<int>(name.size()), name.data(), ns, 1e9 / ns);
+}
+
+} // namespace bench
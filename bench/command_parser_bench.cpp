@@ -0,0 +1,114 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+// Compares the per-line cost of the controller's command parsing. The generic
+// variant mirrors the original implementation: a fresh `caf::json_reader` per
+// line, a heap-allocated command with a string type and a response that grows
+// by appending. The specialized variant uses `command_parser` and
+// `result_response`.
+
+#include "bench.hpp"
+#include "command.hpp"
+
+#include <caf/json_reader.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+constexpr size_t num_runs = 1'000'000;
+
+/// The command type of the original implementation.
+struct generic_command {
+  std::string type;
+  int32_t id = 0;
+  int32_t amount = 0;
+  bool atomic = false;
+  std::vector<batch_op> ops;
+
+  bool valid() const noexcept {
+    return type == "inc" || type == "dec" || type == "batch";
+  }
+};
+
+template <class Insepctor>
+bool inspect(Insepctor& f, generic_command& x) {
+  return f.object(x).fields(f.field("type", x.type),
+                            f.field("id", x.id).fallback(0),
+                            f.field("amount", x.amount).fallback(0),
+                            f.field("atomic", x.atomic).fallback(false),
+                            f.field("ops", x.ops).fallback(
+                              std::vector<batch_op>{}));
+}
+
+std::shared_ptr<generic_command> generic_parse(std::string_view line) {
+  caf::json_reader reader;
+  if (!reader.load(line))
+    return nullptr;
+  auto ptr = std::make_shared<generic_command>();
+  if (!reader.apply(*ptr) || !ptr->valid())
+    return nullptr;
+  return ptr;
+}
+
+std::string generic_response(int32_t res) {
+  auto str = R"_({"result":)_"s;
+  str += std::to_string(res);
+  str += '}';
+  return str;
+}
+
+/// A mix of compact and spaced inputs as produced by typical clients.
+std::vector<std::string> make_lines() {
+  std::vector<std::string> result;
+  for (int32_t id = 1; id <= 64; ++id) {
+    auto id_str = std::to_string(id);
+    result.push_back(R"_({"type":"inc","id":)_" + id_str
+                     + R"_(,"amount":5})_");
+    result.push_back(R"_({ "type": "dec", "id": )_" + id_str
+                     + R"_(, "amount": 3 })_");
+  }
+  return result;
+}
+
+} // namespace
+
+int main() {
+  auto lines = make_lines();
+  auto line = [&lines](size_t i) -> std::string_view {
+    return lines[i % lines.size()];
+  };
+  bench::report("parse (json_reader per line)",
+                bench::ns_per_op(num_runs, [&](size_t i) {
+                  bench::do_not_optimize(generic_parse(line(i)));
+                }));
+  command_parser parser;
+  command cmd;
+  bench::report("parse (reused json_reader)",
+                bench::ns_per_op(num_runs, [&](size_t i) {
+                  bench::do_not_optimize(parser.parse_generic(line(i), cmd));
+                }));
+  bench::report("parse (command_parser)",
+                bench::ns_per_op(num_runs, [&](size_t i) {
+                  bench::do_not_optimize(parser.parse(line(i), cmd));
+                }));
+  if (parser.fallbacks() != 0) {
+    std::fprintf(stderr, "unexpected fallbacks: %zu\n", parser.fallbacks());
+    return EXIT_FAILURE;
+  }
+  auto value = [](size_t i) { return static_cast<int32_t>(i % 100'000); };
+  bench::report("response (append)",
+                bench::ns_per_op(num_runs, [&](size_t i) {
+                  bench::do_not_optimize(generic_response(value(i)));
+                }));
+  bench::report("response (to_chars)",
+                bench::ns_per_op(num_runs, [&](size_t i) {
+                  bench::do_not_optimize(result_response(value(i)));
+                }));
+  return EXIT_SUCCESS;
+}
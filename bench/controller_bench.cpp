@@ -0,0 +1,75 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+// Measures how many commands per second a single client gets through the
+// command port. The client keeps up to N commands in flight and sweeps N from
+// 1 to a maximum. Run it against servers with different `cmd-window` settings
+// to see how the window of the controller limits the throughput.
+//
+// Usage: controller-bench <host> <port> <item-id> [commands] [max-depth]
+//
+// The item must exist. Each command increments its available count by one.
+
+#include "bench.hpp"
+#include "socket.hpp"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+int main(int argc, char** argv) {
+  if (argc < 4) {
+    std::fprintf(stderr, "usage: %s <host> <port> <item-id> [commands] "
+                         "[max-depth]\n",
+                 argv[0]);
+    return EXIT_FAILURE;
+  }
+  auto num_commands = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 10'000;
+  auto max_depth = argc > 5 ? std::strtoul(argv[5], nullptr, 10) : 256;
+  auto fd = bench::connect_to(argv[1], argv[2]);
+  if (fd < 0) {
+    std::fprintf(stderr, "failed to connect to %s:%s\n", argv[1], argv[2]);
+    return EXIT_FAILURE;
+  }
+  auto cmd = std::string{R"_({"type":"inc","id":)_"};
+  cmd += argv[3];
+  cmd += R"_(,"amount":1})_";
+  cmd += '\n';
+  auto buf = std::string{};
+  auto line = std::string{};
+  for (unsigned long depth = 1; depth <= max_depth; depth *= 2) {
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    unsigned long sent = 0;
+    unsigned long received = 0;
+    unsigned long errors = 0;
+    while (received < num_commands) {
+      // Fill the pipeline, then wait for the oldest response.
+      auto batch = std::string{};
+      while (sent < num_commands && sent - received < depth) {
+        batch += cmd;
+        ++sent;
+      }
+      if (!batch.empty() && !bench::write_all(fd, batch)) {
+        std::fprintf(stderr, "lost connection to the server\n");
+        return EXIT_FAILURE;
+      }
+      if (!bench::read_line(fd, buf, line)) {
+        std::fprintf(stderr, "lost connection to the server\n");
+        return EXIT_FAILURE;
+      }
+      if (line.find("error") != std::string::npos)
+        ++errors;
+      ++received;
+    }
+    auto elapsed = std::chrono::duration<double>{clock::now() - start};
+    auto name = "depth " + std::to_string(depth);
+    if (errors > 0)
+      name += " (" + std::to_string(errors) + " errors)";
+    bench::report(name, elapsed.count() * 1e9 / num_commands);
+  }
+  close(fd);
+  return EXIT_SUCCESS;
+}
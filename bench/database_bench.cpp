@@ -0,0 +1,140 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+// Compares the per-operation cost of `sqlite_database`, which keeps its
+// statements prepared for the lifetime of the connection, with preparing and
+// finalizing a statement on each call. Both variants run against an in-memory
+// database to keep disk I/O out of the measurement.
+
+#include "bench.hpp"
+#include "sqlite_database.hpp"
+
+#include <sqlite3.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+constexpr int32_t num_items = 10'000;
+
+constexpr size_t num_runs = 200'000;
+
+/// Re-implements `sqlite_database::get` by preparing the statement on each
+/// call.
+std::optional<item> adhoc_get(sqlite3* db, int32_t id) {
+  const char* get_query = R"_(
+    SELECT id, name, price, available
+    FROM items WHERE id = ?
+  )_";
+  sqlite3_stmt* stmt = nullptr;
+  if (sqlite3_prepare_v2(db, get_query, -1, &stmt, nullptr) != SQLITE_OK)
+    return std::nullopt;
+  if (sqlite3_bind_int(stmt, 1, id) != SQLITE_OK
+      || sqlite3_step(stmt) != SQLITE_ROW) {
+    sqlite3_finalize(stmt);
+    return std::nullopt;
+  }
+  item result;
+  result.id = sqlite3_column_int(stmt, 0);
+  result.name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+  result.price = sqlite3_column_int(stmt, 2);
+  result.available = sqlite3_column_int(stmt, 3);
+  sqlite3_finalize(stmt);
+  return result;
+}
+
+/// Re-implements `sqlite_database::inc` by preparing the statement on each
+/// call. Uses the same SQL, including the `RETURNING` clause, so that both
+/// variants differ only in preparing the statement.
+ec adhoc_inc(sqlite3* db, int32_t id, int32_t amount, item& result) {
+  const char* inc_query = R"_(
+  UPDATE items
+  SET available = available + ?
+  WHERE id = ? AND available <= 2147483647 - ?
+  RETURNING id, name, price, available
+)_";
+  sqlite3_stmt* stmt = nullptr;
+  if (sqlite3_prepare_v2(db, inc_query, -1, &stmt, nullptr) != SQLITE_OK)
+    return ec::database_inaccessible;
+  if (sqlite3_bind_int(stmt, 1, amount) != SQLITE_OK
+      || sqlite3_bind_int(stmt, 2, id) != SQLITE_OK
+      || sqlite3_bind_int(stmt, 3, amount) != SQLITE_OK
+      || sqlite3_step(stmt) != SQLITE_ROW) {
+    sqlite3_finalize(stmt);
+    return ec::no_such_item;
+  }
+  result.id = sqlite3_column_int(stmt, 0);
+  result.name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+  result.price = sqlite3_column_int(stmt, 2);
+  result.available = sqlite3_column_int(stmt, 3);
+  auto done = sqlite3_step(stmt) == SQLITE_DONE;
+  sqlite3_finalize(stmt);
+  return done ? ec::nil : ec::database_inaccessible;
+}
+
+/// Opens an in-memory database for the ad-hoc variant with the same schema
+/// and content as the one managed by `sqlite_database`.
+sqlite3* open_adhoc_db() {
+  sqlite3* db = nullptr;
+  if (sqlite3_open(":memory:", &db) != SQLITE_OK)
+    return nullptr;
+  const char* init = "CREATE TABLE items ("
+                     "id INTEGER PRIMARY KEY,"
+                     "name TEXT NOT NULL,"
+                     "price INTEGER NOT NULL,"
+                     "available INTEGER NOT NULL);"
+                     "WITH RECURSIVE ids(id) AS ("
+                     "  SELECT 1 UNION ALL SELECT id + 1 FROM ids"
+                     "  WHERE id < 10000)"
+                     "INSERT INTO items SELECT id, 'item-' || id, 100, 10"
+                     "  FROM ids";
+  if (sqlite3_exec(db, init, nullptr, nullptr, nullptr) != SQLITE_OK) {
+    sqlite3_close(db);
+    return nullptr;
+  }
+  return db;
+}
+
+} // namespace
+
+int main() {
+  sqlite_database db{":memory:"};
+  if (auto err = db.open()) {
+    std::fprintf(stderr, "failed to open the database\n");
+    return EXIT_FAILURE;
+  }
+  for (int32_t id = 1; id <= num_items; ++id) {
+    if (db.insert(item{id, 100, 10, "item-" + std::to_string(id)}) != ec::nil) {
+      std::fprintf(stderr, "failed to populate the database\n");
+      return EXIT_FAILURE;
+    }
+  }
+  auto* adhoc_db = open_adhoc_db();
+  if (adhoc_db == nullptr) {
+    std::fprintf(stderr, "failed to open the ad-hoc database\n");
+    return EXIT_FAILURE;
+  }
+  auto key = [](size_t i) { return static_cast<int32_t>(i % num_items) + 1; };
+  bench::report("get (prepare per call)",
+                bench::ns_per_op(num_runs, [&](size_t i) {
+                  bench::do_not_optimize(adhoc_get(adhoc_db, key(i)));
+                }));
+  bench::report("get (prepared once)",
+                bench::ns_per_op(num_runs, [&](size_t i) {
+                  bench::do_not_optimize(db.get(key(i)));
+                }));
+  bench::report("inc (prepare per call)",
+                bench::ns_per_op(num_runs, [&](size_t i) {
+                  item updated;
+                  bench::do_not_optimize(
+                    adhoc_inc(adhoc_db, key(i), 1, updated));
+                }));
+  bench::report("inc (prepared once)",
+                bench::ns_per_op(num_runs, [&](size_t i) {
+                  item updated;
+                  bench::do_not_optimize(db.inc(key(i), 1, updated));
+                }));
+  sqlite3_close(adhoc_db);
+  return EXIT_SUCCESS;
+}
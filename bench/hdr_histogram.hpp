@@ -0,0 +1,129 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+// A minimal HDR histogram for recording latencies. Follows the bucket layout
+// of HdrHistogram: each bucket covers twice the range of the previous one and
+// splits it into a fixed number of sub-buckets, which bounds the relative
+// error of every recorded value.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace bench {
+
+class hdr_histogram {
+public:
+  /// Creates a histogram for values in `[1, highest]` with the given number
+  /// of significant decimal digits.
+  /// @pre `highest >= 2` and `1 <= digits <= 5`
+  explicit hdr_histogram(int64_t highest = 3'600'000'000'000, int digits = 3)
+    : highest_(highest) {
+    auto single_unit = 2 * static_cast<int64_t>(std::pow(10, digits));
+    auto magnitude = static_cast<int>(std::ceil(std::log2(single_unit)));
+    half_magnitude_ = magnitude - 1;
+    sub_bucket_count_ = int64_t{1} << magnitude;
+    half_count_ = sub_bucket_count_ / 2;
+    mask_ = static_cast<uint64_t>(sub_bucket_count_ - 1);
+    // Find the number of buckets that covers `highest`.
+    int buckets = 1;
+    auto smallest_untrackable = sub_bucket_count_;
+    while (smallest_untrackable <= highest) {
+      if (smallest_untrackable > std::numeric_limits<int64_t>::max() / 2) {
+        ++buckets;
+        break;
+      }
+      smallest_untrackable <<= 1;
+      ++buckets;
+    }
+    counts_.resize(static_cast<size_t>(buckets + 1) * half_count_);
+  }
+
+  /// Adds `value` to the histogram. Clamps values to the trackable range.
+  void record(int64_t value) {
+    value = std::clamp<int64_t>(value, 0, highest_);
+    ++counts_[index_of(value)];
+    ++total_;
+    max_ = std::max(max_, value);
+    sum_ += static_cast<double>(value);
+  }
+
+  /// Adds all values of `other` to this histogram.
+  /// @pre `other` uses the same configuration.
+  void merge(const hdr_histogram& other) {
+    for (size_t i = 0; i < counts_.size(); ++i)
+      counts_[i] += other.counts_[i];
+    total_ += other.total_;
+    max_ = std::max(max_, other.max_);
+    sum_ += other.sum_;
+  }
+
+  /// Returns the number of recorded values.
+  uint64_t total() const noexcept {
+    return total_;
+  }
+
+  /// Returns the largest recorded value.
+  int64_t max() const noexcept {
+    return max_;
+  }
+
+  /// Returns the average of all recorded values.
+  double mean() const noexcept {
+    return total_ > 0 ? sum_ / static_cast<double>(total_) : 0.0;
+  }
+
+  /// Returns the value at the given percentile, e.g., 99.9. The result is
+  /// the largest value that is equivalent to the recorded value.
+  int64_t value_at(double percentile) const noexcept {
+    if (total_ == 0)
+      return 0;
+    auto rank = static_cast<uint64_t>(
+      std::ceil(percentile / 100.0 * static_cast<double>(total_)));
+    rank = std::clamp<uint64_t>(rank, 1, total_);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); ++i) {
+      seen += counts_[i];
+      if (seen >= rank)
+        return std::min(highest_equivalent(i), max_);
+    }
+    return max_;
+  }
+
+private:
+  size_t index_of(int64_t value) const noexcept {
+    auto bits = static_cast<uint64_t>(value) | mask_;
+    auto bucket = 63 - half_magnitude_ - __builtin_clzll(bits);
+    auto sub_bucket = value >> bucket;
+    return (static_cast<size_t>(bucket + 1) << half_magnitude_)
+           + static_cast<size_t>(sub_bucket - half_count_);
+  }
+
+  int64_t highest_equivalent(size_t index) const noexcept {
+    auto bucket = static_cast<int>(index >> half_magnitude_) - 1;
+    auto sub_bucket = static_cast<int64_t>(index & (half_count_ - 1))
+                      + half_count_;
+    if (bucket < 0) {
+      sub_bucket -= half_count_;
+      bucket = 0;
+    }
+    auto lowest = sub_bucket << bucket;
+    return lowest + (int64_t{1} << bucket) - 1;
+  }
+
+  int64_t highest_;
+  int half_magnitude_ = 0;
+  int64_t sub_bucket_count_ = 0;
+  int64_t half_count_ = 0;
+  uint64_t mask_ = 0;
+  std::vector<uint64_t> counts_;
+  uint64_t total_ = 0;
+  int64_t max_ = 0;
+  double sum_ = 0;
+};
+
+} // namespace bench
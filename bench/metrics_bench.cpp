@@ -0,0 +1,77 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+// Measures the cost of updating metrics on hot paths, with one thread and
+// with several threads that update the same metrics at once. For comparison,
+// it also measures a counter that all threads share and a plain clock read,
+// which every latency measurement needs twice.
+
+#include "bench.hpp"
+#include "metrics.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr size_t num_ops = 10'000'000;
+
+std::atomic<uint64_t> shared_counter;
+
+/// Runs `fn` on `num_threads` threads at once and returns the average time
+/// per call on each thread.
+template <class F>
+double ns_per_op_on(size_t num_threads, F fn) {
+  auto results = std::vector<double>(num_threads);
+  auto threads = std::vector<std::thread>{};
+  for (size_t i = 0; i < num_threads; ++i)
+    threads.emplace_back(
+      [&fn, &results, i] { results[i] = bench::ns_per_op(num_ops, fn); });
+  for (auto& thread : threads)
+    thread.join();
+  double sum = 0;
+  for (auto ns : results)
+    sum += ns;
+  return sum / static_cast<double>(num_threads);
+}
+
+} // namespace
+
+int main() {
+  auto max_threads = std::max(std::thread::hardware_concurrency(), 2u);
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    auto suffix = " (" + std::to_string(threads) + " threads)";
+    bench::report("metrics::inc" + suffix,
+                  ns_per_op_on(threads, [](size_t) {
+                    metrics::inc(metrics::counter::http_errors);
+                  }));
+    bench::report("metrics::add" + suffix,
+                  ns_per_op_on(threads, [](size_t i) {
+                    metrics::add(metrics::gauge::controller_in_flight,
+                                 i % 2 == 0 ? 1 : -1);
+                  }));
+    bench::report("metrics::observe" + suffix,
+                  ns_per_op_on(threads, [](size_t i) {
+                    metrics::observe(metrics::histogram::db_get, i);
+                  }));
+    bench::report("metrics::scoped_timer" + suffix,
+                  ns_per_op_on(threads, [](size_t) {
+                    metrics::scoped_timer timer{metrics::histogram::db_inc};
+                  }));
+    bench::report("shared atomic counter" + suffix,
+                  ns_per_op_on(threads, [](size_t) {
+                    shared_counter.fetch_add(1, std::memory_order_relaxed);
+                  }));
+    bench::report("steady_clock::now" + suffix,
+                  ns_per_op_on(threads, [](size_t) {
+                    bench::do_not_optimize(std::chrono::steady_clock::now());
+                  }));
+  }
+  bench::report("metrics::render", bench::ns_per_op(100, [](size_t) {
+                  bench::do_not_optimize(metrics::render());
+                }));
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,90 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+// Blocking socket helpers for the benchmark clients in this directory.
+
+#pragma once
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace bench {
+
+/// Connects to `host` at `port` and disables Nagle's algorithm.
+/// @returns the socket or -1 on error.
+inline int connect_to(const char* host, const char* port) {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addrs = nullptr;
+  if (getaddrinfo(host, port, &hints, &addrs) != 0)
+    return -1;
+  int fd = -1;
+  for (auto* addr = addrs; addr != nullptr; addr = addr->ai_next) {
+    fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (fd < 0)
+      continue;
+    if (connect(fd, addr->ai_addr, addr->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addrs);
+  if (fd >= 0) {
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+  }
+  return fd;
+}
+
+/// Reads some bytes from `fd` and appends them to `buf`.
+/// @returns `false` if the connection is closed or broken.
+inline bool read_some(int fd, std::string& buf) {
+  char tmp[4096];
+  auto n = read(fd, tmp, sizeof(tmp));
+  if (n <= 0)
+    return false;
+  buf.append(tmp, static_cast<size_t>(n));
+  return true;
+}
+
+/// Reads from `fd` until receiving a complete line. Keeps excess bytes in
+/// `buf` for the next call.
+inline bool read_line(int fd, std::string& buf, std::string& line) {
+  for (;;) {
+    if (auto pos = buf.find('\n'); pos != std::string::npos) {
+      line.assign(buf, 0, pos);
+      buf.erase(0, pos + 1);
+      return true;
+    }
+    if (!read_some(fd, buf))
+      return false;
+  }
+}
+
+/// Reads from `fd` until `buf` contains at least `n` bytes.
+inline bool read_at_least(int fd, std::string& buf, size_t n) {
+  while (buf.size() < n)
+    if (!read_some(fd, buf))
+      return false;
+  return true;
+}
+
+/// Writes all of `data` to `fd`.
+inline bool write_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    auto n = write(fd, data.data(), data.size());
+    if (n <= 0)
+      return false;
+    data.remove_prefix(static_cast<size_t>(n));
+  }
+  return true;
+}
+
+} // namespace bench
@@ -0,0 +1,629 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+// Drives a running server with a mix of HTTP requests, commands on the JSON
+// command port and WebSocket subscribers on `/events`, all at the same time.
+// Reports the throughput and the latency percentiles of each operation.
+//
+// Usage: warehouse-bench [--option=value ...]
+//
+// Options:
+//   --host               server address (default: 127.0.0.1)
+//   --http-port          port of the HTTP server (default: 8080)
+//   --cmd-port           port of the JSON command server (default: 7788)
+//   --http-connections   number of HTTP clients (default: 8)
+//   --cmd-connections    number of command clients (default: 0)
+//   --subscribers        number of `/events` subscribers (default: 0)
+//   --items              number of item IDs, starting at 1 (default: 10000)
+//   --populate           add all items before the run (default: 0)
+//   --read-ratio         share of reads among HTTP requests (default: 0.9)
+//   --list-ratio         share of `/items` listings among reads (default: 0)
+//   --dist               key distribution: uniform or zipf (default: zipf)
+//   --zipf-s             exponent of the Zipf distribution (default: 0.99)
+//   --warmup             seconds before recording (default: 2)
+//   --duration           seconds of recording (default: 10)
+//   --seed               seed for the random number generators (default: 42)
+//
+// Writes come in pairs: a client first increments the available count of an
+// item and later decrements the same item again. Hence, writes never fail
+// because an item runs out of stock and the run leaves the counts as they
+// were.
+
+#include "hdr_histogram.hpp"
+#include "socket.hpp"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// Maximum time for waiting on a single response.
+constexpr auto response_timeout = 5s;
+
+// Number of IDs per `/items` listing.
+constexpr int32_t list_size = 100;
+
+// Range of the recorded latencies: up to one minute in nanoseconds.
+constexpr int64_t max_latency = 60'000'000'000;
+
+struct config {
+  std::string host = "127.0.0.1";
+  std::string http_port = "8080";
+  std::string cmd_port = "7788";
+  size_t http_connections = 8;
+  size_t cmd_connections = 0;
+  size_t subscribers = 0;
+  int32_t items = 10'000;
+  bool populate = false;
+  double read_ratio = 0.9;
+  double list_ratio = 0.0;
+  bool zipf = true;
+  double zipf_s = 0.99;
+  double warmup = 2;
+  double duration = 10;
+  uint64_t seed = 42;
+};
+
+bool parse_args(int argc, char** argv, config& cfg) {
+  for (int i = 1; i < argc; ++i) {
+    auto arg = std::string_view{argv[i]};
+    auto eq = arg.find('=');
+    if (arg.substr(0, 2) != "--" || eq == std::string_view::npos) {
+      std::fprintf(stderr, "expected --option=value, got: %s\n", argv[i]);
+      return false;
+    }
+    auto key = arg.substr(2, eq - 2);
+    auto str = std::string{arg.substr(eq + 1)};
+    auto num = std::strtod(str.c_str(), nullptr);
+    if (key == "host")
+      cfg.host = str;
+    else if (key == "http-port")
+      cfg.http_port = str;
+    else if (key == "cmd-port")
+      cfg.cmd_port = str;
+    else if (key == "http-connections")
+      cfg.http_connections = static_cast<size_t>(num);
+    else if (key == "cmd-connections")
+      cfg.cmd_connections = static_cast<size_t>(num);
+    else if (key == "subscribers")
+      cfg.subscribers = static_cast<size_t>(num);
+    else if (key == "items")
+      cfg.items = static_cast<int32_t>(num);
+    else if (key == "populate")
+      cfg.populate = num != 0;
+    else if (key == "read-ratio")
+      cfg.read_ratio = num;
+    else if (key == "list-ratio")
+      cfg.list_ratio = num;
+    else if (key == "dist" && (str == "uniform" || str == "zipf"))
+      cfg.zipf = str == "zipf";
+    else if (key == "zipf-s")
+      cfg.zipf_s = num;
+    else if (key == "warmup")
+      cfg.warmup = num;
+    else if (key == "duration")
+      cfg.duration = num;
+    else if (key == "seed")
+      cfg.seed = static_cast<uint64_t>(num);
+    else {
+      std::fprintf(stderr, "invalid option: %s\n", argv[i]);
+      return false;
+    }
+  }
+  if (cfg.items < 1 || cfg.duration <= 0 || cfg.warmup < 0) {
+    std::fprintf(stderr, "items and duration must be positive\n");
+    return false;
+  }
+  return true;
+}
+
+/// Shared state of all clients.
+struct run_state {
+  /// Tells all clients to stop.
+  std::atomic<bool> stop = false;
+  /// Clients only record operations that start at or after this point.
+  clock_type::time_point record_start;
+};
+
+/// Draws item IDs from `[1, n]`. With the Zipf distribution, the probability
+/// of ID `k` is proportional to `1 / k^s`, i.e., ID 1 is the hottest item.
+class key_generator {
+public:
+  key_generator(std::shared_ptr<const std::vector<double>> cdf, int32_t n,
+                uint64_t seed)
+    : cdf_(std::move(cdf)), n_(n), rng_(seed) {
+    // nop
+  }
+
+  /// Computes the cumulative distribution for `n` keys.
+  static std::shared_ptr<const std::vector<double>> zipf_cdf(int32_t n,
+                                                             double s) {
+    auto result = std::make_shared<std::vector<double>>();
+    result->reserve(static_cast<size_t>(n));
+    double sum = 0;
+    for (int32_t k = 1; k <= n; ++k) {
+      sum += 1.0 / std::pow(static_cast<double>(k), s);
+      result->push_back(sum);
+    }
+    for (auto& x : *result)
+      x /= sum;
+    return result;
+  }
+
+  int32_t next() {
+    if (cdf_ == nullptr)
+      return std::uniform_int_distribution<int32_t>{1, n_}(rng_);
+    auto u = std::uniform_real_distribution<double>{0, 1}(rng_);
+    auto i = std::lower_bound(cdf_->begin(), cdf_->end(), u);
+    return static_cast<int32_t>(std::min<ptrdiff_t>(i - cdf_->begin(),
+                                                    n_ - 1))
+           + 1;
+  }
+
+  /// Returns a number in `[0, 1)`.
+  double uniform() {
+    return std::uniform_real_distribution<double>{0, 1}(rng_);
+  }
+
+private:
+  std::shared_ptr<const std::vector<double>> cdf_;
+  int32_t n_;
+  std::mt19937_64 rng_;
+};
+
+
+/// Latencies and errors of one kind of operation.
+struct op_stats {
+  bench::hdr_histogram latency{max_latency};
+  uint64_t errors = 0;
+
+  void merge(const op_stats& other) {
+    latency.merge(other.latency);
+    errors += other.errors;
+  }
+};
+
+/// Limits how long `read` blocks on `fd`.
+void set_read_timeout(int fd, std::chrono::microseconds timeout) {
+  timeval tv{};
+  tv.tv_sec = static_cast<time_t>(timeout.count() / 1'000'000);
+  tv.tv_usec = static_cast<suseconds_t>(timeout.count() % 1'000'000);
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+int connect_with_timeout(const std::string& host, const std::string& port) {
+  auto fd = bench::connect_to(host.c_str(), port.c_str());
+  if (fd >= 0)
+    set_read_timeout(fd, response_timeout);
+  return fd;
+}
+
+/// A blocking HTTP/1.1 client that keeps its connection open. Reconnects
+/// after errors or when the server closes the connection.
+class http_client {
+public:
+  explicit http_client(const config& cfg) : cfg_(cfg) {
+    // nop
+  }
+
+  http_client(const http_client&) = delete;
+
+  http_client& operator=(const http_client&) = delete;
+
+  ~http_client() {
+    disconnect();
+  }
+
+  /// Sends a request and waits for the response.
+  /// @returns the status code or 0 if the connection failed.
+  int request(std::string_view method, std::string_view path,
+              std::string_view body = {}) {
+    if (fd_ < 0 && (fd_ = connect_with_timeout(cfg_.host, cfg_.http_port)) < 0)
+      return 0;
+    auto req = std::string{method};
+    req += ' ';
+    req += path;
+    req += " HTTP/1.1\r\nHost: ";
+    req += cfg_.host;
+    req += "\r\nContent-Type: application/json\r\nContent-Length: ";
+    req += std::to_string(body.size());
+    req += "\r\n\r\n";
+    req += body;
+    auto status = 0;
+    if (!bench::write_all(fd_, req) || !read_response(status)) {
+      disconnect();
+      return 0;
+    }
+    return status;
+  }
+
+private:
+  bool read_response(int& status) {
+    auto end = std::string::npos;
+    while ((end = buf_.find("\r\n\r\n")) == std::string::npos)
+      if (!bench::read_some(fd_, buf_))
+        return false;
+    // Parse the status line, e.g., "HTTP/1.1 200 OK".
+    if (buf_.compare(0, 5, "HTTP/") != 0 || buf_.size() < 12)
+      return false;
+    status = std::atoi(buf_.c_str() + 9);
+    // Scan the header fields for the content length and for "close".
+    size_t content_length = 0;
+    auto close_after = false;
+    auto header = std::string_view{buf_}.substr(0, end);
+    for (auto pos = header.find("\r\n"); pos != std::string_view::npos;) {
+      auto next = header.find("\r\n", pos + 2);
+      auto field = header.substr(pos + 2, next - pos - 2);
+      auto lower = std::string{field};
+      std::transform(lower.begin(), lower.end(), lower.begin(),
+                     [](unsigned char c) { return std::tolower(c); });
+      if (lower.compare(0, 15, "content-length:") == 0)
+        content_length = std::strtoul(lower.c_str() + 15, nullptr, 10);
+      else if (lower.compare(0, 11, "connection:") == 0
+               && lower.find("close") != std::string::npos)
+        close_after = true;
+      pos = next;
+    }
+    auto total = end + 4 + content_length;
+    if (!bench::read_at_least(fd_, buf_, total))
+      return false;
+    buf_.erase(0, total);
+    if (close_after)
+      disconnect();
+    return true;
+  }
+
+  void disconnect() {
+    if (fd_ >= 0) {
+      close(fd_);
+      fd_ = -1;
+    }
+    buf_.clear();
+  }
+
+  const config& cfg_;
+  int fd_ = -1;
+  std::string buf_;
+};
+
+/// Picks the item for the next write. Every increment is followed by a
+/// decrement of the same item, which never fails.
+class write_pairs {
+public:
+  /// Returns the item and whether to increment it.
+  std::pair<int32_t, bool> next(key_generator& keys) {
+    if (pending_) {
+      auto id = *pending_;
+      pending_.reset();
+      return {id, false};
+    }
+    pending_ = keys.next();
+    return {*pending_, true};
+  }
+
+private:
+  std::optional<int32_t> pending_;
+};
+
+/// Runs `fn` and records its latency if the operation started in the
+/// measurement phase. `fn` returns whether the operation succeeded.
+template <class F>
+void timed(const run_state& state, op_stats& stats, F&& fn) {
+  auto start = clock_type::now();
+  auto ok = fn();
+  if (start < state.record_start)
+    return;
+  auto elapsed = clock_type::now() - start;
+  stats.latency.record(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  if (!ok)
+    ++stats.errors;
+}
+
+/// Results of an HTTP client.
+struct http_results {
+  op_stats get;
+  op_stats list;
+  op_stats write;
+};
+
+void run_http_client(const config& cfg, const run_state& state,
+                     key_generator keys, http_results& out) {
+  auto client = http_client{cfg};
+  auto writes = write_pairs{};
+  auto is_ok = [](int status) { return status >= 200 && status < 300; };
+  while (!state.stop) {
+    if (keys.uniform() < cfg.read_ratio) {
+      auto id = keys.next();
+      if (keys.uniform() < cfg.list_ratio) {
+        auto path = "/items?from=" + std::to_string(id)
+                    + "&to=" + std::to_string(id + list_size - 1);
+        timed(state, out.list,
+              [&] { return is_ok(client.request("GET", path)); });
+      } else {
+        auto path = "/item/" + std::to_string(id);
+        timed(state, out.get,
+              [&] { return is_ok(client.request("GET", path)); });
+      }
+    } else {
+      auto [id, inc] = writes.next(keys);
+      auto path = "/item/" + std::to_string(id) + (inc ? "/inc/1" : "/dec/1");
+      timed(state, out.write,
+            [&] { return is_ok(client.request("PUT", path)); });
+    }
+  }
+}
+
+void run_cmd_client(const config& cfg, const run_state& state,
+                    key_generator keys, op_stats& out) {
+  auto writes = write_pairs{};
+  auto fd = -1;
+  auto buf = std::string{};
+  auto line = std::string{};
+  while (!state.stop) {
+    auto [id, inc] = writes.next(keys);
+    auto cmd = std::string{R"_({"type":")_"};
+    cmd += inc ? "inc" : "dec";
+    cmd += R"_(","id":)_";
+    cmd += std::to_string(id);
+    cmd += R"_(,"amount":1})_";
+    cmd += '\n';
+    timed(state, out, [&] {
+      if (fd < 0 && (fd = connect_with_timeout(cfg.host, cfg.cmd_port)) < 0)
+        return false;
+      if (!bench::write_all(fd, cmd) || !bench::read_line(fd, buf, line)) {
+        close(fd);
+        fd = -1;
+        buf.clear();
+        return false;
+      }
+      return line.find("error") == std::string::npos;
+    });
+    // Avoid spinning when the server is unreachable.
+    if (fd < 0)
+      std::this_thread::sleep_for(100ms);
+  }
+  if (fd >= 0)
+    close(fd);
+}
+
+/// Results of an `/events` subscriber.
+struct subscriber_results {
+  uint64_t events = 0;
+  uint64_t frames = 0;
+  bool connected = false;
+};
+
+/// Counts the events in a frame of the delta format.
+uint64_t count_events(std::string_view payload) {
+  uint64_t result = 0;
+  for (auto pos = payload.find("\"seq\":"); pos != std::string_view::npos;
+       pos = payload.find("\"seq\":", pos + 6))
+    ++result;
+  return result;
+}
+
+void run_subscriber(const config& cfg, const run_state& state,
+                    subscriber_results& out) {
+  auto fd = bench::connect_to(cfg.host.c_str(), cfg.http_port.c_str());
+  if (fd < 0)
+    return;
+  auto req = "GET /events?format=delta HTTP/1.1\r\nHost: " + cfg.host
+             + "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+               "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+               "Sec-WebSocket-Version: 13\r\n\r\n";
+  auto buf = std::string{};
+  auto end = std::string::npos;
+  if (!bench::write_all(fd, req)) {
+    close(fd);
+    return;
+  }
+  while ((end = buf.find("\r\n\r\n")) == std::string::npos)
+    if (!bench::read_some(fd, buf)) {
+      close(fd);
+      return;
+    }
+  if (buf.compare(0, 12, "HTTP/1.1 101") != 0) {
+    close(fd);
+    return;
+  }
+  out.connected = true;
+  buf.erase(0, end + 4);
+  // Read frames until the run ends. Server frames are never masked.
+  auto message = std::string{};
+  while (!state.stop) {
+    if (buf.size() < 2) {
+      pollfd pfd{fd, POLLIN, 0};
+      if (poll(&pfd, 1, 100) <= 0)
+        continue;
+      if (!bench::read_some(fd, buf))
+        break;
+      continue;
+    }
+    auto opcode = static_cast<uint8_t>(buf[0]) & 0x0F;
+    auto fin = (static_cast<uint8_t>(buf[0]) & 0x80) != 0;
+    size_t len = static_cast<uint8_t>(buf[1]) & 0x7F;
+    size_t offset = 2;
+    if (len >= 126) {
+      auto num_bytes = len == 126 ? size_t{2} : size_t{8};
+      if (!bench::read_at_least(fd, buf, 2 + num_bytes))
+        break;
+      len = 0;
+      for (size_t i = 0; i < num_bytes; ++i)
+        len = (len << 8) | static_cast<uint8_t>(buf[2 + i]);
+      offset += num_bytes;
+    }
+    if (!bench::read_at_least(fd, buf, offset + len))
+      break;
+    auto payload = std::string_view{buf}.substr(offset, len);
+    if (opcode == 0x8) {
+      break;
+    } else if (opcode == 0x9) {
+      // Answer pings with a masked pong (with an all-zero mask).
+      auto pong = std::string{"\x8A"};
+      pong += static_cast<char>(0x80 | std::min<size_t>(len, 125));
+      pong.append(4, '\0');
+      pong += payload.substr(0, 125);
+      bench::write_all(fd, pong);
+    } else if (opcode <= 0x2) {
+      message += payload;
+      if (fin) {
+        if (clock_type::now() >= state.record_start) {
+          out.events += count_events(message);
+          ++out.frames;
+        }
+        message.clear();
+      }
+    }
+    buf.erase(0, offset + len);
+  }
+  close(fd);
+}
+
+/// Adds all items with IDs in `[first, last]`. Items that already exist
+/// stay as they are.
+bool populate(const config& cfg, int32_t first, int32_t last) {
+  auto client = http_client{cfg};
+  for (auto id = first; id <= last; ++id) {
+    auto body = R"_({"name":"item-)_" + std::to_string(id)
+                + R"_(","price":)_" + std::to_string(id % 1000 + 1) + "}";
+    if (client.request("POST", "/item/" + std::to_string(id), body) == 0)
+      return false;
+  }
+  return true;
+}
+
+void print_row(const char* name, const op_stats& stats, double seconds) {
+  const auto& lat = stats.latency;
+  if (lat.total() == 0)
+    return;
+  auto us = [](int64_t ns) { return static_cast<double>(ns) / 1e3; };
+  std::printf("%-10s %10llu %8llu %12.0f %10.1f %10.1f %10.1f %10.1f\n", name,
+              static_cast<unsigned long long>(lat.total()),
+              static_cast<unsigned long long>(stats.errors),
+              static_cast<double>(lat.total()) / seconds, us(lat.value_at(50)),
+              us(lat.value_at(99)), us(lat.value_at(99.9)), us(lat.max()));
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  auto cfg = config{};
+  if (!parse_args(argc, argv, cfg))
+    return EXIT_FAILURE;
+  auto cdf = std::shared_ptr<const std::vector<double>>{};
+  if (cfg.zipf)
+    cdf = key_generator::zipf_cdf(cfg.items, cfg.zipf_s);
+  if (cfg.populate) {
+    std::printf("adding %d items ...\n", cfg.items);
+    auto workers = std::vector<std::thread>{};
+    auto num_workers = std::max<size_t>(cfg.http_connections, 1);
+    auto per_worker = cfg.items / static_cast<int32_t>(num_workers) + 1;
+    auto failed = std::atomic<bool>{false};
+    for (size_t i = 0; i < num_workers; ++i) {
+      auto first = static_cast<int32_t>(i) * per_worker + 1;
+      auto last = std::min(first + per_worker - 1, cfg.items);
+      workers.emplace_back([&cfg, &failed, first, last] {
+        if (!populate(cfg, first, last))
+          failed = true;
+      });
+    }
+    for (auto& worker : workers)
+      worker.join();
+    if (failed) {
+      std::fprintf(stderr, "failed to add the items\n");
+      return EXIT_FAILURE;
+    }
+  }
+  // Start all clients, then wait for the warmup and the measurement phase.
+  auto state = run_state{};
+  auto warmup = std::chrono::duration<double>{cfg.warmup};
+  auto duration = std::chrono::duration<double>{cfg.duration};
+  state.record_start = clock_type::now()
+                       + std::chrono::duration_cast<clock_type::duration>(
+                         warmup);
+  auto http = std::vector<http_results>(cfg.http_connections);
+  auto cmd = std::vector<op_stats>(cfg.cmd_connections);
+  auto subs = std::vector<subscriber_results>(cfg.subscribers);
+  auto threads = std::vector<std::thread>{};
+  uint64_t seed = cfg.seed;
+  for (auto& sub : subs)
+    threads.emplace_back([&cfg, &state, &sub] {
+      run_subscriber(cfg, state, sub);
+    });
+  for (auto& out : http)
+    threads.emplace_back([&cfg, &state, &out, keys = key_generator{
+                                                cdf, cfg.items, seed++}] {
+      run_http_client(cfg, state, keys, out);
+    });
+  for (auto& out : cmd)
+    threads.emplace_back([&cfg, &state, &out, keys = key_generator{
+                                                cdf, cfg.items, seed++}] {
+      run_cmd_client(cfg, state, keys, out);
+    });
+  std::printf("running for %.1f s after %.1f s of warmup ...\n", cfg.duration,
+              cfg.warmup);
+  std::this_thread::sleep_until(
+    state.record_start + std::chrono::duration_cast<clock_type::duration>(
+                           duration));
+  state.stop = true;
+  for (auto& thread : threads)
+    thread.join();
+  // Merge the results of all clients and print a summary in microseconds.
+  auto total = http_results{};
+  for (auto& out : http) {
+    total.get.merge(out.get);
+    total.list.merge(out.list);
+    total.write.merge(out.write);
+  }
+  auto cmd_total = op_stats{};
+  for (auto& out : cmd)
+    cmd_total.merge(out);
+  std::printf("%-10s %10s %8s %12s %10s %10s %10s %10s\n", "operation",
+              "count", "errors", "ops/s", "p50 us", "p99 us", "p999 us",
+              "max us");
+  print_row("http get", total.get, cfg.duration);
+  print_row("http list", total.list, cfg.duration);
+  print_row("http put", total.write, cfg.duration);
+  print_row("cmd", cmd_total, cfg.duration);
+  if (!subs.empty()) {
+    auto connected = std::count_if(subs.begin(), subs.end(),
+                                   [](auto& sub) { return sub.connected; });
+    uint64_t events = 0;
+    uint64_t frames = 0;
+    for (auto& sub : subs) {
+      events += sub.events;
+      frames += sub.frames;
+    }
+    std::printf("events: %zu of %zu subscribers connected, %llu events in "
+                "%llu frames, %.0f events/s per subscriber\n",
+                static_cast<size_t>(connected), subs.size(),
+                static_cast<unsigned long long>(events),
+                static_cast<unsigned long long>(frames),
+                connected > 0 ? static_cast<double>(events) / cfg.duration
+                                  / static_cast<double>(connected)
+                              : 0.0);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,497 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+// Runs the same cases against all storage engines. Both implementations of
+// `database` must behave the same way, so that the server may use either one.
+// A randomized run applies the same operations to both engines in lockstep
+// and compares every result.
+
+#include "database.hpp"
+#include "ec.hpp"
+#include "item.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <limits>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Must live in the namespace of `item` for `std::vector` to find them.
+
+bool operator==(const item& x, const item& y) {
+  return x.id == y.id && x.price == y.price && x.available == y.available
+         && x.name == y.name;
+}
+
+bool operator!=(const item& x, const item& y) {
+  return !(x == y);
+}
+
+namespace {
+
+int num_failures = 0;
+
+void fail(const char* file, int line, const std::string& what) {
+  std::fprintf(stderr, "%s:%d: %s\n", file, line, what.c_str());
+  ++num_failures;
+}
+
+#define CHECK(expr)                                                            \
+  do {                                                                         \
+    if (!(expr))                                                               \
+      fail(__FILE__, __LINE__, "check failed: " #expr);                        \
+  } while (false)
+
+#define CHECK_EC(expr, expected)                                               \
+  do {                                                                         \
+    auto res_ = (expr);                                                        \
+    if (res_ != (expected))                                                    \
+      fail(__FILE__, __LINE__,                                                 \
+           #expr " == " + to_string(res_) + ", expected "                      \
+             + to_string(expected));                                           \
+  } while (false)
+
+constexpr auto max_count = std::numeric_limits<int32_t>::max();
+
+/// Returns the IDs of `items`.
+std::vector<int32_t> ids_of(const std::vector<item>& items) {
+  auto result = std::vector<int32_t>{};
+  for (const auto& value : items)
+    result.push_back(value.id);
+  return result;
+}
+
+/// Owns a database in a fresh file and removes all its files afterwards.
+class fixture {
+public:
+  fixture(storage_engine engine, std::string_view name) : engine_(engine) {
+    auto path = std::filesystem::temp_directory_path();
+    path /= "warehouse-test-" + to_string(engine) + "-" + std::string{name};
+    file_ = path.string();
+    remove_files();
+    reopen();
+  }
+
+  fixture(const fixture&) = delete;
+
+  fixture& operator=(const fixture&) = delete;
+
+  ~fixture() {
+    db_.reset();
+    remove_files();
+  }
+
+  database& db() {
+    return *db_;
+  }
+
+  const std::string& file() const noexcept {
+    return file_;
+  }
+
+  /// Closes the database and opens it again from its file.
+  void reopen() {
+    db_.reset();
+    db_ = make_database(engine_, file_);
+    if (auto err = db_->open())
+      fail(__FILE__, __LINE__, "failed to open " + file_);
+  }
+
+private:
+  void remove_files() {
+    for (auto suffix : {"", "-journal", "-wal", "-shm", ".tmp"})
+      std::filesystem::remove(file_ + suffix);
+  }
+
+  storage_engine engine_;
+  std::string file_;
+  database_ptr db_;
+};
+
+/// Inserts items with the given IDs, named `item-<id>`.
+void populate(database& db, std::vector<int32_t> ids) {
+  for (auto id : ids)
+    CHECK_EC(db.insert(item{id, 100 + id, id, "item-" + std::to_string(id)}),
+             ec::nil);
+}
+
+void test_get(storage_engine engine) {
+  fixture fx{engine, "get"};
+  auto& db = fx.db();
+  CHECK(db.count() == 0);
+  CHECK(!db.get(1));
+  populate(db, {1, 2, 3});
+  CHECK(db.count() == 3);
+  auto value = db.get(2);
+  CHECK(value && *value == (item{2, 102, 2, "item-2"}));
+  CHECK_EC(db.insert(item{2, 1, 1, "dup"}), ec::key_already_exists);
+  CHECK(db.count() == 3);
+  CHECK(db.get(2)->name == "item-2");
+}
+
+void test_range(storage_engine engine) {
+  fixture fx{engine, "range"};
+  auto& db = fx.db();
+  populate(db, {5, 1, 3, 9, 7});
+  auto items = std::vector<item>{};
+  CHECK_EC(db.range(2, 8, items), ec::nil);
+  CHECK(ids_of(items) == (std::vector<int32_t>{3, 5, 7}));
+  items.clear();
+  CHECK_EC(db.range(1, 9, items, 2), ec::nil);
+  CHECK(ids_of(items) == (std::vector<int32_t>{1, 3}));
+  items.clear();
+  CHECK_EC(db.range(1, 9, items, 0), ec::nil);
+  CHECK(items.empty());
+  CHECK_EC(db.range(10, 20, items), ec::nil);
+  CHECK(items.empty());
+  CHECK_EC(db.range(8, 2, items), ec::nil);
+  CHECK(items.empty());
+  // The result receives additional items.
+  items.push_back(item{42, 0, 0, "x"});
+  CHECK_EC(db.range(9, 9, items), ec::nil);
+  CHECK(ids_of(items) == (std::vector<int32_t>{42, 9}));
+}
+
+void test_get_many(storage_engine engine) {
+  fixture fx{engine, "get_many"};
+  auto& db = fx.db();
+  populate(db, {1, 3, 9});
+  auto items = std::vector<item>{};
+  CHECK_EC(db.get_many({9, 2, 1, 9}, items), ec::nil);
+  CHECK(ids_of(items) == (std::vector<int32_t>{9, 1, 9}));
+  items.clear();
+  CHECK_EC(db.get_many({}, items), ec::nil);
+  CHECK(items.empty());
+}
+
+void test_mutations(storage_engine engine) {
+  fixture fx{engine, "mutations"};
+  auto& db = fx.db();
+  populate(db, {1, 2});
+  auto value = item{};
+  CHECK_EC(db.inc(1, 5, value), ec::nil);
+  CHECK(value == (item{1, 101, 6, "item-1"}));
+  CHECK_EC(db.dec(1, 2, value), ec::nil);
+  CHECK(value.available == 4);
+  CHECK_EC(db.dec(1, 10, value), ec::nil);
+  CHECK(value.available == 0);
+  CHECK_EC(db.del(2, value), ec::nil);
+  CHECK(value == (item{2, 102, 2, "item-2"}));
+  CHECK(!db.get(2));
+  CHECK(db.count() == 1);
+  // Missing items.
+  CHECK_EC(db.inc(2, 1, value), ec::no_such_item);
+  CHECK_EC(db.dec(2, 1, value), ec::no_such_item);
+  CHECK_EC(db.del(2, value), ec::no_such_item);
+  // Invalid amounts.
+  CHECK_EC(db.inc(1, 0, value), ec::invalid_argument);
+  CHECK_EC(db.inc(1, -1, value), ec::invalid_argument);
+  CHECK_EC(db.dec(1, 0, value), ec::invalid_argument);
+  CHECK_EC(db.dec(1, -1, value), ec::invalid_argument);
+  // The count must stay within 32 bits.
+  CHECK_EC(db.inc(1, max_count, value), ec::nil);
+  CHECK(value.available == max_count);
+  CHECK_EC(db.inc(1, 1, value), ec::invalid_argument);
+  CHECK(db.get(1)->available == max_count);
+  CHECK_EC(db.dec(1, max_count, value), ec::nil);
+  CHECK(value.available == 0);
+}
+
+void test_transactions(storage_engine engine) {
+  fixture fx{engine, "transactions"};
+  auto& db = fx.db();
+  populate(db, {1, 2});
+  auto value = item{};
+  // Commit.
+  CHECK_EC(db.begin(), ec::nil);
+  CHECK_EC(db.inc(1, 1, value), ec::nil);
+  CHECK_EC(db.commit(), ec::nil);
+  CHECK(db.get(1)->available == 2);
+  // Rollback reverts all kinds of mutations.
+  CHECK_EC(db.begin(), ec::nil);
+  CHECK_EC(db.inc(1, 1, value), ec::nil);
+  CHECK_EC(db.del(2, value), ec::nil);
+  populate(db, {3});
+  CHECK(db.count() == 2);
+  CHECK_EC(db.rollback(), ec::nil);
+  CHECK(db.get(1)->available == 2);
+  CHECK(db.get(2));
+  CHECK(!db.get(3));
+  // A savepoint outside of a transaction starts one.
+  CHECK_EC(db.savepoint(), ec::nil);
+  CHECK_EC(db.inc(1, 1, value), ec::nil);
+  CHECK_EC(db.release_savepoint(), ec::nil);
+  CHECK(db.get(1)->available == 3);
+  CHECK_EC(db.savepoint(), ec::nil);
+  CHECK_EC(db.inc(1, 1, value), ec::nil);
+  CHECK_EC(db.rollback_to_savepoint(), ec::nil);
+  CHECK(db.get(1)->available == 3);
+  // Savepoints nest into transactions.
+  CHECK_EC(db.begin(), ec::nil);
+  CHECK_EC(db.inc(1, 1, value), ec::nil);
+  CHECK_EC(db.savepoint(), ec::nil);
+  CHECK_EC(db.inc(1, 10, value), ec::nil);
+  CHECK_EC(db.del(2, value), ec::nil);
+  CHECK_EC(db.rollback_to_savepoint(), ec::nil);
+  CHECK_EC(db.savepoint(), ec::nil);
+  CHECK_EC(db.dec(2, 1, value), ec::nil);
+  CHECK_EC(db.release_savepoint(), ec::nil);
+  CHECK_EC(db.commit(), ec::nil);
+  CHECK(db.get(1)->available == 4);
+  CHECK(db.get(2)->available == 1);
+  // A rollback discards released savepoints.
+  CHECK_EC(db.begin(), ec::nil);
+  CHECK_EC(db.savepoint(), ec::nil);
+  CHECK_EC(db.inc(1, 1, value), ec::nil);
+  CHECK_EC(db.release_savepoint(), ec::nil);
+  CHECK_EC(db.rollback(), ec::nil);
+  CHECK(db.get(1)->available == 4);
+}
+
+void test_transaction_errors(storage_engine engine) {
+  fixture fx{engine, "transaction_errors"};
+  auto& db = fx.db();
+  populate(db, {1});
+  CHECK_EC(db.commit(), ec::database_inaccessible);
+  CHECK_EC(db.rollback(), ec::database_inaccessible);
+  CHECK_EC(db.release_savepoint(), ec::database_inaccessible);
+  CHECK_EC(db.rollback_to_savepoint(), ec::database_inaccessible);
+  CHECK_EC(db.begin(), ec::nil);
+  CHECK_EC(db.begin(), ec::database_inaccessible);
+  CHECK_EC(db.rollback(), ec::nil);
+  // Failed operations inside a transaction leave it intact.
+  auto value = item{};
+  CHECK_EC(db.begin(), ec::nil);
+  CHECK_EC(db.inc(1, 1, value), ec::nil);
+  CHECK_EC(db.inc(2, 1, value), ec::no_such_item);
+  CHECK_EC(db.insert(item{1, 0, 0, "dup"}), ec::key_already_exists);
+  CHECK_EC(db.commit(), ec::nil);
+  CHECK(db.get(1)->available == 2);
+}
+
+void test_reopen(storage_engine engine) {
+  fixture fx{engine, "reopen"};
+  populate(fx.db(), {1, 2, 3});
+  auto value = item{};
+  CHECK_EC(fx.db().inc(1, 5, value), ec::nil);
+  CHECK_EC(fx.db().del(2, value), ec::nil);
+  CHECK_EC(fx.db().begin(), ec::nil);
+  CHECK_EC(fx.db().inc(3, 5, value), ec::nil);
+  CHECK_EC(fx.db().commit(), ec::nil);
+  // Closing the database discards an unfinished transaction.
+  CHECK_EC(fx.db().begin(), ec::nil);
+  CHECK_EC(fx.db().inc(1, 100, value), ec::nil);
+  populate(fx.db(), {4});
+  fx.reopen();
+  auto& db = fx.db();
+  CHECK(db.count() == 2);
+  CHECK(db.get(1)->available == 6);
+  CHECK(!db.get(2));
+  CHECK(db.get(3)->available == 8);
+  CHECK(!db.get(4));
+  // The database remains writable after reopening.
+  CHECK_EC(db.inc(1, 1, value), ec::nil);
+  fx.reopen();
+  CHECK(fx.db().get(1)->available == 7);
+}
+
+/// Cuts a crash into the last commit of the memory engine's log and checks
+/// that replaying the log drops the whole commit.
+void test_torn_commit() {
+  for (auto corrupt_only : {false, true}) {
+    fixture fx{storage_engine::memory, "torn_commit"};
+    populate(fx.db(), {1, 2});
+    auto value = item{};
+    CHECK_EC(fx.db().begin(), ec::nil);
+    CHECK_EC(fx.db().inc(1, 5, value), ec::nil);
+    CHECK_EC(fx.db().del(2, value), ec::nil);
+    populate(fx.db(), {3});
+    CHECK_EC(fx.db().commit(), ec::nil);
+    fx.reopen();
+    CHECK(fx.db().count() == 2);
+    CHECK_EC(fx.db().savepoint(), ec::nil);
+    CHECK_EC(fx.db().inc(1, 5, value), ec::nil);
+    CHECK_EC(fx.db().inc(3, 5, value), ec::nil);
+    CHECK_EC(fx.db().release_savepoint(), ec::nil);
+    auto size = std::filesystem::file_size(fx.file());
+    if (corrupt_only) {
+      // A complete frame with a wrong checksum, e.g., after the file system
+      // grew the file but did not write the data yet.
+      auto* out = std::fopen(fx.file().c_str(), "r+b");
+      CHECK(out != nullptr);
+      if (out != nullptr) {
+        std::fseek(out, static_cast<long>(size) - 1, SEEK_SET);
+        std::fputc('?', out);
+        std::fclose(out);
+      }
+    } else {
+      std::filesystem::resize_file(fx.file(), size - 3);
+    }
+    fx.reopen();
+    auto& db = fx.db();
+    CHECK(db.count() == 2);
+    CHECK(db.get(1)->available == 6);
+    CHECK(db.get(3)->available == 3);
+  }
+}
+
+/// Applies the same random operations to all engines and compares the
+/// results.
+void test_random(size_t num_ops) {
+  auto engines = std::vector<storage_engine>{storage_engine::sqlite,
+                                             storage_engine::memory};
+  auto fixtures = std::vector<std::unique_ptr<fixture>>{};
+  for (auto engine : engines)
+    fixtures.push_back(std::make_unique<fixture>(engine, "random"));
+  auto rng = std::minstd_rand{42};
+  auto pick = [&rng](int32_t lo, int32_t hi) {
+    return std::uniform_int_distribution<int32_t>{lo, hi}(rng);
+  };
+  auto amount = [&] {
+    switch (pick(0, 9)) {
+      case 0:
+        return pick(-2, 0);
+      case 1:
+        return pick(max_count / 2, max_count);
+      default:
+        return pick(1, 50);
+    }
+  };
+  // Keep most operations inside transactions to make the run fast.
+  auto in_transaction = false;
+  for (size_t i = 0; i < num_ops; ++i) {
+    auto op = pick(0, 15);
+    auto id = pick(1, 64);
+    auto n = amount();
+    auto other_id = pick(1, 64);
+    auto extra = pick(-1, 9);
+    auto results = std::vector<ec>{};
+    auto values = std::vector<std::vector<item>>{};
+    for (auto& fx : fixtures) {
+      auto& db = fx->db();
+      auto value = item{};
+      auto items = std::vector<item>{};
+      auto res = ec::nil;
+      switch (op) {
+        case 0:
+        case 1:
+          res = db.insert(item{id, n, extra, "i" + std::to_string(id)});
+          break;
+        case 2:
+        case 3:
+        case 4:
+          res = db.inc(id, n, value);
+          items.push_back(value);
+          break;
+        case 5:
+        case 6:
+          res = db.dec(id, n, value);
+          items.push_back(value);
+          break;
+        case 7:
+          res = db.del(id, value);
+          items.push_back(value);
+          break;
+        case 8:
+          if (auto x = db.get(id))
+            items.push_back(*x);
+          break;
+        case 9:
+          res = db.range(id, other_id, items, extra);
+          break;
+        case 10:
+          res = db.get_many({id, other_id, id}, items);
+          break;
+        case 11:
+          res = in_transaction ? db.commit() : db.begin();
+          break;
+        case 12:
+          res = in_transaction ? db.rollback() : db.begin();
+          break;
+        case 13:
+          res = db.savepoint();
+          break;
+        case 14:
+          res = db.release_savepoint();
+          break;
+        default:
+          res = db.rollback_to_savepoint();
+      }
+      // Only successful mutations produce a value.
+      if (op >= 2 && op <= 7 && res != ec::nil)
+        items.clear();
+      results.push_back(res);
+      values.push_back(std::move(items));
+    }
+    if (op == 11 || op == 12) {
+      if (results[0] == ec::nil)
+        in_transaction = !in_transaction;
+    } else if (op == 13 && !in_transaction && results[0] == ec::nil) {
+      // The outermost savepoint started a transaction. Release it right away
+      // to keep the bookkeeping above simple.
+      for (auto& fx : fixtures)
+        CHECK_EC(fx->db().release_savepoint(), ec::nil);
+    }
+    for (size_t j = 1; j < fixtures.size(); ++j) {
+      if (results[j] != results[0] || values[j].size() != values[0].size()) {
+        fail(__FILE__, __LINE__,
+             "engines disagree at operation " + std::to_string(i) + " (op "
+               + std::to_string(op) + "): " + to_string(results[0]) + " vs. "
+               + to_string(results[j]));
+        return;
+      }
+      for (size_t k = 0; k < values[0].size(); ++k) {
+        if (values[j][k] != values[0][k]) {
+          fail(__FILE__, __LINE__,
+               "engines return different items at operation "
+                 + std::to_string(i));
+          return;
+        }
+      }
+    }
+  }
+  if (in_transaction)
+    for (auto& fx : fixtures)
+      CHECK_EC(fx->db().commit(), ec::nil);
+  // Compare the final state, before and after reopening.
+  for (auto reopen : {false, true}) {
+    auto all = std::vector<std::vector<item>>{};
+    for (auto& fx : fixtures) {
+      if (reopen)
+        fx->reopen();
+      auto& items = all.emplace_back();
+      CHECK_EC(fx->db().range(std::numeric_limits<int32_t>::min(), max_count,
+                              items),
+               ec::nil);
+    }
+    for (size_t j = 1; j < all.size(); ++j)
+      CHECK(all[j] == all[0]);
+  }
+}
+
+} // namespace
+
+int main() {
+  for (auto engine : {storage_engine::sqlite, storage_engine::memory}) {
+    std::printf("engine: %s\n", to_string(engine).c_str());
+    test_get(engine);
+    test_range(engine);
+    test_get_many(engine);
+    test_mutations(engine);
+    test_transactions(engine);
+    test_transaction_errors(engine);
+    test_reopen(engine);
+  }
+  test_torn_commit();
+  test_random(20'000);
+  if (num_failures > 0) {
+    std::printf("%d checks failed\n", num_failures);
+    return EXIT_FAILURE;
+  }
+  std::printf("all checks passed\n");
+  return EXIT_SUCCESS;
+}
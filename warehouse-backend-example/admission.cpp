@@ -0,0 +1,157 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "admission.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+int64_t now_ns() noexcept {
+  auto t = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+}
+
+} // namespace
+
+concurrency_limiter::concurrency_limiter(const admission_config& cfg,
+                                         std::chrono::nanoseconds grace,
+                                         metric_ids ids)
+  : min_limit_(static_cast<double>(std::max(cfg.min_limit, size_t{1}))),
+    max_limit_(std::max(static_cast<double>(cfg.max_limit), min_limit_)),
+    target_ns_(cfg.target_latency.count()),
+    grace_ns_(grace.count()),
+    backoff_(cfg.backoff),
+    ids_(ids),
+    limit_(std::clamp(static_cast<double>(cfg.initial_limit), min_limit_,
+                      max_limit_)) {
+  metrics::add(ids_.limit, static_cast<int64_t>(limit()));
+}
+
+bool concurrency_limiter::try_acquire() noexcept {
+  auto n = in_flight_.fetch_add(1, std::memory_order_relaxed);
+  if (static_cast<double>(n) >= limit_.load(std::memory_order_relaxed)) {
+    in_flight_.fetch_sub(1, std::memory_order_relaxed);
+    metrics::inc(ids_.shed);
+    return false;
+  }
+  metrics::add(ids_.in_flight, 1);
+  return true;
+}
+
+void concurrency_limiter::release(std::chrono::nanoseconds latency,
+                                  bool overloaded) noexcept {
+  auto n = in_flight_.fetch_sub(1, std::memory_order_relaxed);
+  metrics::add(ids_.in_flight, -1);
+  if (overloaded || latency.count() - grace_ns_ > target_ns_) {
+    // Multiplicative decrease, once per target latency.
+    auto now = now_ns();
+    auto last = last_decrease_.load(std::memory_order_relaxed);
+    if (now - last < target_ns_
+        || !last_decrease_.compare_exchange_strong(last, now,
+                                                   std::memory_order_relaxed))
+      return;
+    update([this](double x) { return x * backoff_; });
+    return;
+  }
+  // Additive increase, but only while the budget is at least half in use.
+  // Otherwise, the limit would grow during idle periods without proving that
+  // the database can keep up.
+  update([n](double x) {
+    return 2 * static_cast<double>(n) >= x ? x + 1.0 / x : x;
+  });
+}
+
+void concurrency_limiter::release() noexcept {
+  in_flight_.fetch_sub(1, std::memory_order_relaxed);
+  metrics::add(ids_.in_flight, -1);
+}
+
+size_t concurrency_limiter::limit() const noexcept {
+  return static_cast<size_t>(limit_.load(std::memory_order_relaxed));
+}
+
+size_t concurrency_limiter::in_flight() const noexcept {
+  auto n = in_flight_.load(std::memory_order_relaxed);
+  return n > 0 ? static_cast<size_t>(n) : 0;
+}
+
+template <class F>
+void concurrency_limiter::update(F fn) noexcept {
+  auto old_limit = limit_.load(std::memory_order_relaxed);
+  auto new_limit = 0.0;
+  do {
+    new_limit = std::clamp(fn(old_limit), min_limit_, max_limit_);
+    if (new_limit == old_limit)
+      return;
+  } while (!limit_.compare_exchange_weak(old_limit, new_limit,
+                                         std::memory_order_relaxed));
+  // The gauge shows the integral part of the limit.
+  auto delta = static_cast<int64_t>(std::floor(new_limit))
+               - static_cast<int64_t>(std::floor(old_limit));
+  if (delta != 0)
+    metrics::add(ids_.limit, delta);
+}
+
+struct admission_permit::slot {
+  explicit slot(concurrency_limiter* limiter)
+    : limiter(limiter), start(std::chrono::steady_clock::now()) {
+    // nop
+  }
+
+  ~slot() {
+    if (!done)
+      limiter->release();
+  }
+
+  concurrency_limiter* limiter;
+  std::chrono::steady_clock::time_point start;
+  bool done = false;
+};
+
+admission_permit::admission_permit(concurrency_limiter* limiter)
+  : admitted_(true), slot_(std::make_shared<slot>(limiter)) {
+  // nop
+}
+
+admission_permit admission_permit::unlimited() {
+  auto result = admission_permit{};
+  result.admitted_ = true;
+  return result;
+}
+
+void admission_permit::complete(bool overloaded) const noexcept {
+  if (!slot_ || slot_->done)
+    return;
+  slot_->done = true;
+  auto elapsed = std::chrono::steady_clock::now() - slot_->start;
+  slot_->limiter->release(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed), overloaded);
+}
+
+admission_control::admission_control(const admission_config& cfg) {
+  if (cfg.max_limit == 0)
+    return;
+  using ids = concurrency_limiter::metric_ids;
+  reads_ = std::make_unique<concurrency_limiter>(
+    cfg, std::chrono::nanoseconds{0},
+    ids{metrics::gauge::admission_read_limit,
+        metrics::gauge::admission_read_in_flight,
+        metrics::counter::admission_read_shed});
+  // Writes may wait for the commit window before the database even starts
+  // working on them.
+  writes_ = std::make_unique<concurrency_limiter>(
+    cfg, cfg.commit_window,
+    ids{metrics::gauge::admission_write_limit,
+        metrics::gauge::admission_write_in_flight,
+        metrics::counter::admission_write_shed});
+}
+
+admission_permit admission_control::admit(traffic_class what) {
+  if (!reads_)
+    return admission_permit::unlimited();
+  auto* limiter = what == traffic_class::read ? reads_.get() : writes_.get();
+  if (!limiter->try_acquire())
+    return admission_permit{};
+  return admission_permit{limiter};
+}
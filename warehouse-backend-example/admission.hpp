@@ -0,0 +1,147 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "metrics.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/// Selects the budget of `admission_control` that a request draws from.
+enum class traffic_class {
+  /// Requests that only read items.
+  read,
+  /// Requests that modify items.
+  write,
+};
+
+/// Configures the limiters of `admission_control`.
+struct admission_config {
+  /// Lower bound for each concurrency limit.
+  size_t min_limit = 4;
+  /// Upper bound for each concurrency limit. The default of 0 disables
+  /// admission control.
+  size_t max_limit = 0;
+  /// Limit before observing any latency.
+  size_t initial_limit = 64;
+  /// Requests that take longer than this signal an overloaded database.
+  std::chrono::nanoseconds target_latency = std::chrono::milliseconds{50};
+  /// Time that writes may spend waiting for a shared commit. Does not count
+  /// towards `target_latency`, because the wait says nothing about the load.
+  std::chrono::nanoseconds commit_window = std::chrono::nanoseconds{0};
+  /// Factor for shrinking a limit after a signal of overload.
+  double backoff = 0.9;
+};
+
+/// Limits the number of outstanding requests with an adaptive limit. The
+/// limit grows by one for each limit's worth of fast responses and shrinks by
+/// `backoff` when responses exceed the target latency or time out (AIMD).
+/// Shrinks at most once per target latency, because all requests that were
+/// in flight at the time of an overload report it. Thread-safe.
+class concurrency_limiter {
+public:
+  /// Metrics that reflect the state of a limiter.
+  struct metric_ids {
+    metrics::gauge limit;
+    metrics::gauge in_flight;
+    metrics::counter shed;
+  };
+
+  /// @param grace Latency per request that does not count towards the target
+  ///              latency.
+  concurrency_limiter(const admission_config& cfg,
+                      std::chrono::nanoseconds grace, metric_ids ids);
+
+  concurrency_limiter(const concurrency_limiter&) = delete;
+
+  concurrency_limiter& operator=(const concurrency_limiter&) = delete;
+
+  /// Takes a slot if the number of outstanding requests is below the limit.
+  bool try_acquire() noexcept;
+
+  /// Returns a slot and adapts the limit to the observed latency.
+  /// @param overloaded Signals an overload regardless of `latency`, e.g.,
+  ///                   after a timeout.
+  void release(std::chrono::nanoseconds latency, bool overloaded) noexcept;
+
+  /// Returns a slot without adapting the limit, e.g., when a client
+  /// disconnects before receiving the result.
+  void release() noexcept;
+
+  /// Returns the current limit.
+  size_t limit() const noexcept;
+
+  /// Returns the number of outstanding requests.
+  size_t in_flight() const noexcept;
+
+private:
+  /// Sets the limit to `fn(old)`, clamped to the configured bounds.
+  template <class F>
+  void update(F fn) noexcept;
+
+  double min_limit_;
+  double max_limit_;
+  int64_t target_ns_;
+  int64_t grace_ns_;
+  double backoff_;
+  metric_ids ids_;
+  std::atomic<double> limit_;
+  std::atomic<int64_t> in_flight_{0};
+  std::atomic<int64_t> last_decrease_{0};
+};
+
+/// Grants a request a slot of a `concurrency_limiter`. Copies share the slot,
+/// so asynchronous callbacks may capture a copy. The slot returns to the
+/// limiter on `complete` or when the last copy goes away.
+class admission_permit {
+public:
+  admission_permit() = default;
+
+  /// Creates a permit for a slot that the caller took from `limiter`.
+  explicit admission_permit(concurrency_limiter* limiter);
+
+  /// Creates a permit that does not hold a slot, i.e., for requests that
+  /// bypass admission control.
+  static admission_permit unlimited();
+
+  /// Returns whether the request may proceed.
+  explicit operator bool() const noexcept {
+    return admitted_;
+  }
+
+  /// Returns the slot and reports the latency since creating the permit.
+  /// Calls after the first have no effect.
+  void complete(bool overloaded = false) const noexcept;
+
+private:
+  struct slot;
+
+  bool admitted_ = false;
+  std::shared_ptr<slot> slot_;
+};
+
+/// Sheds requests to the database actors before their mailboxes grow without
+/// bounds. Reads and writes have separate budgets, because a backlog of
+/// commits should not starve GET requests and vice versa.
+class admission_control {
+public:
+  explicit admission_control(const admission_config& cfg);
+
+  admission_control(const admission_control&) = delete;
+
+  admission_control& operator=(const admission_control&) = delete;
+
+  /// Tries to admit a request of class `what`.
+  /// @returns a permit that converts to `false` if the request must be shed.
+  admission_permit admit(traffic_class what);
+
+private:
+  /// Both limiters are `nullptr` if admission control is disabled.
+  std::unique_ptr<concurrency_limiter> reads_;
+  std::unique_ptr<concurrency_limiter> writes_;
+};
+
+using admission_control_ptr = std::shared_ptr<admission_control>;
@@ -0,0 +1,170 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "aggregate.hpp"
+
+// The vectorized kernels use per-function target attributes instead of global
+// compiler flags. Hence, the binary still runs on CPUs without AVX2 and picks
+// the kernels at runtime.
+#if (defined(__x86_64__) || defined(__i386__))                                 \
+  && (defined(__GNUC__) || defined(__clang__))
+#  define WAREHOUSE_X86_SIMD 1
+#  include <immintrin.h>
+#endif
+
+namespace {
+
+int64_t stock_value_scalar(const int32_t* prices, const int32_t* available,
+                           size_t n) {
+  int64_t result = 0;
+  for (size_t i = 0; i < n; ++i)
+    result += int64_t{prices[i]} * available[i];
+  return result;
+}
+
+size_t count_below_scalar(const int32_t* values, size_t n,
+                          int32_t threshold) {
+  size_t result = 0;
+  for (size_t i = 0; i < n; ++i)
+    result += values[i] < threshold ? 1 : 0;
+  return result;
+}
+
+#ifdef WAREHOUSE_X86_SIMD
+
+__attribute__((target("sse4.1"))) int64_t
+stock_value_sse4(const int32_t* prices, const int32_t* available, size_t n) {
+  // `_mm_mul_epi32` multiplies the lower 32 bits of each 64-bit lane. We
+  // shift the odd elements down for the second multiplication.
+  auto acc = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prices + i));
+    auto y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(available + i));
+    acc = _mm_add_epi64(acc, _mm_mul_epi32(x, y));
+    acc = _mm_add_epi64(acc, _mm_mul_epi32(_mm_srli_epi64(x, 32),
+                                           _mm_srli_epi64(y, 32)));
+  }
+  int64_t lanes[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+  return lanes[0] + lanes[1] + stock_value_scalar(prices + i, available + i,
+                                                  n - i);
+}
+
+__attribute__((target("sse4.1"))) size_t
+count_below_sse4(const int32_t* values, size_t n, int32_t threshold) {
+  // Each comparison yields -1 per matching lane, so subtracting the mask
+  // counts the matches per lane.
+  auto limit = _mm_set1_epi32(threshold);
+  auto acc = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+    acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(limit, x));
+  }
+  int32_t lanes[4];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+  size_t result = 0;
+  for (auto lane : lanes)
+    result += static_cast<uint32_t>(lane);
+  return result + count_below_scalar(values + i, n - i, threshold);
+}
+
+__attribute__((target("avx2"))) int64_t
+stock_value_avx2(const int32_t* prices, const int32_t* available, size_t n) {
+  auto acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prices + i));
+    auto y = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(available + i));
+    acc = _mm256_add_epi64(acc, _mm256_mul_epi32(x, y));
+    acc = _mm256_add_epi64(acc, _mm256_mul_epi32(_mm256_srli_epi64(x, 32),
+                                                 _mm256_srli_epi64(y, 32)));
+  }
+  int64_t lanes[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3]
+         + stock_value_scalar(prices + i, available + i, n - i);
+}
+
+__attribute__((target("avx2"))) size_t
+count_below_avx2(const int32_t* values, size_t n, int32_t threshold) {
+  auto limit = _mm256_set1_epi32(threshold);
+  auto acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+    acc = _mm256_sub_epi32(acc, _mm256_cmpgt_epi32(limit, x));
+  }
+  int32_t lanes[8];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+  size_t result = 0;
+  for (auto lane : lanes)
+    result += static_cast<uint32_t>(lane);
+  return result + count_below_scalar(values + i, n - i, threshold);
+}
+
+#endif // WAREHOUSE_X86_SIMD
+
+constexpr aggregate_kernels scalar_kernels{
+  simd_level::scalar,
+  stock_value_scalar,
+  count_below_scalar,
+};
+
+#ifdef WAREHOUSE_X86_SIMD
+
+constexpr aggregate_kernels sse4_kernels{
+  simd_level::sse4,
+  stock_value_sse4,
+  count_below_sse4,
+};
+
+constexpr aggregate_kernels avx2_kernels{
+  simd_level::avx2,
+  stock_value_avx2,
+  count_below_avx2,
+};
+
+#endif // WAREHOUSE_X86_SIMD
+
+} // namespace
+
+std::string to_string(simd_level level) {
+  switch (level) {
+    default:
+      return "scalar";
+    case simd_level::sse4:
+      return "sse4";
+    case simd_level::avx2:
+      return "avx2";
+  }
+}
+
+simd_level detect_simd_level() noexcept {
+#ifdef WAREHOUSE_X86_SIMD
+  if (__builtin_cpu_supports("avx2"))
+    return simd_level::avx2;
+  if (__builtin_cpu_supports("sse4.1"))
+    return simd_level::sse4;
+#endif
+  return simd_level::scalar;
+}
+
+const aggregate_kernels& kernels_for(simd_level level) noexcept {
+#ifdef WAREHOUSE_X86_SIMD
+  auto supported = detect_simd_level();
+  if (level == simd_level::avx2 && supported == simd_level::avx2)
+    return avx2_kernels;
+  if (level >= simd_level::sse4 && supported >= simd_level::sse4)
+    return sse4_kernels;
+#else
+  static_cast<void>(level);
+#endif
+  return scalar_kernels;
+}
+
+const aggregate_kernels& default_kernels() noexcept {
+  static const aggregate_kernels& result = kernels_for(detect_simd_level());
+  return result;
+}
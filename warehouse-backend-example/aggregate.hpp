@@ -0,0 +1,45 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// Selects the instruction set for the aggregation kernels.
+enum class simd_level : uint8_t {
+  /// Plain C++ loops.
+  scalar,
+  /// 128-bit vectors (SSE4.1).
+  sse4,
+  /// 256-bit vectors (AVX2).
+  avx2,
+};
+
+/// @relates simd_level
+std::string to_string(simd_level level);
+
+/// Returns the best level that both the compiler and the CPU support.
+simd_level detect_simd_level() noexcept;
+
+/// Aggregation kernels over columns of `int32_t` values.
+struct aggregate_kernels {
+  /// The instruction set of the kernels.
+  simd_level level;
+
+  /// Computes the sum of `prices[i] * available[i]` for all `i < n`.
+  int64_t (*stock_value)(const int32_t* prices, const int32_t* available,
+                         size_t n);
+
+  /// Counts the values below `threshold`.
+  /// @pre `n <= INT32_MAX`
+  size_t (*count_below)(const int32_t* values, size_t n, int32_t threshold);
+};
+
+/// Returns the kernels for `level`. Falls back to the next lower level that
+/// the compiler and the CPU support.
+const aggregate_kernels& kernels_for(simd_level level) noexcept;
+
+/// Returns the kernels for `detect_simd_level()`. Detects the CPU features
+/// only once.
+const aggregate_kernels& default_kernels() noexcept;
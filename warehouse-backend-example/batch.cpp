@@ -0,0 +1,63 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "batch.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+std::string_view op_type_names[] = {
+  "inc",
+  "dec",
+  "del",
+};
+
+} // namespace
+
+std::string to_string(op_type x) {
+  return std::string{op_type_names[static_cast<uint8_t>(x)]};
+}
+
+bool from_string(std::string_view name, op_type& x) {
+  for (size_t i = 0; i < std::size(op_type_names); ++i) {
+    if (name == op_type_names[i]) {
+      x = static_cast<op_type>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool from_integer(uint8_t value, op_type& x) {
+  if (value < std::size(op_type_names)) {
+    x = static_cast<op_type>(value);
+    return true;
+  }
+  return false;
+}
+
+std::string batch_to_json(bool atomic, const std::vector<batch_result>& xs) {
+  auto failed = [](const batch_result& x) { return x.code != ec::nil; };
+  auto committed = !atomic || std::none_of(xs.begin(), xs.end(), failed);
+  std::string result = R"_({"committed":)_";
+  result += committed ? "true" : "false";
+  result += R"_(,"results":[)_";
+  for (size_t i = 0; i < xs.size(); ++i) {
+    if (i > 0)
+      result += ',';
+    result += R"_({"id":)_";
+    result += std::to_string(xs[i].id);
+    if (xs[i].code == ec::nil) {
+      result += R"_(,"available":)_";
+      result += std::to_string(xs[i].available);
+    } else {
+      result += R"_(,"error":")_";
+      result += to_string(xs[i].code);
+      result += '"';
+    }
+    result += '}';
+  }
+  result += "]}";
+  return result;
+}
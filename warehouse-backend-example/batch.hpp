@@ -0,0 +1,79 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "ec.hpp"
+
+#include <caf/default_enum_inspect.hpp>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// The kind of a single operation in a batch.
+enum class op_type : uint8_t {
+  /// Increments the available count of an item.
+  inc,
+  /// Decrements the available count of an item.
+  dec,
+  /// Deletes an item.
+  del,
+};
+
+/// @relates op_type
+std::string to_string(op_type);
+
+/// @relates op_type
+bool from_string(std::string_view, op_type&);
+
+/// @relates op_type
+bool from_integer(uint8_t, op_type&);
+
+/// @relates op_type
+template <class Inspector>
+bool inspect(Inspector& f, op_type& x) {
+  return caf::default_enum_inspect(f, x);
+}
+
+/// A single operation in a batch.
+struct batch_op {
+  op_type type = op_type::inc;
+  int32_t id = 0;
+  int32_t amount = 0; // Ignored for `del`.
+};
+
+template <class Inspector>
+bool inspect(Inspector& f, batch_op& x) {
+  return f.object(x).fields(f.field("type", x.type), f.field("id", x.id),
+                            f.field("amount", x.amount).fallback(0));
+}
+
+/// The outcome of a single operation in a batch.
+struct batch_result {
+  int32_t id = 0;
+  ec code = ec::nil;
+  int32_t available = 0; // The available count after the operation.
+};
+
+template <class Inspector>
+bool inspect(Inspector& f, batch_result& x) {
+  return f.object(x).fields(f.field("id", x.id), f.field("code", x.code),
+                            f.field("available", x.available));
+}
+
+/// A batch of operations as sent by clients.
+struct batch_request {
+  bool atomic = false;
+  std::vector<batch_op> ops;
+};
+
+template <class Inspector>
+bool inspect(Inspector& f, batch_request& x) {
+  return f.object(x).fields(f.field("atomic", x.atomic).fallback(false),
+                            f.field("ops", x.ops));
+}
+
+/// Renders the outcome of a batch as JSON object with the fields "committed"
+/// and "results". Each result either has an "available" or an "error" field.
+std::string batch_to_json(bool atomic, const std::vector<batch_result>& xs);
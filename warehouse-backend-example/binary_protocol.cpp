@@ -0,0 +1,72 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "binary_protocol.hpp"
+
+#include "types.hpp"
+
+#include <caf/error.hpp>
+#include <caf/type_id.hpp>
+
+namespace {
+
+void write_int32(int32_t value, std::byte* out) {
+  auto x = static_cast<uint32_t>(value);
+  out[0] = static_cast<std::byte>(x >> 24);
+  out[1] = static_cast<std::byte>(x >> 16);
+  out[2] = static_cast<std::byte>(x >> 8);
+  out[3] = static_cast<std::byte>(x);
+}
+
+int32_t read_int32(const std::byte* in) {
+  auto x = (static_cast<uint32_t>(in[0]) << 24)
+           | (static_cast<uint32_t>(in[1]) << 16)
+           | (static_cast<uint32_t>(in[2]) << 8)
+           | static_cast<uint32_t>(in[3]);
+  return static_cast<int32_t>(x);
+}
+
+} // namespace
+
+namespace binary_protocol {
+
+bool decode_request(caf::const_byte_span bytes, batch_op& result) {
+  if (bytes.size() != request_size)
+    return false;
+  if (!from_integer(static_cast<uint8_t>(bytes[0]), result.type))
+    return false;
+  result.id = read_int32(bytes.data() + 1);
+  result.amount = read_int32(bytes.data() + 5);
+  return true;
+}
+
+request_record encode_request(const batch_op& op) {
+  request_record result;
+  result[0] = static_cast<std::byte>(op.type);
+  write_int32(op.id, result.data() + 1);
+  write_int32(op.amount, result.data() + 5);
+  return result;
+}
+
+bool decode_response(caf::const_byte_span bytes, uint8_t& status,
+                     int32_t& available) {
+  if (bytes.size() != response_size)
+    return false;
+  status = static_cast<uint8_t>(bytes[0]);
+  available = read_int32(bytes.data() + 1);
+  return true;
+}
+
+response_record encode_response(uint8_t status, int32_t available) {
+  response_record result;
+  result[0] = static_cast<std::byte>(status);
+  write_int32(available, result.data() + 1);
+  return result;
+}
+
+response_record encode_error(const caf::error& what) {
+  if (what.category() == caf::type_id_v<ec>)
+    return encode_response(what.code(), 0);
+  return encode_response(status_unknown, 0);
+}
+
+} // namespace binary_protocol
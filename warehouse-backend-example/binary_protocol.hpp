@@ -0,0 +1,70 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "batch.hpp"
+
+#include <caf/byte_span.hpp>
+#include <caf/fwd.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/// Fixed-width records for the binary command port. Each record travels in a
+/// length-prefixed frame (see `caf::net::lp`) and all integers use network
+/// byte order.
+///
+/// Requests have 9 bytes:
+///
+/// | Offset | Size | Field                              |
+/// |--------|------|------------------------------------|
+/// | 0      | 1    | opcode (0 = inc, 1 = dec, 2 = del) |
+/// | 1      | 4    | item ID (signed)                   |
+/// | 5      | 4    | amount (signed, 0 for del)         |
+///
+/// Responses have 5 bytes and arrive in the order of the requests:
+///
+/// | Offset | Size | Field                                      |
+/// |--------|------|--------------------------------------------|
+/// | 0      | 1    | status (an `ec` value or `status_unknown`) |
+/// | 1      | 4    | available count after the operation        |
+namespace binary_protocol {
+
+/// The size of a request record in bytes.
+constexpr size_t request_size = 9;
+
+/// The size of a response record in bytes.
+constexpr size_t response_size = 5;
+
+/// Status for errors that have no representation as `ec`, e.g., timeouts.
+constexpr uint8_t status_unknown = 0xFF;
+
+using request_record = std::array<std::byte, request_size>;
+
+using response_record = std::array<std::byte, response_size>;
+
+/// Decodes a request record.
+/// @returns `false` if `bytes` has the wrong size or an unknown opcode.
+bool decode_request(caf::const_byte_span bytes, batch_op& result);
+
+/// Encodes a request record.
+request_record encode_request(const batch_op& op);
+
+/// Decodes a response record.
+/// @returns `false` if `bytes` has the wrong size.
+bool decode_response(caf::const_byte_span bytes, uint8_t& status,
+                     int32_t& available);
+
+/// Encodes a response record.
+response_record encode_response(uint8_t status, int32_t available);
+
+/// Encodes the response for a successful operation.
+inline response_record encode_result(int32_t available) {
+  return encode_response(static_cast<uint8_t>(ec::nil), available);
+}
+
+/// Encodes the response for a failed operation.
+response_record encode_error(const caf::error& what);
+
+} // namespace binary_protocol
@@ -0,0 +1,196 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "command.hpp"
+
+#include <charconv>
+#include <iterator>
+
+namespace {
+
+std::string_view command_type_names[] = {
+  "inc",
+  "dec",
+  "batch",
+};
+
+/// A minimal cursor over the input of the fast path.
+class scanner {
+public:
+  explicit scanner(std::string_view input) : input_(input) {
+    // nop
+  }
+
+  void skip_ws() noexcept {
+    while (pos_ < input_.size()
+           && (input_[pos_] == ' ' || input_[pos_] == '\t'
+               || input_[pos_] == '\r' || input_[pos_] == '\n'))
+      ++pos_;
+  }
+
+  bool at_end() noexcept {
+    skip_ws();
+    return pos_ == input_.size();
+  }
+
+  /// Consumes `ch` after optional whitespace.
+  bool consume(char ch) noexcept {
+    skip_ws();
+    if (pos_ < input_.size() && input_[pos_] == ch) {
+      ++pos_;
+      return true;
+    }
+    return false;
+  }
+
+  /// Reads a string without escape sequences.
+  bool read_plain_string(std::string_view& result) noexcept {
+    if (!consume('"'))
+      return false;
+    auto first = pos_;
+    while (pos_ < input_.size()) {
+      auto ch = input_[pos_];
+      if (ch == '"') {
+        result = input_.substr(first, pos_ - first);
+        ++pos_;
+        return true;
+      }
+      if (ch == '\\' || static_cast<unsigned char>(ch) < 0x20)
+        return false;
+      ++pos_;
+    }
+    return false;
+  }
+
+  /// Reads an integer that fits into 32 bits.
+  bool read_int32(int32_t& result) noexcept {
+    skip_ws();
+    auto* first = input_.data() + pos_;
+    auto* last = input_.data() + input_.size();
+    auto [ptr, err] = std::from_chars(first, last, result);
+    if (err != std::errc{} || ptr == first)
+      return false;
+    // Reject fractions and exponents: `from_chars` stops before them.
+    if (ptr != last && (*ptr == '.' || *ptr == 'e' || *ptr == 'E'))
+      return false;
+    pos_ += static_cast<size_t>(ptr - first);
+    return true;
+  }
+
+private:
+  std::string_view input_;
+  size_t pos_ = 0;
+};
+
+/// The fields of `inc` and `dec`. Unlike for batches, they are mandatory.
+struct mutation_fields {
+  int32_t* id;
+  int32_t* amount;
+};
+
+template <class Inspector>
+bool inspect(Inspector& f, mutation_fields& x) {
+  return f.object(x).fields(f.field("id", *x.id),
+                            f.field("amount", *x.amount));
+}
+
+} // namespace
+
+std::string to_string(command_type x) {
+  return std::string{command_type_names[static_cast<uint8_t>(x)]};
+}
+
+bool from_string(std::string_view name, command_type& x) {
+  for (size_t i = 0; i < std::size(command_type_names); ++i) {
+    if (name == command_type_names[i]) {
+      x = static_cast<command_type>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool from_integer(uint8_t value, command_type& x) {
+  if (value < std::size(command_type_names)) {
+    x = static_cast<command_type>(value);
+    return true;
+  }
+  return false;
+}
+
+bool command_parser::parse(std::string_view line, command& result) {
+  if (parse_fast(line, result))
+    return true;
+  ++fallbacks_;
+  return parse_generic(line, result);
+}
+
+bool command_parser::parse_generic(std::string_view line, command& result) {
+  result = command{};
+  if (!reader_.load(line) || !reader_.apply(result))
+    return false;
+  if (result.type == command_type::batch)
+    return true;
+  // The schema of `command` has fallbacks for the fields that only batches
+  // may omit. Check again with the stricter schema for `inc` and `dec`.
+  reader_.revert();
+  auto fields = mutation_fields{&result.id, &result.amount};
+  return reader_.apply(fields);
+}
+
+bool command_parser::parse_fast(std::string_view line, command& result) {
+  scanner in{line};
+  if (!in.consume('{'))
+    return false;
+  auto has_type = false;
+  auto has_id = false;
+  auto has_amount = false;
+  result.id = 0;
+  result.amount = 0;
+  result.atomic = false;
+  result.ops.clear();
+  if (!in.consume('}')) {
+    do {
+      std::string_view key;
+      if (!in.read_plain_string(key) || !in.consume(':'))
+        return false;
+      if (key == "type" && !has_type) {
+        std::string_view value;
+        if (!in.read_plain_string(value))
+          return false;
+        if (value == "inc")
+          result.type = command_type::inc;
+        else if (value == "dec")
+          result.type = command_type::dec;
+        else
+          return false;
+        has_type = true;
+      } else if (key == "id" && !has_id) {
+        if (!in.read_int32(result.id))
+          return false;
+        has_id = true;
+      } else if (key == "amount" && !has_amount) {
+        if (!in.read_int32(result.amount))
+          return false;
+        has_amount = true;
+      } else {
+        return false;
+      }
+    } while (in.consume(','));
+    if (!in.consume('}'))
+      return false;
+  }
+  return has_type && has_id && has_amount && in.at_end();
+}
+
+std::string result_response(int32_t value) {
+  constexpr std::string_view prefix = R"_({"result":)_";
+  char buf[16];
+  auto [end, err] = std::to_chars(buf, buf + sizeof(buf), value);
+  auto len = static_cast<size_t>(end - buf);
+  std::string result;
+  result.reserve(prefix.size() + len + 1);
+  result.append(prefix);
+  result.append(buf, len);
+  result += '}';
+  return result;
+}
@@ -0,0 +1,94 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "batch.hpp"
+
+#include <caf/default_enum_inspect.hpp>
+#include <caf/json_reader.hpp>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// The type of a command on the command port.
+enum class command_type : uint8_t {
+  inc,
+  dec,
+  batch,
+};
+
+/// @relates command_type
+std::string to_string(command_type);
+
+/// @relates command_type
+bool from_string(std::string_view, command_type&);
+
+/// @relates command_type
+bool from_integer(uint8_t, command_type&);
+
+/// @relates command_type
+template <class Inspector>
+bool inspect(Inspector& f, command_type& x) {
+  return caf::default_enum_inspect(f, x);
+}
+
+// --(command-begin)--
+struct command {
+  command_type type = command_type::inc;
+  int32_t id = 0;
+  int32_t amount = 0;
+  bool atomic = false;       // Only used by "batch".
+  std::vector<batch_op> ops; // Only used by "batch".
+};
+
+template <class Insepctor>
+bool inspect(Insepctor& f, command& x) {
+  return f.object(x).fields(f.field("type", x.type),
+                            f.field("id", x.id).fallback(0),
+                            f.field("amount", x.amount).fallback(0),
+                            f.field("atomic", x.atomic).fallback(false),
+                            f.field("ops", x.ops).fallback(
+                              std::vector<batch_op>{}));
+}
+// --(command-end)--
+
+/// Parses commands from JSON. Each client connection owns one parser to reuse
+/// its buffers.
+///
+/// The parser has a fast path for the fixed schema of `inc` and `dec`, i.e.,
+/// a flat object with the fields `type`, `id` and `amount`. The fast path
+/// works directly on the input bytes without building a DOM or allocating.
+/// Anything else, e.g., batches, escaped strings or unknown fields, goes
+/// through `caf::json_reader`.
+class command_parser {
+public:
+  /// Parses a single line of input.
+  /// @returns `true` on success, `false` if `line` is not a valid command.
+  bool parse(std::string_view line, command& result);
+
+  /// Parses `line` with `caf::json_reader` only.
+  bool parse_generic(std::string_view line, command& result);
+
+  /// Returns the error of the last call to `parse_generic`.
+  const caf::error& last_error() const noexcept {
+    return reader_.get_error();
+  }
+
+  /// Counts how often `parse` took the generic path.
+  size_t fallbacks() const noexcept {
+    return fallbacks_;
+  }
+
+private:
+  /// Tries to parse `line` without allocating.
+  /// @returns `true` on success, `false` if `line` requires the generic path.
+  static bool parse_fast(std::string_view line, command& result);
+
+  caf::json_reader reader_;
+  size_t fallbacks_ = 0;
+};
+
+/// Renders `{"result":<value>}` with a single allocation.
+std::string result_response(int32_t value);
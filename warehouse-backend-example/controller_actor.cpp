@@ -3,6 +3,12 @@
 #include "controller_actor.hpp"
 
 #include "applog.hpp"
+#include "batch.hpp"
+#include "binary_protocol.hpp"
+#include "command.hpp"
+#include "ec.hpp"
+#include "metrics.hpp"
+#include "tracing.hpp"
 
 #include <caf/actor.hpp>
 #include <caf/blocking_actor.hpp>
@@ -11,112 +17,269 @@
 #include <caf/event_based_actor.hpp>
 #include <caf/flow/byte.hpp>
 #include <caf/flow/string.hpp>
-#include <caf/json_reader.hpp>
+#include <caf/net/lp/frame.hpp>
 #include <caf/net/socket.hpp>
 #include <caf/net/tcp_accept_socket.hpp>
 #include <caf/net/tcp_stream_socket.hpp>
 #include <caf/scheduled_actor/flow.hpp>
 #include <caf/typed_actor.hpp>
 
+#include <memory>
+#include <optional>
+
 using namespace std::literals;
 
 namespace {
 
-// --(command-begin)--
-struct command {
-  std::string type; // Either "inc" or "dec".
-  int32_t id = 0;
-  int32_t amount = 0;
+/// Converts an error from the database actor to a response for the client.
+caf::expected<caf::cow_string> error_response(const caf::error& what) {
+  auto str = R"_({"error":")_"s;
+  str += to_string(what);
+  str += R"_("})_";
+  return caf::cow_string{std::move(str)};
+}
+
+/// Counts a command as in flight and starts measuring its latency.
+metrics::stopwatch begin_command(metrics::histogram id) {
+  metrics::add(metrics::gauge::controller_in_flight, 1);
+  return metrics::stopwatch{id};
+}
+
+/// Records the latency of a command and whether it failed.
+void end_command(const metrics::stopwatch& timer, bool failed) {
+  timer.stop();
+  if (failed)
+    metrics::inc(metrics::counter::controller_errors);
+}
 
-  bool valid() const noexcept {
-    return type == "inc" || type == "dec";
+/// Takes a command out of the in-flight gauge once its response observable
+/// terminates, even if the client disconnects before the result arrives.
+void leave_flight() {
+  metrics::add(metrics::gauge::controller_in_flight, -1);
+}
+
+/// Sends a command to the database actor right away and returns an observable
+/// for the response to the client.
+caf::flow::observable<caf::cow_string>
+send_command(caf::event_based_actor* self, const database_actor& db_actor,
+             admission_control& admission, const std::optional<command>& cmd) {
+  // If the `map` step failed, inject an error message.
+  if (!cmd) {
+    metrics::inc(metrics::counter::controller_errors);
+    auto str = R"_({"error":"invalid command"})_"s;
+    return self->make_observable()
+      .just(caf::cow_string{std::move(str)})
+      .as_observable();
+  }
+  // Reject the command right away if the database cannot keep up. The permit
+  // returns its slot once the response observable goes away, even if the
+  // client disconnects before the result arrives.
+  auto permit = admission.admit(traffic_class::write);
+  if (!permit) {
+    auto str = R"_({"error":"overloaded"})_"s;
+    return self->make_observable()
+      .just(caf::cow_string{std::move(str)})
+      .as_observable();
+  }
+  auto timer = begin_command(metrics::histogram::cmd_json);
+  // Batches produce a JSON object with per-operation results.
+  if (cmd->type == command_type::batch) {
+    auto atomic = cmd->atomic;
+    auto trace = tracing::request_trace{"cmd.batch"};
+    return self->mail(batch_atom_v, cmd->ops, atomic, trace.id())
+      .request(db_actor, 1s)
+      .as_observable()
+      .map([atomic, timer, permit,
+            trace](const std::vector<batch_result>& results) mutable {
+        end_command(timer, false);
+        permit.complete();
+        trace.mark("cmd.wait");
+        auto str = caf::cow_string{batch_to_json(atomic, results)};
+        trace.finish("cmd.respond");
+        return str;
+      })
+      .on_error_return([timer, permit,
+                        trace](const caf::error& what) mutable {
+        end_command(timer, true);
+        permit.complete(what == caf::sec::request_timeout);
+        trace.finish("cmd.wait");
+        applog::debug("controller received an error for a batch: {}", what);
+        return error_response(what);
+      })
+      .do_finally(leave_flight)
+      .as_observable();
+  }
+  // Send the command to the database actor and convert the result message
+  // into an observable.
+  caf::flow::observable<int32_t> result;
+  auto trace = tracing::request_trace{cmd->type == command_type::inc
+                                        ? "cmd.inc"
+                                        : "cmd.dec"};
+  if (cmd->type == command_type::inc) {
+    result = self->mail(inc_atom_v, cmd->id, cmd->amount, trace.id())
+               .request(db_actor, 1s)
+               .as_observable();
+  } else {
+    result = self->mail(dec_atom_v, cmd->id, cmd->amount, trace.id())
+               .request(db_actor, 1s)
+               .as_observable();
   }
-};
+  // On error, we return an error message to the client. The lambdas only
+  // capture the plain fields of the command to avoid copying `ops`.
+  return result
+    .map([type = cmd->type, id = cmd->id, timer, permit,
+          trace](int32_t res) mutable {
+      end_command(timer, false);
+      permit.complete();
+      trace.mark("cmd.wait");
+      applog::debug("controller received result for {} {} -> {}", type, id,
+                    res);
+      auto str = caf::cow_string{result_response(res)};
+      trace.finish("cmd.respond");
+      return str;
+    })
+    .on_error_return(
+      [type = cmd->type, id = cmd->id, timer, permit,
+       trace](const caf::error& what) mutable {
+        end_command(timer, true);
+        permit.complete(what == caf::sec::request_timeout);
+        trace.finish("cmd.wait");
+        applog::debug("controller received an error for {} {} -> {}", type,
+                      id, what);
+        return error_response(what);
+      })
+    .do_finally(leave_flight)
+    .as_observable();
+}
+
+/// Converts a response record to a frame for the binary protocol.
+caf::net::lp::frame to_frame(const binary_protocol::response_record& rec) {
+  return caf::net::lp::frame{caf::const_byte_span{rec}};
+}
+
+/// Converts an error from the database actor to a frame for the binary
+/// protocol.
+caf::expected<caf::net::lp::frame> error_frame(const caf::error& what) {
+  return to_frame(binary_protocol::encode_error(what));
+}
 
-template <class Insepctor>
-bool inspect(Insepctor& f, command& x) {
-  return f.object(x).fields(f.field("type", x.type), f.field("id", x.id),
-                            f.field("amount", x.amount));
+/// Like `send_command`, but for a request of the binary protocol.
+caf::flow::observable<caf::net::lp::frame>
+send_binary_command(caf::event_based_actor* self,
+                    const database_actor& db_actor,
+                    admission_control& admission,
+                    const std::optional<batch_op>& op) {
+  // If the `map` step failed, inject an error record.
+  if (!op) {
+    metrics::inc(metrics::counter::controller_errors);
+    auto err = caf::make_error(ec::invalid_argument);
+    return self->make_observable()
+      .just(to_frame(binary_protocol::encode_error(err)))
+      .as_observable();
+  }
+  // Same admission control as for JSON commands.
+  auto permit = admission.admit(traffic_class::write);
+  if (!permit) {
+    auto err = caf::make_error(ec::overloaded);
+    return self->make_observable()
+      .just(to_frame(binary_protocol::encode_error(err)))
+      .as_observable();
+  }
+  auto timer = begin_command(metrics::histogram::cmd_binary);
+  auto trace = tracing::request_trace{op->type == op_type::inc   ? "bin.inc"
+                                      : op->type == op_type::dec ? "bin.dec"
+                                                                 : "bin.del"};
+  auto to_result = [timer, permit, trace](int32_t res) mutable {
+    end_command(timer, false);
+    permit.complete();
+    trace.mark("bin.wait");
+    auto frame = to_frame(binary_protocol::encode_result(res));
+    trace.finish("bin.respond");
+    return frame;
+  };
+  auto to_error = [timer, permit, trace](const caf::error& what) mutable {
+    end_command(timer, true);
+    permit.complete(what == caf::sec::request_timeout);
+    trace.finish("bin.wait");
+    return error_frame(what);
+  };
+  switch (op->type) {
+    case op_type::inc:
+      return self->mail(inc_atom_v, op->id, op->amount, trace.id())
+        .request(db_actor, 1s)
+        .as_observable()
+        .map(to_result)
+        .on_error_return(to_error)
+        .do_finally(leave_flight)
+        .as_observable();
+    case op_type::dec:
+      return self->mail(dec_atom_v, op->id, op->amount, trace.id())
+        .request(db_actor, 1s)
+        .as_observable()
+        .map(to_result)
+        .on_error_return(to_error)
+        .do_finally(leave_flight)
+        .as_observable();
+    default: // op_type::del
+      return self->mail(del_atom_v, op->id, trace.id())
+        .request(db_actor, 1s)
+        .as_observable()
+        .map([to_result](caf::unit_t) mutable { return to_result(0); })
+        .on_error_return(to_error)
+        .do_finally(leave_flight)
+        .as_observable();
+  }
 }
-// --(command-end)--
 
 } // namespace
 
 // --(spawn-controller-actor-impl-part1-begin)--
 caf::actor
 spawn_controller_actor(caf::actor_system& sys, database_actor db_actor,
-                       caf::net::acceptor_resource<std::byte> events) {
-  return sys.spawn([events, db_actor](caf::event_based_actor* self) mutable {
+                       admission_control_ptr admission,
+                       caf::net::acceptor_resource<std::byte> events,
+                       size_t window) {
+  return sys.spawn([events, db_actor, admission,
+                    window](caf::event_based_actor* self) mutable {
     // Stop if the database actor terminates.
     self->monitor(db_actor, [self](const caf::error& reason) {
       applog::info("controller lost the database actor: {}", reason);
       self->quit(reason);
     });
     // For each buffer pair, we create a new flow ...
-    events.observe_on(self).for_each([self, db_actor](auto ev) {
+    events.observe_on(self).for_each([self, db_actor, admission,
+                                      window](auto ev) {
       applog::info("controller added a new client");
       auto [pull, push] = ev.data();
+      // Each connection reuses the buffers of its own parser.
+      auto parser = std::make_shared<command_parser>();
       pull
         .observe_on(self)
         // ... that converts the lines to commands ...
         .transform(caf::flow::byte::split_as_utf8_at('\n'))
         // --(spawn-controller-actor-impl-part1-end)--
         // --(spawn-controller-actor-impl-part2-begin)--
-        .map([self](const caf::cow_string& line) {
+        .map([parser](const caf::cow_string& line) {
           applog::debug("controller received line: {}", line.str());
-          caf::json_reader reader;
-          if (!reader.load(line.str())) {
-            applog::error("controller failed to parse JSON: {}",
-                          reader.get_error());
-            return std::shared_ptr<command>{}; // Invalid JSON.
+          auto result = std::optional<command>{std::in_place};
+          if (!parser->parse(line.str(), *result)) {
+            applog::error("controller failed to parse a command: {}",
+                          parser->last_error());
+            result.reset();
           }
-          auto ptr = std::make_shared<command>();
-          if (!reader.apply(*ptr))
-            return std::shared_ptr<command>{}; // Not a command.
-          return ptr;
+          return result;
         })
         // --(spawn-controller-actor-impl-part2-end)--
         // --(spawn-controller-actor-impl-part3-begin)--
-        .concat_map([self, db_actor](std::shared_ptr<command> ptr) {
-          // If the `map` step failed, inject an error message.
-          if (ptr == nullptr || !ptr->valid()) {
-            auto str = R"_({"error":"invalid command"})_"s;
-            return self->make_observable()
-              .just(caf::cow_string{std::move(str)})
-              .as_observable();
-          }
-          // Send the command to the database actor and convert the
-          // result message into an observable.
-          caf::flow::observable<int32_t> result;
-          if (ptr->type == "inc") {
-            result = self->mail(inc_atom_v, ptr->id, ptr->amount)
-                       .request(db_actor, 1s)
-                       .as_observable();
-          } else {
-            result = self->mail(dec_atom_v, ptr->id, ptr->amount)
-                       .request(db_actor, 1s)
-                       .as_observable();
-          }
-          // On error, we return an error message to the client.
-          return result
-            .map([ptr](int32_t res) {
-              applog::debug("controller received result for {} -> {}", *ptr,
-                            res);
-              auto str = R"_({"result":)_"s;
-              str += std::to_string(res);
-              str += '}';
-              return caf::cow_string{std::move(str)};
-            })
-            .on_error_return([ptr](const caf::error& what) {
-              applog::debug("controller received an error for {} -> {}", *ptr,
-                            what);
-              auto str = R"_({"error":")_"s;
-              str += to_string(what);
-              str += R"_("})_";
-              auto res = caf::cow_string{std::move(str)};
-              return caf::expected<caf::cow_string>{std::move(res)};
-            })
-            .as_observable();
+        // ... that sends up to `window` commands ahead to the database actor
+        // while waiting for the oldest response ...
+        .map([self, db_actor, admission](const std::optional<command>& cmd) {
+          return send_command(self, db_actor, *admission, cmd);
+        })
+        .on_backpressure_buffer(window)
+        // ... that restores the input order of the responses ...
+        .concat_map([](caf::flow::observable<caf::cow_string> response) {
+          return response;
         })
         // --(spawn-controller-actor-impl-part3-end)--
         // --(spawn-controller-actor-impl-part4-begin)--
@@ -132,3 +295,48 @@ spawn_controller_actor(caf::actor_system& sys, database_actor db_actor,
   });
 }
 // --(spawn-controller-actor-impl-part4-end)--
+
+caf::actor
+spawn_binary_controller_actor(
+  caf::actor_system& sys, database_actor db_actor,
+  admission_control_ptr admission,
+  caf::net::acceptor_resource<caf::net::lp::frame> events, size_t window) {
+  using frame = caf::net::lp::frame;
+  return sys.spawn([events, db_actor, admission,
+                    window](caf::event_based_actor* self) mutable {
+    // Stop if the database actor terminates.
+    self->monitor(db_actor, [self](const caf::error& reason) {
+      applog::info("binary controller lost the database actor: {}", reason);
+      self->quit(reason);
+    });
+    events.observe_on(self).for_each([self, db_actor, admission,
+                                      window](auto ev) {
+      applog::info("binary controller added a new client");
+      auto [pull, push] = ev.data();
+      pull
+        .observe_on(self)
+        // Each frame carries exactly one fixed-width request record.
+        .map([](const frame& msg) {
+          auto result = std::optional<batch_op>{std::in_place};
+          if (!binary_protocol::decode_request(msg.bytes(), *result)) {
+            applog::error("binary controller received a malformed record");
+            result.reset();
+          }
+          return result;
+        })
+        // Same pipelining as for JSON commands.
+        .map([self, db_actor, admission](const std::optional<batch_op>& op) {
+          return send_binary_command(self, db_actor, *admission, op);
+        })
+        .on_backpressure_buffer(window)
+        .concat_map([](caf::flow::observable<frame> response) {
+          return response;
+        })
+        .on_backpressure_buffer(32)
+        .do_finally([] {
+          applog::info("binary controller lost connection to a client");
+        })
+        .subscribe(push);
+    });
+  });
+}
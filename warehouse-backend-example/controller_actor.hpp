@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include "admission.hpp"
 #include "caf/net/fwd.hpp"
 #include "database_actor.hpp"
 #include "types.hpp"
@@ -9,11 +10,30 @@
 #include <caf/fwd.hpp>
 #include <caf/net/acceptor_resource.hpp>
 #include <caf/net/fwd.hpp>
+#include <caf/net/lp/frame.hpp>
 
 #include <cstddef>
 
 // --(spawn-controller-actor-begin)--
+/// Spawns an actor that reads JSON commands from each client and forwards them
+/// to `db_actor`.
+/// @param admission Sheds commands while the database is overloaded.
+/// @param window Maximum number of commands per client that the controller
+///               sends ahead while waiting for the oldest response. Responses
+///               always arrive in input order.
 caf::actor
 spawn_controller_actor(caf::actor_system& sys, database_actor db_actor,
-                       caf::net::acceptor_resource<std::byte> events);
+                       admission_control_ptr admission,
+                       caf::net::acceptor_resource<std::byte> events,
+                       size_t window = 1);
 // --(spawn-controller-actor-end)--
+
+/// Spawns an actor that reads commands in the binary protocol (see
+/// `binary_protocol.hpp`) from each client and forwards them to `db_actor`.
+/// @param admission See `spawn_controller_actor`.
+/// @param window See `spawn_controller_actor`.
+caf::actor
+spawn_binary_controller_actor(
+  caf::actor_system& sys, database_actor db_actor,
+  admission_control_ptr admission,
+  caf::net::acceptor_resource<caf::net::lp::frame> events, size_t window = 1);
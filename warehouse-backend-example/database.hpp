@@ -11,56 +11,123 @@
 #include <memory>
 #include <optional>
 #include <string>
-
-extern "C" {
-
-struct sqlite3;
-
-} // extern "C"
+#include <string_view>
+#include <vector>
+
+/// Configures how a storage engine opens its files.
+struct database_options {
+  /// Enables write-ahead logging instead of SQLite's rollback journal. Only
+  /// affects the SQLite engine.
+  bool wal = false;
+
+  /// Opens the connection in read-only mode. Read-only connections neither
+  /// create the table nor change the journal mode. Only the SQLite engine
+  /// supports read-only connections.
+  bool read_only = false;
+};
 
 // --(database-begin)--
 /// A simple database interface for storing items.
 class database {
 public:
-  database(std::string db_file) : db_file_(std::move(db_file)) {
-    // nop
-  }
-
-  ~database();
+  virtual ~database();
 
-  /// Opens the database file and creates the table if it does not exist.
+  /// Opens the database, creates the storage if it does not exist yet and
+  /// allocates all resources for the lifetime of the database.
   /// @returns `caf::error{}` on success, an error code otherwise.
-  [[nodiscard]] caf::error open();
+  [[nodiscard]] virtual caf::error open() = 0;
 
   /// Retrieves the number of items in the database.
   /// @returns the number of items in the database.
-  [[nodiscard]] int count();
+  [[nodiscard]] virtual int count() = 0;
 
   /// Retrieves an item from the database.
   /// @returns the item if found, `std::nullopt` otherwise.
-  [[nodiscard]] std::optional<item> get(int32_t id);
+  [[nodiscard]] virtual std::optional<item> get(int32_t id) = 0;
+
+  /// Retrieves the items with an ID in `[first, last]`, ordered by ID.
+  /// @param result Receives the items.
+  /// @param limit Maximum number of items to read. Negative for no limit.
+  /// @returns `ec::nil` on success, an error code otherwise.
+  [[nodiscard]] virtual ec range(int32_t first, int32_t last,
+                                 std::vector<item>& result, int limit = -1)
+    = 0;
+
+  /// Retrieves all existing items from a list of IDs, in the order of `ids`.
+  /// @param result Receives the items.
+  /// @returns `ec::nil` on success, an error code otherwise.
+  [[nodiscard]] virtual ec get_many(const std::vector<int32_t>& ids,
+                                    std::vector<item>& result)
+    = 0;
 
   /// Inserts a new item into the database.
   /// @returns `ec::nil` on success, an error code otherwise.
-  [[nodiscard]] ec insert(const item& new_item);
+  [[nodiscard]] virtual ec insert(const item& new_item) = 0;
 
   /// Increments the available count of an item.
+  /// @param updated Receives the state of the item after the update.
+  /// @returns `ec::nil` on success, an error code otherwise. Fails with
+  ///          `ec::invalid_argument` if `amount` is not positive or the count
+  ///          would exceed the range of `int32_t`.
+  [[nodiscard]] virtual ec inc(int32_t id, int32_t amount, item& updated) = 0;
+
+  /// Decrements the available count of an item, but never below 0.
+  /// @param updated Receives the state of the item after the update.
+  /// @returns `ec::nil` on success, an error code otherwise. Fails with
+  ///          `ec::invalid_argument` if `amount` is not positive.
+  [[nodiscard]] virtual ec dec(int32_t id, int32_t amount, item& updated) = 0;
+
+  /// Deletes an item from the database.
+  /// @param removed Receives the last state of the item.
   /// @returns `ec::nil` on success, an error code otherwise.
-  [[nodiscard]] ec inc(int32_t id, int32_t amount);
+  [[nodiscard]] virtual ec del(int32_t id, item& removed) = 0;
 
-  /// Decrements the available count of an item.
+  /// Starts a transaction that spans all following calls until `commit` or
+  /// `rollback`.
   /// @returns `ec::nil` on success, an error code otherwise.
-  [[nodiscard]] ec dec(int32_t id, int32_t amount);
+  [[nodiscard]] virtual ec begin() = 0;
 
-  /// Deletes an item from the database.
+  /// Commits the current transaction.
   /// @returns `ec::nil` on success, an error code otherwise.
-  [[nodiscard]] ec del(int32_t id);
+  [[nodiscard]] virtual ec commit() = 0;
 
-private:
-  std::string db_file_;
-  sqlite3* db_ = nullptr;
+  /// Aborts the current transaction.
+  /// @returns `ec::nil` on success, an error code otherwise.
+  [[nodiscard]] virtual ec rollback() = 0;
+
+  /// Starts a savepoint. Outside of a transaction, this also starts a new
+  /// transaction that ends with `release_savepoint`.
+  /// @returns `ec::nil` on success, an error code otherwise.
+  [[nodiscard]] virtual ec savepoint() = 0;
+
+  /// Ends the current savepoint and keeps its changes.
+  /// @returns `ec::nil` on success, an error code otherwise.
+  [[nodiscard]] virtual ec release_savepoint() = 0;
+
+  /// Reverts all changes since the current savepoint and ends it.
+  /// @returns `ec::nil` on success, an error code otherwise.
+  [[nodiscard]] virtual ec rollback_to_savepoint() = 0;
 };
 
 /// A smart pointer to an item database.
 using database_ptr = std::shared_ptr<database>;
 // --(database-end)--
+
+/// Selects the implementation of `database`.
+enum class storage_engine {
+  /// Stores the items in an SQLite database file.
+  sqlite,
+  /// Keeps all items in memory and appends each change to a log file.
+  memory,
+};
+
+/// @relates storage_engine
+std::string to_string(storage_engine engine);
+
+/// @relates storage_engine
+bool from_string(std::string_view name, storage_engine& engine);
+
+/// Creates a database that uses `engine` for storing the items in `file`.
+/// @note Call `open` on the result before using it.
+database_ptr make_database(storage_engine engine, std::string file,
+                           database_options opts = {});
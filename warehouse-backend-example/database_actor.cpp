@@ -2,97 +2,468 @@
 
 #include "database_actor.hpp"
 
+#include "batch.hpp"
 #include "ec.hpp"
 #include "item.hpp"
+#include "metrics.hpp"
+#include "subscription.hpp"
+#include "tracing.hpp"
 #include "types.hpp"
 
 #include <caf/actor_from_state.hpp>
 #include <caf/actor_system.hpp>
 #include <caf/async/publisher.hpp>
+#include <caf/disposable.hpp>
 #include <caf/error.hpp>
 #include <caf/flow/observable_builder.hpp>
 #include <caf/net/http/status.hpp>
+#include <caf/typed_response_promise.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <unordered_set>
+#include <vector>
 
 namespace {
 
+/// A request that waits for the shared commit of its transaction.
+struct pending_mutation {
+  /// The changes to publish after a successful commit.
+  std::vector<item_change> changes;
+  /// Responds to the client once the outcome of the commit is known.
+  std::function<void(const caf::error&)> reply;
+};
+
 // --(database-actor-state-begin)--
 struct database_actor_state {
   database_actor_state(database_actor::pointer self_ptr, database_ptr db_ptr,
-                       item_events* events)
-    : self(self_ptr), db(db_ptr), mcast(self) {
+                       item_cache_ptr cache_ptr,
+                       response_cache_ptr responses_ptr,
+                       commit_policy commit_cfg, item_events* events)
+    : self(self_ptr),
+      db(db_ptr),
+      mcast(self),
+      cache(cache_ptr),
+      responses(responses_ptr),
+      policy(commit_cfg) {
     *events = mcast.as_observable().to_publisher();
   }
 
+  ~database_actor_state() {
+    // Mutations of an unfinished group never got a reply, so we discard them.
+    if (in_transaction)
+      (void) db->rollback();
+    metrics::add(metrics::gauge::db_mailbox_depth, -reported_depth);
+  }
+
   database_actor::behavior_type make_behavior();
 
   database_actor::pointer self;
   database_ptr db;
   caf::flow::multicaster<item_event> mcast;
+  item_cache_ptr cache;
+  response_cache_ptr responses;
+  // The sequence number of the last published change.
+  uint64_t seq = 0;
+
+  /// Returns whether mutations share commits.
+  bool group_commit() const noexcept {
+    return policy.window.count() > 0;
+  }
+
+  /// Reports the number of waiting messages to the mailbox depth gauge.
+  void sample_mailbox() {
+    auto depth = static_cast<int64_t>(self->mailbox().size());
+    metrics::add(metrics::gauge::db_mailbox_depth, depth - reported_depth);
+    reported_depth = depth;
+  }
+
+  /// Opens a new transaction for the next group if necessary.
+  /// @param trace The trace ID of the request that joins the group.
+  ec begin_group(uint64_t trace);
+
+  /// Applies a single operation of a batch.
+  ec apply(const batch_op& op, std::vector<item_change>& changes,
+           int32_t& available);
+
+  /// Applies all operations of a batch in a single transaction.
+  caf::result<std::vector<batch_result>>
+  apply_batch(const std::vector<batch_op>& ops, bool atomic);
+
+  /// Publishes `changes` and returns `result` right away or defers both until
+  /// the current group commits.
+  template <class T>
+  caf::result<T> finish(T result, std::vector<item_change> changes) {
+    if (!group_commit()) {
+      for (auto& change : changes)
+        publish(change);
+      return result;
+    }
+    auto prom = self->make_response_promise<T>();
+    defer(std::move(changes),
+          [prom, result = std::move(result)](const caf::error& err) mutable {
+            if (err)
+              prom.deliver(err);
+            else
+              prom.deliver(result);
+          });
+    return prom;
+  }
+
+  /// Like `finish`, but for requests without a result.
+  caf::result<void> finish(std::vector<item_change> changes);
+
+  /// Adds a request to the current group.
+  void defer(std::vector<item_change> changes,
+             std::function<void(const caf::error&)> reply);
+
+  /// Makes a committed change visible in the cache and to subscribers.
+  void publish(item_change& change);
+
+  /// Reads an item from the database and adds it to the cache.
+  /// @pre The item has no uncommitted changes.
+  caf::expected<item> get(int32_t id, uint64_t trace);
+
+  /// Runs a listing query.
+  /// @pre No transaction is open.
+  caf::expected<item_page> list(const item_query& query, uint64_t trace);
+
+  /// Calls `fn` once the current group commits and responds with its result.
+  template <class T, class F>
+  caf::result<T> after_commit(F fn) {
+    auto prom = self->make_response_promise<T>();
+    deferred_reads.push_back(
+      [prom, fn = std::move(fn)]() mutable { prom.deliver(fn()); });
+    return prom;
+  }
+
+  /// Reads the committed state of all items that match `filter`.
+  caf::result<item_snapshot> snapshot(const subscription_filter& filter);
+
+  /// Commits the current group, publishes its events and replies to all
+  /// requests in the group.
+  void commit();
+
+  commit_policy policy;
+  bool in_transaction = false;
+  std::vector<pending_mutation> pending;
+  // Items with uncommitted changes in the current group.
+  std::unordered_set<int32_t> dirty;
+  // Reads that wait for the current group to commit.
+  std::vector<std::function<void()>> deferred_reads;
+  caf::disposable commit_timer;
+  // The trace ID of the first sampled request in the current group.
+  uint64_t group_trace = tracing::no_trace;
+  // The share of this actor in the mailbox depth gauge.
+  int64_t reported_depth = 0;
 };
 // --(database-actor-state-end)--
 
 database_actor::behavior_type database_actor_state::make_behavior() {
   return {
-    [this](get_atom, int32_t id) -> caf::result<item> {
-      if (auto value = db->get(id))
+    [this](get_atom, int32_t id, uint64_t trace) -> caf::result<item> {
+      sample_mailbox();
+      // The cache only holds committed states.
+      if (auto value = cache->get(id))
         return {std::move(*value)};
-      return {caf::make_error(ec::no_such_item)};
+      // The transaction of the current group would show uncommitted changes.
+      if (dirty.count(id) > 0)
+        return after_commit<item>([this, id, trace] { return get(id, trace); });
+      return get(id, trace);
+    },
+    [this](list_atom, const item_query& query,
+           uint64_t trace) -> caf::result<item_page> {
+      sample_mailbox();
+      if (in_transaction)
+        return after_commit<item_page>(
+          [this, query, trace] { return list(query, trace); });
+      return list(query, trace);
     },
     // --(database-actor-state-add-begin)--
-    [this](add_atom, int32_t id, int32_t price,
-           const std::string& name) -> caf::result<void> {
+    [this](add_atom, int32_t id, int32_t price, const std::string& name,
+           uint64_t trace) -> caf::result<void> {
+      sample_mailbox();
+      auto timer = metrics::scoped_timer{metrics::histogram::db_add};
+      auto span = tracing::scoped_span{"db.add", trace};
+      if (auto err = begin_group(trace); err != ec::nil)
+        return {caf::make_error(err)};
       auto value = item{id, price, 0, std::move(name)};
       if (auto err = db->insert(value); err != ec::nil)
         return {caf::make_error(err)};
-      mcast.push(std::make_shared<item>(std::move(value)));
-      return {};
+      return finish({item_change{0, change_type::added, std::move(value)}});
     },
     // --(database-actor-state-add-end)--
-    [this](inc_atom, int32_t id, int32_t amount) -> caf::result<int32_t> {
-      if (auto err = db->inc(id, amount); err != ec::nil)
+    [this](inc_atom, int32_t id, int32_t amount,
+           uint64_t trace) -> caf::result<int32_t> {
+      sample_mailbox();
+      auto timer = metrics::scoped_timer{metrics::histogram::db_inc};
+      auto span = tracing::scoped_span{"db.inc", trace};
+      if (auto err = begin_group(trace); err != ec::nil)
+        return {caf::make_error(err)};
+      auto value = item{};
+      if (auto err = db->inc(id, amount, value); err != ec::nil)
         return {caf::make_error(err)};
-      if (auto value = db->get(id)) {
-        auto result = value->available;
-        mcast.push(std::make_shared<item>(std::move(*value)));
-        return result;
-      }
-      return {caf::make_error(ec::no_such_item)};
+      auto result = value.available;
+      return finish(result,
+                    {item_change{0, change_type::updated, std::move(value)}});
     },
-    [this](dec_atom, int32_t id, int32_t amount) -> caf::result<int32_t> {
-      if (auto err = db->dec(id, amount); err != ec::nil)
+    [this](dec_atom, int32_t id, int32_t amount,
+           uint64_t trace) -> caf::result<int32_t> {
+      sample_mailbox();
+      auto timer = metrics::scoped_timer{metrics::histogram::db_dec};
+      auto span = tracing::scoped_span{"db.dec", trace};
+      if (auto err = begin_group(trace); err != ec::nil)
         return {caf::make_error(err)};
-      if (auto value = db->get(id)) {
-        auto result = value->available;
-        mcast.push(std::make_shared<item>(std::move(*value)));
-        return result;
-      }
-      return {caf::make_error(ec::no_such_item)};
+      auto value = item{};
+      if (auto err = db->dec(id, amount, value); err != ec::nil)
+        return {caf::make_error(err)};
+      auto result = value.available;
+      return finish(result,
+                    {item_change{0, change_type::updated, std::move(value)}});
     },
-    [this](del_atom, int32_t id) -> caf::result<void> {
-      auto value = db->get(id);
-      if (!value)
-        return {caf::make_error(ec::no_such_item)};
-      if (auto err = db->del(id); err != ec::nil)
+    [this](del_atom, int32_t id, uint64_t trace) -> caf::result<void> {
+      sample_mailbox();
+      auto timer = metrics::scoped_timer{metrics::histogram::db_del};
+      auto span = tracing::scoped_span{"db.del", trace};
+      if (auto err = begin_group(trace); err != ec::nil)
+        return {caf::make_error(err)};
+      auto value = item{};
+      if (auto err = db->del(id, value); err != ec::nil)
         return {caf::make_error(err)};
-      value->available = 0;
-      mcast.push(std::make_shared<item>(std::move(*value)));
-      return caf::unit;
+      value.available = 0;
+      return finish({item_change{0, change_type::erased, std::move(value)}});
+    },
+    [this](batch_atom, const std::vector<batch_op>& ops, bool atomic,
+           uint64_t trace) -> caf::result<std::vector<batch_result>> {
+      sample_mailbox();
+      auto timer = metrics::scoped_timer{metrics::histogram::db_batch};
+      auto span = tracing::scoped_span{"db.batch", trace};
+      if (auto err = begin_group(trace); err != ec::nil)
+        return {caf::make_error(err)};
+      return apply_batch(ops, atomic);
+    },
+    [this](snapshot_atom,
+           const subscription_filter& filter) -> caf::result<item_snapshot> {
+      sample_mailbox();
+      return snapshot(filter);
     },
   };
 }
 
+ec database_actor_state::begin_group(uint64_t trace) {
+  if (!group_commit())
+    return ec::nil;
+  // The shared commit shows up in the first sampled request of the group.
+  if (group_trace == tracing::no_trace)
+    group_trace = trace;
+  if (in_transaction)
+    return ec::nil;
+  if (auto err = db->begin(); err != ec::nil)
+    return err;
+  in_transaction = true;
+  commit_timer = self->run_delayed(policy.window, [this] { commit(); });
+  return ec::nil;
+}
+
+ec database_actor_state::apply(const batch_op& op,
+                               std::vector<item_change>& changes,
+                               int32_t& available) {
+  auto value = item{};
+  auto err = ec::nil;
+  switch (op.type) {
+    case op_type::inc:
+      err = db->inc(op.id, op.amount, value);
+      break;
+    case op_type::dec:
+      err = db->dec(op.id, op.amount, value);
+      break;
+    case op_type::del:
+      err = db->del(op.id, value);
+      value.available = 0;
+      break;
+  }
+  if (err != ec::nil)
+    return err;
+  available = value.available;
+  auto type = op.type == op_type::del ? change_type::erased
+                                      : change_type::updated;
+  changes.push_back({0, type, std::move(value)});
+  return ec::nil;
+}
+
+caf::result<std::vector<batch_result>>
+database_actor_state::apply_batch(const std::vector<batch_op>& ops,
+                                  bool atomic) {
+  // The savepoint either nests into the transaction of the current group or
+  // starts a transaction of its own.
+  if (auto err = db->savepoint(); err != ec::nil)
+    return {caf::make_error(err)};
+  auto results = std::vector<batch_result>{};
+  results.reserve(ops.size());
+  auto changes = std::vector<item_change>{};
+  auto failed = false;
+  for (const auto& op : ops) {
+    auto& res = results.emplace_back(batch_result{op.id, ec::nil, 0});
+    if (atomic && failed) {
+      res.code = ec::transaction_aborted;
+      continue;
+    }
+    res.code = apply(op, changes, res.available);
+    failed = failed || res.code != ec::nil;
+  }
+  if (atomic && failed) {
+    if (auto err = db->rollback_to_savepoint(); err != ec::nil)
+      return {caf::make_error(err)};
+    // Operations that succeeded before the failure are void now.
+    for (auto& res : results)
+      if (res.code == ec::nil)
+        res.code = ec::transaction_aborted;
+    return results;
+  }
+  if (auto err = db->release_savepoint(); err != ec::nil) {
+    (void) db->rollback_to_savepoint();
+    return {caf::make_error(err)};
+  }
+  return finish(std::move(results), std::move(changes));
+}
+
+caf::result<void>
+database_actor_state::finish(std::vector<item_change> changes) {
+  if (!group_commit()) {
+    for (auto& change : changes)
+      publish(change);
+    return caf::unit;
+  }
+  auto prom = self->make_response_promise<void>();
+  defer(std::move(changes), [prom](const caf::error& err) mutable {
+    if (err)
+      prom.deliver(err);
+    else
+      prom.deliver();
+  });
+  return prom;
+}
+
+void database_actor_state::defer(std::vector<item_change> changes,
+                                 std::function<void(const caf::error&)> reply) {
+  for (auto& change : changes)
+    dirty.insert(change.value.id);
+  pending.push_back({std::move(changes), std::move(reply)});
+  if (pending.size() >= policy.max_batch)
+    commit();
+}
+
+void database_actor_state::publish(item_change& change) {
+  if (change.type == change_type::erased)
+    cache->erase(change.value.id);
+  else
+    cache->put(change.value);
+  responses->invalidate(change.value.id);
+  change.seq = ++seq;
+  mcast.push(std::make_shared<item_change>(std::move(change)));
+}
+
+caf::expected<item> database_actor_state::get(int32_t id, uint64_t trace) {
+  auto span = tracing::scoped_span{"db.get", trace};
+  auto token = cache->fill_token(id);
+  auto timer = metrics::stopwatch{metrics::histogram::db_get};
+  auto value = db->get(id);
+  timer.stop();
+  if (!value)
+    return caf::make_error(ec::no_such_item);
+  cache->fill(*value, token);
+  return std::move(*value);
+}
+
+caf::expected<item_page>
+database_actor_state::list(const item_query& query, uint64_t trace) {
+  auto timer = metrics::scoped_timer{metrics::histogram::db_list};
+  auto span = tracing::scoped_span{"db.list", trace};
+  auto result = item_page{};
+  if (auto err = run_item_query(*db, query, result); err != ec::nil)
+    return caf::make_error(err);
+  return result;
+}
+
+caf::result<item_snapshot>
+database_actor_state::snapshot(const subscription_filter& filter) {
+  // Commit the current group first. Otherwise, the snapshot would contain
+  // changes that have no sequence number yet.
+  commit();
+  auto timer = metrics::scoped_timer{metrics::histogram::db_snapshot};
+  auto result = item_snapshot{};
+  result.seq = seq;
+  auto& items = result.items;
+  if (filter.matches_all()) {
+    constexpr auto min_id = std::numeric_limits<int32_t>::min();
+    constexpr auto max_id = std::numeric_limits<int32_t>::max();
+    if (auto err = db->range(min_id, max_id, items); err != ec::nil)
+      return {caf::make_error(err)};
+    return result;
+  }
+  for (auto id : filter.ids)
+    if (auto value = db->get(id))
+      items.push_back(std::move(*value));
+  for (const auto& range : filter.ranges)
+    if (auto err = db->range(range.first, range.last, items); err != ec::nil)
+      return {caf::make_error(err)};
+  std::sort(items.begin(), items.end(),
+            [](const item& x, const item& y) { return x.id < y.id; });
+  return result;
+}
+
+void database_actor_state::commit() {
+  commit_timer.dispose();
+  if (!in_transaction)
+    return;
+  in_transaction = false;
+  auto mutations = std::move(pending);
+  pending.clear();
+  dirty.clear();
+  auto timer = metrics::stopwatch{metrics::histogram::db_commit};
+  auto span = tracing::scoped_span{"db.commit", group_trace};
+  group_trace = tracing::no_trace;
+  auto err = db->commit();
+  timer.stop();
+  if (err != ec::nil) {
+    (void) db->rollback();
+    // Readers may have rendered the uncommitted states in the meantime.
+    auto reason = caf::make_error(err);
+    for (auto& mutation : mutations) {
+      for (auto& change : mutation.changes)
+        responses->invalidate(change.value.id);
+      mutation.reply(reason);
+    }
+  } else {
+    for (auto& mutation : mutations) {
+      for (auto& change : mutation.changes)
+        publish(change);
+      mutation.reply(caf::error{});
+    }
+  }
+  // Either way, the database only has committed states again.
+  auto reads = std::move(deferred_reads);
+  deferred_reads.clear();
+  for (auto& read : reads)
+    read();
+}
+
 } // namespace
 
 // --(spawn-database-actor-impl-begin)--
 std::pair<database_actor, item_events>
-spawn_database_actor(caf::actor_system& sys, database_ptr db) {
+spawn_database_actor(caf::actor_system& sys, database_ptr db,
+                     item_cache_ptr cache, response_cache_ptr responses,
+                     commit_policy policy) {
   // Note: the actor uses a blocking API (SQLite3) and thus should run in its
   //       own thread.
   using caf::actor_from_state;
   using caf::detached;
   item_events events;
   auto hdl = sys.spawn<detached>(actor_from_state<database_actor_state>, db,
-                                 &events);
+                                 std::move(cache), std::move(responses),
+                                 policy, &events);
   return {hdl, std::move(events)};
 }
 // --(spawn-database-actor-impl-end)--
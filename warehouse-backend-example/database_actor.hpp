@@ -2,31 +2,62 @@
 
 #pragma once
 
+#include "batch.hpp"
 #include "database.hpp"
 #include "item.hpp"
+#include "item_cache.hpp"
+#include "item_query.hpp"
+#include "response_cache.hpp"
+#include "subscription.hpp"
 #include "types.hpp"
 
+#include <caf/timespan.hpp>
+
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 
 // --(database-actor-begin)--
+// Requests end with the trace ID of the client request or `tracing::no_trace`.
+// The actor records its work under that ID.
 struct database_trait {
   using signatures = caf::type_list<
     // Retrieves an item from the database.
-    caf::result<item>(get_atom, int32_t),
+    caf::result<item>(get_atom, int32_t, uint64_t),
+    // Retrieves a page of items from the database.
+    caf::result<item_page>(list_atom, item_query, uint64_t),
     // Adds a new item to the database.
-    caf::result<void>(add_atom, int32_t, int32_t, std::string),
+    caf::result<void>(add_atom, int32_t, int32_t, std::string, uint64_t),
     // Increments the available count of an item.
-    caf::result<int32_t>(inc_atom, int32_t, int32_t),
+    caf::result<int32_t>(inc_atom, int32_t, int32_t, uint64_t),
     // Decrements the available count of an item.
-    caf::result<int32_t>(dec_atom, int32_t, int32_t),
+    caf::result<int32_t>(dec_atom, int32_t, int32_t, uint64_t),
     // Deletes an item from the database.
-    caf::result<void>(del_atom, int32_t)>;
+    caf::result<void>(del_atom, int32_t, uint64_t),
+    // Applies multiple operations in one transaction. If the flag is true,
+    // the batch is atomic, i.e., either all operations succeed or none.
+    caf::result<std::vector<batch_result>>(batch_atom, std::vector<batch_op>,
+                                           bool, uint64_t),
+    // Reads the committed state of all items that match the filter.
+    caf::result<item_snapshot>(snapshot_atom, subscription_filter)>;
 };
 
 using database_actor = caf::typed_actor<database_trait>;
 // --(database-actor-end)--
 
+/// Configures whether and how mutations share a single commit.
+struct commit_policy {
+  /// Maximum time a mutation waits for others to share its commit. A zero
+  /// window disables group commit, i.e., each mutation commits on its own.
+  caf::timespan window{0};
+
+  /// Maximum number of mutations that share a single commit.
+  size_t max_batch = 64;
+};
+
 // --(spawn-database-actor-begin)--
 std::pair<database_actor, item_events>
-spawn_database_actor(caf::actor_system& sys, database_ptr db);
+spawn_database_actor(caf::actor_system& sys, database_ptr db,
+                     item_cache_ptr cache, response_cache_ptr responses,
+                     commit_policy policy = {});
 // --(spawn-database-actor-end)--
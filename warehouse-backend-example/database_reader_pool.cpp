@@ -0,0 +1,73 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "database_reader_pool.hpp"
+
+#include "applog.hpp"
+#include "ec.hpp"
+#include "metrics.hpp"
+#include "tracing.hpp"
+
+#include <caf/actor_from_state.hpp>
+#include <caf/actor_system.hpp>
+#include <caf/error.hpp>
+
+namespace {
+
+struct database_reader_state {
+  database_reader_state(database_reader_actor::pointer self_ptr,
+                        database_ptr db_ptr, item_cache_ptr cache_ptr,
+                        database_actor writer)
+    : self(self_ptr), db(db_ptr), cache(cache_ptr) {
+    // Stop if the database actor terminates.
+    self->monitor(writer, [this](const caf::error& reason) {
+      applog::debug("database reader lost the database actor: {}", reason);
+      self->quit(reason);
+    });
+  }
+
+  database_reader_actor::behavior_type make_behavior() {
+    return {
+      [this](get_atom, int32_t id, uint64_t trace) -> caf::result<item> {
+        if (auto value = cache->get(id))
+          return {std::move(*value)};
+        auto span = tracing::scoped_span{"db.get", trace};
+        auto token = cache->fill_token(id);
+        auto timer = metrics::stopwatch{metrics::histogram::db_get};
+        auto value = db->get(id);
+        timer.stop();
+        if (!value)
+          return {caf::make_error(ec::no_such_item)};
+        cache->fill(*value, token);
+        return {std::move(*value)};
+      },
+      [this](list_atom, const item_query& query,
+             uint64_t trace) -> caf::result<item_page> {
+        auto timer = metrics::scoped_timer{metrics::histogram::db_list};
+        auto span = tracing::scoped_span{"db.list", trace};
+        auto result = item_page{};
+        if (auto err = run_item_query(*db, query, result); err != ec::nil)
+          return {caf::make_error(err)};
+        return result;
+      },
+    };
+  }
+
+  database_reader_actor::pointer self;
+  database_ptr db;
+  item_cache_ptr cache;
+};
+
+} // namespace
+
+database_reader_actor spawn_database_reader(caf::actor_system& sys,
+                                            database_ptr db,
+                                            item_cache_ptr cache,
+                                            database_actor writer) {
+  // Note: just like the database actor, readers use a blocking API and thus
+  //       run in their own thread.
+  using caf::actor_from_state;
+  using caf::detached;
+  return sys.spawn<detached>(actor_from_state<database_reader_state>,
+                             std::move(db), std::move(cache),
+                             std::move(writer));
+}
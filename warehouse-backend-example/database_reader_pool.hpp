@@ -0,0 +1,72 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "database.hpp"
+#include "database_actor.hpp"
+#include "item.hpp"
+#include "item_cache.hpp"
+#include "item_query.hpp"
+#include "types.hpp"
+
+#include <caf/fwd.hpp>
+#include <caf/typed_actor.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct database_reader_trait {
+  using signatures = caf::type_list<
+    // Retrieves an item from the database. The last argument is a trace ID.
+    caf::result<item>(get_atom, int32_t, uint64_t),
+    // Retrieves a page of items from the database.
+    caf::result<item_page>(list_atom, item_query, uint64_t)>;
+};
+
+/// An actor that answers read queries from a read-only database connection.
+/// The database actor also implements this interface.
+using database_reader_actor = caf::typed_actor<database_reader_trait>;
+
+/// Spawns a detached actor that answers read queries from `cache` or `db`. The
+/// actor terminates when `writer` terminates.
+database_reader_actor spawn_database_reader(caf::actor_system& sys,
+                                            database_ptr db,
+                                            item_cache_ptr cache,
+                                            database_actor writer);
+
+/// Distributes read queries round-robin over a set of reader actors.
+class database_reader_pool {
+public:
+  /// Creates a pool that sends all reads to `writer`.
+  explicit database_reader_pool(database_actor writer) {
+    readers_.emplace_back(std::move(writer));
+  }
+
+  /// Creates a pool for `readers`.
+  /// @pre `readers` is not empty.
+  explicit database_reader_pool(std::vector<database_reader_actor> readers)
+    : readers_(std::move(readers)) {
+    // nop
+  }
+
+  /// Returns the reader for the next query.
+  const database_reader_actor& next() noexcept {
+    auto index = next_.fetch_add(1, std::memory_order_relaxed);
+    return readers_[index % readers_.size()];
+  }
+
+  /// Returns the number of readers in the pool.
+  size_t size() const noexcept {
+    return readers_.size();
+  }
+
+private:
+  std::vector<database_reader_actor> readers_;
+  std::atomic<size_t> next_ = 0;
+};
+
+/// A smart pointer to a reader pool.
+using database_reader_pool_ptr = std::shared_ptr<database_reader_pool>;
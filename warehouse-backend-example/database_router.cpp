@@ -0,0 +1,425 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "database_router.hpp"
+
+#include "batch.hpp"
+#include "ec.hpp"
+#include "item.hpp"
+#include "item_query.hpp"
+#include "subscription.hpp"
+#include "types.hpp"
+
+#include <caf/actor_from_state.hpp>
+#include <caf/actor_system.hpp>
+#include <caf/async/publisher.hpp>
+#include <caf/error.hpp>
+#include <caf/exit_reason.hpp>
+#include <caf/flow/multicaster.hpp>
+#include <caf/flow/observable_builder.hpp>
+#include <caf/scheduled_actor/flow.hpp>
+#include <caf/typed_response_promise.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+// Maximum time for a shard to answer a request that spans multiple shards.
+constexpr auto shard_timeout = 10s;
+
+/// Collects one response per shard and calls `done` once all responses
+/// arrived. Delivers the first error to the client instead.
+template <class T, class Result>
+struct gather {
+  using promise_type = caf::typed_response_promise<Result>;
+
+  using callback = std::function<void(std::vector<T>&, promise_type&)>;
+
+  gather(size_t num_responses, promise_type prom, callback fn)
+    : results(num_responses),
+      missing(num_responses),
+      prom(std::move(prom)),
+      done(std::move(fn)) {
+    // nop
+  }
+
+  void set(size_t index, T&& result) {
+    if (failed)
+      return;
+    results[index] = std::move(result);
+    if (--missing == 0)
+      done(results, prom);
+  }
+
+  void fail(const caf::error& reason) {
+    if (failed)
+      return;
+    failed = true;
+    prom.deliver(reason);
+  }
+
+  std::vector<T> results;
+  size_t missing;
+  promise_type prom;
+  callback done;
+  bool failed = false;
+};
+
+using batch_results = std::vector<batch_result>;
+
+using page_promise = caf::typed_response_promise<item_page>;
+
+using batch_promise = caf::typed_response_promise<batch_results>;
+
+/// A snapshot that waits for the responses of all shards.
+struct pending_snapshot {
+  subscription_filter filter;
+  caf::typed_response_promise<item_snapshot> prom;
+  /// The snapshots of the individual shards.
+  std::vector<std::optional<item_snapshot>> parts;
+  size_t missing = 0;
+  /// Matching events that the router forwarded while waiting, together with
+  /// the index of their shard.
+  std::vector<std::pair<size_t, item_event>> changes;
+};
+
+struct database_router_state {
+  database_router_state(database_actor::pointer self_ptr,
+                        std::vector<database_shard> shard_list,
+                        item_events* events)
+    : self(self_ptr), mcast(self), shard_seq(shard_list.size()) {
+    *events = mcast.as_observable().to_publisher();
+    for (size_t index = 0; index < shard_list.size(); ++index) {
+      auto& [hdl, shard_events] = shard_list[index];
+      self->monitor(hdl, [this](const caf::error& reason) { //
+        self->quit(reason);
+      });
+      shard_events.observe_on(self)
+        .do_finally([this] {
+          if (++closed_shards == shards.size())
+            mcast.close();
+        })
+        .for_each([this, index](const item_event& event) {
+          if (event != nullptr)
+            forward(index, event);
+        });
+      shards.push_back(std::move(hdl));
+    }
+  }
+
+  ~database_router_state() {
+    for (auto& hdl : shards)
+      anon_send_exit(hdl, caf::exit_reason::user_shutdown);
+  }
+
+  database_actor::behavior_type make_behavior();
+
+  const database_actor& shard(int32_t id) const {
+    return shards[shard_of(id, shards.size())];
+  }
+
+  /// Lists the items with given IDs, preserving their order.
+  caf::result<item_page> list_ids(const item_query& query, uint64_t trace);
+
+  /// Lists a range of items by merging the first page of each shard.
+  caf::result<item_page> list_range(const item_query& query, uint64_t trace);
+
+  /// Applies a batch on all shards that own at least one of its items.
+  caf::result<std::vector<batch_result>>
+  apply_batch(const std::vector<batch_op>& ops, bool atomic, uint64_t trace);
+
+  /// Combines the snapshots of all shards.
+  caf::result<item_snapshot> snapshot(const subscription_filter& filter);
+
+  /// Publishes an event of a shard with a global sequence number.
+  void forward(size_t index, const item_event& event);
+
+  /// Delivers all pending snapshots that are consistent with the events the
+  /// router forwarded so far.
+  void complete_snapshots();
+
+  database_actor::pointer self;
+  std::vector<database_actor> shards;
+  caf::flow::multicaster<item_event> mcast;
+  size_t closed_shards = 0;
+  // The sequence number of the last forwarded event.
+  uint64_t seq = 0;
+  // The shard-local sequence number of the last forwarded event per shard.
+  std::vector<uint64_t> shard_seq;
+  uint64_t next_snapshot_id = 0;
+  std::map<uint64_t, pending_snapshot> snapshots;
+};
+
+database_actor::behavior_type database_router_state::make_behavior() {
+  return {
+    [this](get_atom, int32_t id, uint64_t trace) -> caf::result<item> {
+      return self->mail(get_atom_v, id, trace).delegate(shard(id));
+    },
+    [this](list_atom, const item_query& query,
+           uint64_t trace) -> caf::result<item_page> {
+      if (!query.ids.empty())
+        return list_ids(query, trace);
+      return list_range(query, trace);
+    },
+    [this](add_atom, int32_t id, int32_t price, const std::string& name,
+           uint64_t trace) -> caf::result<void> {
+      return self->mail(add_atom_v, id, price, name, trace)
+        .delegate(shard(id));
+    },
+    [this](inc_atom, int32_t id, int32_t amount,
+           uint64_t trace) -> caf::result<int32_t> {
+      return self->mail(inc_atom_v, id, amount, trace).delegate(shard(id));
+    },
+    [this](dec_atom, int32_t id, int32_t amount,
+           uint64_t trace) -> caf::result<int32_t> {
+      return self->mail(dec_atom_v, id, amount, trace).delegate(shard(id));
+    },
+    [this](del_atom, int32_t id, uint64_t trace) -> caf::result<void> {
+      return self->mail(del_atom_v, id, trace).delegate(shard(id));
+    },
+    [this](batch_atom, const std::vector<batch_op>& ops, bool atomic,
+           uint64_t trace) -> caf::result<std::vector<batch_result>> {
+      return apply_batch(ops, atomic, trace);
+    },
+    [this](snapshot_atom,
+           const subscription_filter& filter) -> caf::result<item_snapshot> {
+      return snapshot(filter);
+    },
+  };
+}
+
+caf::result<item_page>
+database_router_state::list_ids(const item_query& query, uint64_t trace) {
+  auto parts = std::vector<item_query>(shards.size());
+  for (auto id : query.ids)
+    parts[shard_of(id, shards.size())].ids.push_back(id);
+  auto targets = std::vector<size_t>{};
+  for (size_t index = 0; index < parts.size(); ++index)
+    if (!parts[index].ids.empty())
+      targets.push_back(index);
+  if (targets.size() == 1)
+    return self->mail(list_atom_v, query, trace)
+      .delegate(shards[targets.front()]);
+  auto prom = self->make_response_promise<item_page>();
+  auto merge = [ids = query.ids](std::vector<item_page>& pages,
+                                 page_promise& out) {
+    auto index = std::unordered_map<int32_t, const item*>{};
+    for (const auto& page : pages)
+      for (const auto& value : page.items)
+        index.emplace(value.id, &value);
+    auto result = item_page{};
+    for (auto id : ids)
+      if (auto i = index.find(id); i != index.end())
+        result.items.push_back(*i->second);
+    out.deliver(std::move(result));
+  };
+  auto state = std::make_shared<gather<item_page, item_page>>(targets.size(),
+                                                              prom, merge);
+  for (size_t pos = 0; pos < targets.size(); ++pos) {
+    auto index = targets[pos];
+    self->mail(list_atom_v, std::move(parts[index]), trace)
+      .request(shards[index], shard_timeout)
+      .then([state, pos](item_page& page) { state->set(pos, std::move(page)); },
+            [state](const caf::error& what) { state->fail(what); });
+  }
+  return prom;
+}
+
+caf::result<item_page>
+database_router_state::list_range(const item_query& query,
+                                  uint64_t trace) {
+  // Each shard returns its first `limit` items of the range. Hence, the first
+  // `limit` items of the merged result are the first page of the range.
+  auto prom = self->make_response_promise<item_page>();
+  auto merge = [limit = query.limit](std::vector<item_page>& pages,
+                                     page_promise& out) {
+    auto result = item_page{};
+    auto next = std::numeric_limits<int32_t>::max();
+    for (auto& page : pages) {
+      std::move(page.items.begin(), page.items.end(),
+                std::back_inserter(result.items));
+      if (page.has_next) {
+        result.has_next = true;
+        next = std::min(next, page.next);
+      }
+    }
+    auto& items = result.items;
+    std::sort(items.begin(), items.end(),
+              [](const item& x, const item& y) { return x.id < y.id; });
+    if (items.size() > static_cast<size_t>(limit)) {
+      result.has_next = true;
+      next = std::min(next, items[limit].id);
+      items.erase(items.begin() + limit, items.end());
+    }
+    if (result.has_next)
+      result.next = next;
+    out.deliver(std::move(result));
+  };
+  auto state = std::make_shared<gather<item_page, item_page>>(shards.size(),
+                                                              prom, merge);
+  for (size_t index = 0; index < shards.size(); ++index) {
+    self->mail(list_atom_v, query, trace)
+      .request(shards[index], shard_timeout)
+      .then(
+        [state, index](item_page& page) { state->set(index, std::move(page)); },
+        [state](const caf::error& what) { state->fail(what); });
+  }
+  return prom;
+}
+
+caf::result<batch_results>
+database_router_state::apply_batch(const std::vector<batch_op>& ops,
+                                   bool atomic, uint64_t trace) {
+  // Remember the position of each operation for merging the results.
+  auto positions = std::vector<std::vector<size_t>>(shards.size());
+  for (size_t pos = 0; pos < ops.size(); ++pos)
+    positions[shard_of(ops[pos].id, shards.size())].push_back(pos);
+  auto targets = std::vector<size_t>{};
+  for (size_t index = 0; index < positions.size(); ++index)
+    if (!positions[index].empty())
+      targets.push_back(index);
+  if (targets.empty())
+    return batch_results{};
+  if (targets.size() == 1)
+    return self->mail(batch_atom_v, ops, atomic, trace)
+      .delegate(shards[targets.front()]);
+  // Shards commit independently, so we cannot roll back a partial failure.
+  if (atomic)
+    return {caf::make_error(ec::cross_shard_transaction)};
+  auto prom = self->make_response_promise<batch_results>();
+  auto merge = [targets, positions, size = ops.size()](
+                 std::vector<batch_results>& parts, batch_promise& out) {
+    auto results = batch_results(size);
+    for (size_t pos = 0; pos < targets.size(); ++pos) {
+      const auto& indexes = positions[targets[pos]];
+      for (size_t i = 0; i < indexes.size() && i < parts[pos].size(); ++i)
+        results[indexes[i]] = std::move(parts[pos][i]);
+    }
+    out.deliver(std::move(results));
+  };
+  auto state = std::make_shared<gather<batch_results, batch_results>>(
+    targets.size(), prom, merge);
+  for (size_t pos = 0; pos < targets.size(); ++pos) {
+    auto index = targets[pos];
+    auto part = std::vector<batch_op>{};
+    part.reserve(positions[index].size());
+    for (auto i : positions[index])
+      part.push_back(ops[i]);
+    self->mail(batch_atom_v, std::move(part), false, trace)
+      .request(shards[index], shard_timeout)
+      .then(
+        [state, pos](batch_results& res) { state->set(pos, std::move(res)); },
+        [state](const caf::error& what) { state->fail(what); });
+  }
+  return prom;
+}
+
+caf::result<item_snapshot>
+database_router_state::snapshot(const subscription_filter& filter) {
+  auto id = next_snapshot_id++;
+  auto& snap = snapshots[id];
+  snap.filter = filter;
+  snap.prom = self->make_response_promise<item_snapshot>();
+  snap.parts.resize(shards.size());
+  snap.missing = shards.size();
+  auto result = snap.prom;
+  for (size_t index = 0; index < shards.size(); ++index) {
+    self->mail(snapshot_atom_v, filter)
+      .request(shards[index], shard_timeout)
+      .then(
+        [this, id, index](item_snapshot& part) {
+          auto i = snapshots.find(id);
+          if (i == snapshots.end())
+            return;
+          i->second.parts[index] = std::move(part);
+          if (--i->second.missing == 0)
+            complete_snapshots();
+        },
+        [this, id](const caf::error& what) {
+          if (auto i = snapshots.find(id); i != snapshots.end()) {
+            i->second.prom.deliver(what);
+            snapshots.erase(i);
+          }
+        });
+  }
+  return result;
+}
+
+void database_router_state::forward(size_t index, const item_event& event) {
+  shard_seq[index] = event->seq;
+  for (auto& [id, snap] : snapshots)
+    if (snap.filter.matches(event->value.id))
+      snap.changes.emplace_back(index, event);
+  auto change = std::make_shared<item_change>(*event);
+  change->seq = ++seq;
+  mcast.push(std::move(change));
+  if (!snapshots.empty())
+    complete_snapshots();
+}
+
+void database_router_state::complete_snapshots() {
+  // A snapshot is consistent with our sequence numbers once we have forwarded
+  // all events that the shard snapshots include. Events with a larger
+  // shard-local sequence number got a global sequence number before the
+  // snapshot, so we apply them to the snapshot.
+  auto ready = [this](const pending_snapshot& snap) {
+    if (snap.missing > 0)
+      return false;
+    for (size_t index = 0; index < shards.size(); ++index)
+      if (shard_seq[index] < snap.parts[index]->seq)
+        return false;
+    return true;
+  };
+  for (auto i = snapshots.begin(); i != snapshots.end();) {
+    auto& snap = i->second;
+    if (!ready(snap)) {
+      ++i;
+      continue;
+    }
+    auto latest = std::unordered_map<int32_t, const item_change*>{};
+    for (const auto& [index, event] : snap.changes)
+      if (event->seq > snap.parts[index]->seq)
+        latest[event->value.id] = event.get();
+    auto result = item_snapshot{};
+    result.seq = seq;
+    auto& items = result.items;
+    for (auto& part : snap.parts)
+      for (auto& value : part->items) {
+        auto j = latest.find(value.id);
+        if (j == latest.end()) {
+          items.push_back(std::move(value));
+          continue;
+        }
+        if (j->second->type != change_type::erased)
+          items.push_back(j->second->value);
+        latest.erase(j);
+      }
+    // The remaining changes refer to items that the shard snapshots miss.
+    for (const auto& [id, change] : latest)
+      if (change->type != change_type::erased)
+        items.push_back(change->value);
+    std::sort(items.begin(), items.end(),
+              [](const item& x, const item& y) { return x.id < y.id; });
+    snap.prom.deliver(std::move(result));
+    i = snapshots.erase(i);
+  }
+}
+
+} // namespace
+
+database_shard spawn_database_router(caf::actor_system& sys,
+                                     std::vector<database_shard> shards) {
+  using caf::actor_from_state;
+  item_events events;
+  auto hdl = sys.spawn(actor_from_state<database_router_state>,
+                       std::move(shards), &events);
+  return {hdl, std::move(events)};
+}
@@ -0,0 +1,29 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "database_actor.hpp"
+#include "item.hpp"
+
+#include <caf/actor_system.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/// A database actor together with the events it publishes.
+using database_shard = std::pair<database_actor, item_events>;
+
+/// Returns the index of the shard that owns the item with given ID.
+inline size_t shard_of(int32_t id, size_t num_shards) noexcept {
+  return static_cast<uint32_t>(id) % num_shards;
+}
+
+/// Spawns an actor that partitions the items by ID across `shards` and offers
+/// the same interface as a single database actor. The router merges the
+/// events of all shards into a single stream with its own sequence numbers.
+/// Atomic batches must not span multiple shards. The router terminates all
+/// shards when it terminates and vice versa.
+database_shard spawn_database_router(caf::actor_system& sys,
+                                     std::vector<database_shard> shards);
@@ -8,6 +8,11 @@ std::string_view ec_names[] = {
   "nil",
   "no_such_item",
   "key_already_exists",
+  "database_inaccessible",
+  "invalid_argument",
+  "transaction_aborted",
+  "cross_shard_transaction",
+  "overloaded",
 };
 
 } // namespace
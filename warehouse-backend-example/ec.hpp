@@ -20,6 +20,14 @@ enum class ec : uint8_t {
   database_inaccessible,
   /// Indicates that a user-provided argument is invalid.
   invalid_argument,
+  /// Indicates that an operation was rolled back because another operation
+  /// in the same atomic batch failed.
+  transaction_aborted,
+  /// Indicates that an atomic batch touches items on more than one shard.
+  cross_shard_transaction,
+  /// Indicates that admission control rejected a request to protect the
+  /// database from overload.
+  overloaded,
   /// The number of error codes (must be last entry!).
   /// @note This value is not a valid error code.
   num_ec_codes,
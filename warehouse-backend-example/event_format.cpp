@@ -0,0 +1,183 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "event_format.hpp"
+
+#include <caf/error.hpp>
+#include <caf/sec.hpp>
+
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+
+namespace {
+
+// Upper bound for the batch interval of a subscriber in milliseconds.
+constexpr uint32_t max_batch_ms = 1000;
+
+template <class T>
+void append_int(T value, std::string& out) {
+  char buf[24];
+  auto [end, err] = std::to_chars(buf, buf + sizeof(buf), value);
+  out.append(buf, end);
+}
+
+void append_json_string(std::string_view str, std::string& out) {
+  constexpr std::string_view hex = "0123456789abcdef";
+  out += '"';
+  for (auto ch : str) {
+    switch (ch) {
+      case '"':
+        out += R"(\")";
+        break;
+      case '\\':
+        out += R"(\\)";
+        break;
+      case '\n':
+        out += R"(\n)";
+        break;
+      case '\r':
+        out += R"(\r)";
+        break;
+      case '\t':
+        out += R"(\t)";
+        break;
+      default:
+        if (static_cast<unsigned char>(ch) < 0x20) {
+          out += R"(\u00)";
+          out += hex[(ch >> 4) & 0x0F];
+          out += hex[ch & 0x0F];
+        } else {
+          out += ch;
+        }
+    }
+  }
+  out += '"';
+}
+
+/// Appends `"epoch":<epoch>,"seq":<seq>` to `out`.
+void append_position(uint64_t epoch, uint64_t seq, std::string& out) {
+  out += R"("epoch":)";
+  append_int(epoch, out);
+  out += R"(,"seq":)";
+  append_int(seq, out);
+}
+
+/// Parses `<epoch>:<seq>`.
+bool parse_position(std::string_view str, stream_position& result) {
+  auto sep = str.find(':');
+  if (sep == std::string_view::npos)
+    return false;
+  auto parse = [](std::string_view digits, uint64_t& value) {
+    auto* last = digits.data() + digits.size();
+    auto [ptr, err] = std::from_chars(digits.data(), last, value);
+    return err == std::errc{} && ptr == last && !digits.empty();
+  };
+  return parse(str.substr(0, sep), result.epoch)
+         && parse(str.substr(sep + 1), result.seq);
+}
+
+} // namespace
+
+std::string to_string(event_format format) {
+  switch (format) {
+    default:
+      return "full";
+    case event_format::delta:
+      return "delta";
+  }
+}
+
+bool from_string(std::string_view name, event_format& format) {
+  if (name == "full") {
+    format = event_format::full;
+    return true;
+  }
+  if (name == "delta") {
+    format = event_format::delta;
+    return true;
+  }
+  return false;
+}
+
+caf::expected<stream_options>
+make_stream_options(const caf::uri::query_map& query) {
+  stream_options result;
+  if (auto i = query.find("format"); i != query.end()) {
+    if (!from_string(i->second, result.format))
+      return caf::make_error(caf::sec::invalid_argument,
+                             "format must be full or delta");
+  }
+  if (auto i = query.find("batch"); i != query.end()) {
+    const auto& str = i->second;
+    uint32_t ms = 0;
+    auto [ptr, err] = std::from_chars(str.data(), str.data() + str.size(), ms);
+    if (err != std::errc{} || ptr != str.data() + str.size()
+        || ms > max_batch_ms)
+      return caf::make_error(caf::sec::invalid_argument,
+                             "batch must be an interval in ms (0-1000)");
+    result.batch_interval = std::chrono::milliseconds{ms};
+  }
+  if (auto i = query.find("since"); i != query.end()) {
+    stream_position pos;
+    if (!parse_position(i->second, pos))
+      return caf::make_error(caf::sec::invalid_argument,
+                             "since must be a stream position (epoch:seq)");
+    result.since = pos;
+  }
+  return result;
+}
+
+void append_delta(uint64_t epoch, const item_change& change,
+                  std::string& out) {
+  const auto& value = change.value;
+  out += '{';
+  append_position(epoch, change.seq, out);
+  out += R"(,"id":)";
+  append_int(value.id, out);
+  switch (change.type) {
+    case change_type::added:
+      out += R"(,"price":)";
+      append_int(value.price, out);
+      out += R"(,"available":)";
+      append_int(value.available, out);
+      out += R"(,"name":)";
+      append_json_string(value.name, out);
+      break;
+    case change_type::updated:
+      out += R"(,"available":)";
+      append_int(value.available, out);
+      break;
+    case change_type::erased:
+      out += R"(,"erased":true)";
+      break;
+  }
+  out += '}';
+}
+
+void append_full(uint64_t epoch, const item_change& change,
+                 std::string_view item, std::string& out) {
+  out += '{';
+  append_position(epoch, change.seq, out);
+  // Splice the fields of the item into the same object.
+  if (item.size() > 2) {
+    out += ',';
+    out.append(item.substr(1));
+  } else {
+    out += '}';
+  }
+}
+
+void append_snapshot(uint64_t epoch, uint64_t seq, std::string_view items,
+                     std::string& out) {
+  out += '{';
+  append_position(epoch, seq, out);
+  out += R"(,"items":)";
+  out.append(items);
+  out += '}';
+}
+
+void append_resync(uint64_t epoch, uint64_t seq, std::string& out) {
+  out += R"({"resync":true,)";
+  append_position(epoch, seq, out);
+  out += '}';
+}
@@ -0,0 +1,74 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "item.hpp"
+
+#include <caf/expected.hpp>
+#include <caf/timespan.hpp>
+#include <caf/uri.hpp>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/// Selects how the server encodes item events for a subscriber. Each frame
+/// starts with the stream position of the change, see `stream_position`.
+enum class event_format {
+  /// Sends the full item as JSON object for each change:
+  /// `{"epoch":1700000000000000,"seq":7,"id":1,"name":"foo",...}`.
+  full,
+  /// Sends only the changed fields: `available` for `inc` and `dec`,
+  /// `"erased":true` for `del` and all fields for `add`, e.g.,
+  /// `{"epoch":1700000000000000,"seq":8,"id":1,"available":3}`.
+  delta,
+};
+
+/// @relates event_format
+std::string to_string(event_format);
+
+/// @relates event_format
+bool from_string(std::string_view, event_format&);
+
+/// A position in the event stream of a server. Sequence numbers restart with
+/// each server process, so a position also includes the epoch of the process
+/// that assigned the sequence number. Clients resume a stream with
+/// `since=<epoch>:<seq>`.
+struct stream_position {
+  uint64_t epoch = 0;
+  uint64_t seq = 0;
+};
+
+/// Configures the encoding of events for a single subscriber.
+struct stream_options {
+  event_format format = event_format::full;
+  /// Groups all events of this interval into a single frame with a JSON array.
+  /// Within a group, the latest delta for an item replaces earlier `inc` and
+  /// `dec` deltas. A zero interval sends each event in its own frame.
+  caf::timespan batch_interval{0};
+  /// Resumes the stream after the event at this position.
+  std::optional<stream_position> since;
+};
+
+/// Parses stream options from the query of a WebSocket upgrade request.
+/// Accepts the parameters `format` (`full` or `delta`), `batch` (interval in
+/// milliseconds, at most 1000) and `since` (`<epoch>:<seq>`).
+caf::expected<stream_options>
+make_stream_options(const caf::uri::query_map& query);
+
+/// Appends the delta encoding of `change` to `out`.
+void append_delta(uint64_t epoch, const item_change& change, std::string& out);
+
+/// Appends the full encoding of `change` to `out`.
+/// @param item The JSON object for `change.value`.
+void append_full(uint64_t epoch, const item_change& change,
+                 std::string_view item, std::string& out);
+
+/// Appends `{"epoch":<epoch>,"seq":<seq>,"items":<items>}` to `out`.
+/// @param items The JSON array with all items of a snapshot.
+void append_snapshot(uint64_t epoch, uint64_t seq, std::string_view items,
+                     std::string& out);
+
+/// Appends `{"resync":true,"epoch":<epoch>,"seq":<seq>}` to `out`.
+void append_resync(uint64_t epoch, uint64_t seq, std::string& out);
@@ -0,0 +1,494 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "event_hub.hpp"
+
+#include "applog.hpp"
+#include "metrics.hpp"
+#include "types.hpp"
+
+#include <caf/disposable.hpp>
+#include <caf/event_based_actor.hpp>
+#include <caf/flow/multicaster.hpp>
+#include <caf/json_writer.hpp>
+#include <caf/scheduled_actor/flow.hpp>
+#include <caf/sec.hpp>
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <vector>
+
+using namespace std::literals;
+
+namespace ws = caf::net::web_socket;
+
+namespace {
+
+// How often a lagging subscriber checks whether it can make progress.
+constexpr auto conflate_interval = 5ms;
+
+// Maximum time for reading the snapshot of a new subscriber.
+constexpr auto snapshot_timeout = 10s;
+
+/// Returns a new epoch for the sequence numbers of this process: the current
+/// time in microseconds, which stays within the safe integer range of JSON.
+uint64_t make_epoch() {
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(now);
+  return static_cast<uint64_t>(us.count());
+}
+
+} // namespace
+
+/// Sends frames to a single WebSocket client. While waiting for a snapshot,
+/// the subscriber holds back all events. While the client lags behind, the
+/// subscriber either buffers events or merges them per item, depending on the
+/// policy. Optionally, the subscriber groups events into one frame per tick.
+class event_subscriber
+  : public std::enable_shared_from_this<event_subscriber> {
+public:
+  event_subscriber(caf::event_based_actor* self, subscriber_policy policy,
+                   subscription_filter filter, stream_options opts)
+    : self_(self),
+      out_(self),
+      policy_(policy),
+      filter_(std::move(filter)),
+      opts_(opts) {
+    // nop
+  }
+
+  const subscription_filter& filter() const noexcept {
+    return filter_;
+  }
+
+  event_format format() const noexcept {
+    return opts_.format;
+  }
+
+  /// Connects the subscriber to the client. Calls `on_close` once the client
+  /// disconnects or the subscriber stops.
+  void start(event_hub::frame_resource push, std::function<void()> on_close) {
+    out_.as_observable()
+      .do_finally([weak_this = weak_from_this(), f = std::move(on_close)] {
+        if (auto strong_this = weak_this.lock())
+          strong_this->dispose();
+        f();
+      })
+      .subscribe(std::move(push));
+  }
+
+  /// Sends a frame right away.
+  void send_now(const ws::frame& frame) {
+    out_.push(frame);
+  }
+
+  /// Holds back all events until `end_sync`.
+  void begin_sync() {
+    syncing_ = true;
+  }
+
+  /// Sends the snapshot followed by all held back events that the snapshot
+  /// does not include yet.
+  void end_sync(uint64_t seq, const ws::frame& snapshot) {
+    syncing_ = false;
+    out_.push(snapshot);
+    auto backlog = std::move(backlog_);
+    backlog_.clear();
+    for (const auto& event : backlog)
+      if (event.seq > seq)
+        deliver(event);
+  }
+
+  /// Sends the events that the client missed before resuming the stream.
+  /// Unlike new events, they do not count as lag: they wait until the client
+  /// has demand, and new events queue up behind them.
+  void replay(std::vector<event_frame> events) {
+    replay_.insert(replay_.end(), std::make_move_iterator(events.begin()),
+                   std::make_move_iterator(events.end()));
+    flush();
+  }
+
+  void push(const event_frame& event) {
+    if (syncing_) {
+      if (backlog_.size() >= policy_.max_items) {
+        applog::info("disconnect a subscriber that waits too long for its "
+                     "snapshot");
+        metrics::inc(metrics::counter::ws_overflows);
+        abort(caf::make_error(caf::sec::backpressure_overflow));
+        return;
+      }
+      backlog_.push_back(event);
+      return;
+    }
+    deliver(event);
+  }
+
+  /// Closes the connection after sending all frames that the client can
+  /// take right away.
+  void close() {
+    flush();
+    flush_batch();
+    dispose();
+    out_.close();
+  }
+
+  void abort(const caf::error& reason) {
+    dispose();
+    out_.abort(reason);
+  }
+
+private:
+  bool lagging() const noexcept {
+    return !queue_.empty() || out_.max_buffered() >= policy_.max_pending;
+  }
+
+  void deliver(const event_frame& event) {
+    metrics::observe(metrics::histogram::ws_backlog, out_.max_buffered());
+    if (!replay_.empty()) {
+      if (replay_.size() >= policy_.max_items) {
+        applog::info("disconnect a subscriber that falls behind while "
+                     "replaying missed events");
+        metrics::inc(metrics::counter::ws_overflows);
+        abort(caf::make_error(caf::sec::backpressure_overflow));
+        return;
+      }
+      replay_.push_back(event);
+      return;
+    }
+    if (!lagging()) {
+      emit(event);
+      return;
+    }
+    if (policy_.mode == backpressure_policy::buffer) {
+      applog::info("disconnect a subscriber with {} pending events",
+                   out_.max_buffered());
+      metrics::inc(metrics::counter::ws_overflows);
+      abort(caf::make_error(caf::sec::backpressure_overflow));
+      return;
+    }
+    // Like in `emit`, only an update replaces a pending update. Additions and
+    // erasures carry information that a later update does not repeat.
+    if (auto i = latest_.find(event.id); i != latest_.end()) {
+      auto& pending = queue_[i->second - popped_];
+      if (event.type == change_type::updated
+          && pending.type == change_type::updated) {
+        pending = event;
+        return;
+      }
+    }
+    latest_[event.id] = popped_ + queue_.size();
+    queue_.push_back(event);
+    if (queue_.size() > policy_.max_items) {
+      applog::info("disconnect a subscriber with {} conflated events",
+                   queue_.size());
+      metrics::inc(metrics::counter::ws_overflows);
+      abort(caf::make_error(caf::sec::backpressure_overflow));
+      return;
+    }
+    schedule_flush();
+  }
+
+  void flush() {
+    while (!replay_.empty() && out_.max_buffered() < policy_.max_pending) {
+      emit(replay_.front());
+      replay_.pop_front();
+    }
+    if (!replay_.empty()) {
+      schedule_flush();
+      return;
+    }
+    while (!queue_.empty() && out_.max_buffered() < policy_.max_pending) {
+      auto event = std::move(queue_.front());
+      queue_.pop_front();
+      // Keep the index if a later event for the same item is still pending.
+      if (auto i = latest_.find(event.id);
+          i != latest_.end() && i->second == popped_)
+        latest_.erase(i);
+      ++popped_;
+      emit(event);
+    }
+    if (!queue_.empty())
+      schedule_flush();
+  }
+
+  void schedule_flush() {
+    if (flush_timer_.valid() && !flush_timer_.disposed())
+      return;
+    flush_timer_ = self_->run_delayed(conflate_interval,
+                                      [weak_this = weak_from_this()] {
+                                        if (auto ptr = weak_this.lock())
+                                          ptr->flush();
+                                      });
+  }
+
+  /// Sends an event right away or adds it to the current batch.
+  void emit(const event_frame& event) {
+    if (opts_.batch_interval.count() == 0) {
+      out_.push(event.frame);
+      return;
+    }
+    // Deltas of `inc` and `dec` carry the full new state of the field they
+    // change, so the latest one makes earlier ones obsolete.
+    auto i = batch_index_.find(event.id);
+    if (i != batch_index_.end() && event.type == change_type::updated
+        && batch_[i->second].type == change_type::updated) {
+      batch_[i->second] = event;
+      return;
+    }
+    batch_index_[event.id] = batch_.size();
+    batch_.push_back(event);
+    if (batch_.size() == 1)
+      batch_timer_ = self_->run_delayed(opts_.batch_interval,
+                                        [weak_this = weak_from_this()] {
+                                          if (auto ptr = weak_this.lock())
+                                            ptr->flush_batch();
+                                        });
+  }
+
+  /// Sends all events of the current batch as a single JSON array.
+  void flush_batch() {
+    batch_timer_.dispose();
+    if (batch_.empty())
+      return;
+    std::string buf;
+    buf += '[';
+    for (const auto& event : batch_) {
+      if (buf.size() > 1)
+        buf += ',';
+      buf += event.frame.as_text();
+    }
+    buf += ']';
+    batch_.clear();
+    batch_index_.clear();
+    out_.push(ws::frame{buf});
+  }
+
+  void dispose() {
+    flush_timer_.dispose();
+    batch_timer_.dispose();
+    latest_.clear();
+    queue_.clear();
+    backlog_.clear();
+    replay_.clear();
+    batch_.clear();
+    batch_index_.clear();
+  }
+
+  caf::event_based_actor* self_;
+  caf::flow::multicaster<ws::frame> out_;
+  subscriber_policy policy_;
+  subscription_filter filter_;
+  stream_options opts_;
+  caf::disposable flush_timer_;
+  caf::disposable batch_timer_;
+  bool syncing_ = false;
+  // Events that arrived before the snapshot.
+  std::vector<event_frame> backlog_;
+  // Missed events of a resumed stream plus new events that arrived since.
+  std::deque<event_frame> replay_;
+  // Events that wait for the client and the position of the last event per
+  // item, counting from the first event that ever entered the queue.
+  std::deque<event_frame> queue_;
+  std::unordered_map<int32_t, size_t> latest_;
+  size_t popped_ = 0;
+  // Events for the next frame and the position of the last event per item.
+  std::vector<event_frame> batch_;
+  std::unordered_map<int32_t, size_t> batch_index_;
+};
+
+std::string to_string(backpressure_policy policy) {
+  switch (policy) {
+    default:
+      return "buffer";
+    case backpressure_policy::conflate:
+      return "conflate";
+  }
+}
+
+bool from_string(std::string_view name, backpressure_policy& policy) {
+  if (name == "buffer") {
+    policy = backpressure_policy::buffer;
+    return true;
+  }
+  if (name == "conflate") {
+    policy = backpressure_policy::conflate;
+    return true;
+  }
+  return false;
+}
+
+event_hub::event_hub(caf::event_based_actor* self, database_actor db_actor,
+                     subscriber_policy policy, size_t replay_capacity)
+  : self_(self),
+    db_actor_(std::move(db_actor)),
+    policy_(policy),
+    writer_(std::make_unique<caf::json_writer>()),
+    epoch_(make_epoch()),
+    ring_(replay_capacity) {
+  writer_->skip_object_type_annotation(true);
+}
+
+event_hub::~event_hub() {
+  // nop
+}
+
+void event_hub::start(item_events events) {
+  auto strong_this = shared_from_this();
+  events.observe_on(self_)
+    .do_finally([strong_this] { strong_this->close(); })
+    .for_each([strong_this](const item_event& event) {
+      if (event != nullptr)
+        strong_this->publish(event);
+    });
+}
+
+void event_hub::subscribe(input_resource pull, frame_resource push,
+                          subscription_filter filter, stream_options opts) {
+  // We ignore whatever the client may send to us.
+  pull.observe_on(self_).subscribe(std::ignore);
+  auto sub_id = next_sub_id_++;
+  auto sub = std::make_shared<event_subscriber>(self_, policy_,
+                                                std::move(filter), opts);
+  subscribers_.emplace(sub_id, sub);
+  table_.add(sub_id, sub->filter());
+  metrics::add(metrics::gauge::ws_subscribers, 1);
+  sub->start(std::move(push), [weak_this = weak_from_this(), sub_id] {
+    applog::info("WebSocket client disconnected");
+    if (auto strong_this = weak_this.lock())
+      strong_this->unsubscribe(sub_id);
+  });
+  if (opts.since) {
+    // Positions from another process say nothing about our sequence numbers.
+    if (opts.since->epoch == epoch_ && ring_.covers(opts.since->seq)) {
+      // Replay the missed events. They reach the subscriber before any new
+      // event, because the hub runs on a single actor.
+      auto missed = std::vector<event_frame>{};
+      auto collect = [this, &sub, &missed](const item_change& change) {
+        if (!sub->filter().matches(change.value.id))
+          return;
+        if (auto frame = make_frame(change, sub->format()))
+          missed.push_back(event_frame{change.value.id, change.seq,
+                                       change.type, std::move(*frame)});
+      };
+      ring_.for_each_after(opts.since->seq, collect);
+      sub->replay(std::move(missed));
+      return;
+    }
+    frame_buf_.clear();
+    append_resync(epoch_, ring_.last_seq(), frame_buf_);
+    sub->send_now(ws::frame{frame_buf_});
+  }
+  if (!sub->filter().snapshot)
+    return;
+  // Hold back events until we know which changes the snapshot includes.
+  sub->begin_sync();
+  self_->mail(snapshot_atom_v, sub->filter())
+    .request(db_actor_, snapshot_timeout)
+    .then(
+      [weak_this = weak_from_this(), sub_id](const item_snapshot& snapshot) {
+        auto strong_this = weak_this.lock();
+        if (!strong_this)
+          return;
+        auto i = strong_this->subscribers_.find(sub_id);
+        if (i == strong_this->subscribers_.end())
+          return;
+        auto sub = i->second;
+        auto& writer = *strong_this->writer_;
+        writer.reset();
+        if (!writer.apply(snapshot.items)) {
+          applog::error("failed to serialize a snapshot: {}",
+                        writer.get_error());
+          sub->abort(writer.get_error());
+          return;
+        }
+        auto& buf = strong_this->frame_buf_;
+        buf.clear();
+        append_snapshot(strong_this->epoch_, snapshot.seq, writer.str(), buf);
+        sub->end_sync(snapshot.seq, ws::frame{buf});
+      },
+      [weak_this = weak_from_this(), sub_id](const caf::error& what) {
+        applog::error("failed to read a snapshot: {}", what);
+        auto strong_this = weak_this.lock();
+        if (!strong_this)
+          return;
+        if (auto i = strong_this->subscribers_.find(sub_id);
+            i != strong_this->subscribers_.end()) {
+          auto sub = i->second;
+          sub->abort(what);
+        }
+      });
+}
+
+void event_hub::publish(const item_event& event) {
+  ring_.push(event);
+  const auto& change = *event;
+  // Collect the subscribers first, because pushing to a subscriber may remove
+  // it from the table.
+  std::vector<subscriber_ptr> targets;
+  table_.for_each_match(change.value.id, [this, &targets](size_t sub_id) {
+    if (auto i = subscribers_.find(sub_id); i != subscribers_.end())
+      targets.push_back(i->second);
+  });
+  // Serialize the event at most once per format. If that fails, only the
+  // subscribers of the failed format miss the event.
+  std::optional<ws::frame> full;
+  std::optional<ws::frame> delta;
+  auto full_failed = false;
+  auto delta_failed = false;
+  for (auto& sub : targets) {
+    auto is_delta = sub->format() == event_format::delta;
+    auto& frame = is_delta ? delta : full;
+    auto& failed = is_delta ? delta_failed : full_failed;
+    if (!frame) {
+      if (failed)
+        continue;
+      frame = make_frame(change, sub->format());
+      if (!frame) {
+        applog::error("drop event {} for {} subscribers", change.seq,
+                      to_string(sub->format()));
+        failed = true;
+        continue;
+      }
+    }
+    sub->push(event_frame{change.value.id, change.seq, change.type, *frame});
+  }
+}
+
+std::optional<ws::frame> event_hub::make_frame(const item_change& change,
+                                               event_format format) {
+  if (format == event_format::delta) {
+    frame_buf_.clear();
+    append_delta(epoch_, change, frame_buf_);
+    return ws::frame{frame_buf_};
+  }
+  writer_->reset();
+  if (!writer_->apply(change.value)) {
+    applog::error("failed to serialize an item event: {}",
+                  writer_->get_error());
+    return std::nullopt;
+  }
+  frame_buf_.clear();
+  append_full(epoch_, change, writer_->str(), frame_buf_);
+  return ws::frame{frame_buf_};
+}
+
+void event_hub::unsubscribe(size_t sub_id) {
+  if (auto i = subscribers_.find(sub_id); i != subscribers_.end()) {
+    table_.remove(sub_id, i->second->filter());
+    subscribers_.erase(i);
+    metrics::add(metrics::gauge::ws_subscribers, -1);
+  }
+}
+
+void event_hub::close() {
+  auto subscribers = std::move(subscribers_);
+  subscribers_.clear();
+  metrics::add(metrics::gauge::ws_subscribers,
+               -static_cast<int64_t>(subscribers.size()));
+  for (auto& [sub_id, sub] : subscribers) {
+    table_.remove(sub_id, sub->filter());
+    sub->close();
+  }
+}
@@ -0,0 +1,121 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "database_actor.hpp"
+#include "event_format.hpp"
+#include "event_ring.hpp"
+#include "item.hpp"
+#include "subscription.hpp"
+
+#include <caf/async/spsc_buffer.hpp>
+#include <caf/fwd.hpp>
+#include <caf/net/web_socket/frame.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/// An item event after serializing it. Copies share the buffer of the frame,
+/// so subscribers pass it on without copying.
+struct event_frame {
+  /// The ID of the changed item.
+  int32_t id;
+  /// The sequence number of the change.
+  uint64_t seq;
+  /// The kind of the change.
+  change_type type;
+  /// The serialized event.
+  caf::net::web_socket::frame frame;
+};
+
+/// Selects what happens to events for a subscriber that falls behind.
+enum class backpressure_policy {
+  /// Buffers up to a fixed number of events and disconnects the subscriber on
+  /// overflow.
+  buffer,
+  /// Keeps only the latest update per item while the subscriber lags behind.
+  /// Additions and erasures stay in the queue.
+  conflate,
+};
+
+/// @relates backpressure_policy
+std::string to_string(backpressure_policy);
+
+/// @relates backpressure_policy
+bool from_string(std::string_view, backpressure_policy&);
+
+/// Configures how events flow to a single subscriber.
+struct subscriber_policy {
+  backpressure_policy mode = backpressure_policy::buffer;
+  /// Maximum number of frames that wait for the subscriber. Once reached,
+  /// `buffer` disconnects the subscriber and `conflate` starts merging events.
+  size_t max_pending = 32;
+  /// Maximum number of events that wait after merging (`conflate` only) and
+  /// maximum number of events that wait for a snapshot. The subscriber gets
+  /// disconnected when exceeding this limit.
+  size_t max_items = 65'536;
+};
+
+class event_subscriber;
+
+/// Serializes each item event exactly once and dispatches the resulting frames
+/// to all interested WebSocket subscribers. The hub also keeps the most recent
+/// events in a ring for subscribers that resume a stream. All member functions
+/// must run on the actor that created the hub.
+class event_hub : public std::enable_shared_from_this<event_hub> {
+public:
+  using frame_resource
+    = caf::async::producer_resource<caf::net::web_socket::frame>;
+
+  using input_resource
+    = caf::async::consumer_resource<caf::net::web_socket::frame>;
+
+  /// @param replay_capacity Number of recent events for resuming streams.
+  event_hub(caf::event_based_actor* self, database_actor db_actor,
+            subscriber_policy policy, size_t replay_capacity);
+
+  ~event_hub();
+
+  /// Starts consuming `events`.
+  void start(item_events events);
+
+  /// Adds a new WebSocket client that receives all events that match
+  /// `filter`, encoded as selected by `opts`. When resuming a stream with
+  /// `opts.since`, the client either receives all missed events or a
+  /// `{"resync":true,"epoch":<epoch>,"seq":<latest>}` frame if the ring no
+  /// longer has them or the position belongs to another server process.
+  void subscribe(input_resource pull, frame_resource push,
+                 subscription_filter filter, stream_options opts);
+
+private:
+  using subscriber_ptr = std::shared_ptr<event_subscriber>;
+
+  void publish(const item_event& event);
+
+  /// Serializes `change` in the given format.
+  std::optional<caf::net::web_socket::frame>
+  make_frame(const item_change& change, event_format format);
+
+  void unsubscribe(size_t sub_id);
+
+  void close();
+
+  caf::event_based_actor* self_;
+  database_actor db_actor_;
+  subscriber_policy policy_;
+  std::unique_ptr<caf::json_writer> writer_;
+  std::string frame_buf_;
+  // Distinguishes our sequence numbers from those of previous processes.
+  uint64_t epoch_;
+  size_t next_sub_id_ = 1;
+  std::unordered_map<size_t, subscriber_ptr> subscribers_;
+  subscription_table table_;
+  event_ring ring_;
+};
+
+using event_hub_ptr = std::shared_ptr<event_hub>;
@@ -0,0 +1,28 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "event_ring.hpp"
+
+event_ring::event_ring(size_t capacity) : buf_(capacity) {
+  // nop
+}
+
+void event_ring::push(item_event event) {
+  last_seq_ = event->seq;
+  if (buf_.empty())
+    return;
+  buf_[head_] = std::move(event);
+  head_ = (head_ + 1) % buf_.size();
+  if (size_ < buf_.size())
+    ++size_;
+}
+
+bool event_ring::covers(uint64_t seq) const noexcept {
+  // A subscriber cannot have seen more events than we did. Such a position
+  // is invalid and the subscriber must resync.
+  if (seq > last_seq_)
+    return false;
+  if (seq == last_seq_)
+    return true;
+  // The ring must hold the event that directly follows `seq`.
+  return size_ > 0 && at(0)->seq <= seq + 1;
+}
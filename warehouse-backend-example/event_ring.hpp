@@ -0,0 +1,55 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "item.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// A bounded buffer of the most recent item events for replaying them to
+/// subscribers that reconnect. Pushing to a full ring drops the oldest event.
+/// @note The ring is not thread-safe. The event hub owns it and accesses it
+///       only from its actor.
+class event_ring {
+public:
+  explicit event_ring(size_t capacity);
+
+  /// Stores a new event. Events must arrive in the order of their sequence
+  /// numbers.
+  void push(item_event event);
+
+  /// Returns the sequence number of the latest event or 0 if no event
+  /// arrived yet.
+  uint64_t last_seq() const noexcept {
+    return last_seq_;
+  }
+
+  /// Returns whether a subscriber that has seen all events up to `seq` can
+  /// catch up from this ring.
+  bool covers(uint64_t seq) const noexcept;
+
+  /// Calls `fn` with each stored event with a sequence number greater than
+  /// `seq`, from oldest to newest.
+  template <class F>
+  void for_each_after(uint64_t seq, F&& fn) const {
+    for (size_t i = 0; i < size_; ++i) {
+      const auto& event = at(i);
+      if (event->seq > seq)
+        fn(*event);
+    }
+  }
+
+private:
+  /// Returns the `i`-th oldest event.
+  const item_event& at(size_t i) const noexcept {
+    return buf_[(head_ + buf_.size() - size_ + i) % buf_.size()];
+  }
+
+  std::vector<item_event> buf_;
+  // Position for the next event.
+  size_t head_ = 0;
+  size_t size_ = 0;
+  uint64_t last_seq_ = 0;
+};
@@ -1,8 +1,20 @@
 #include "http_server.hpp"
 
+#include "batch.hpp"
+#include "inventory.hpp"
+#include "item_query.hpp"
+#include "metrics.hpp"
+#include "tracing.hpp"
+
 #include <caf/json_object.hpp>
+#include <caf/json_reader.hpp>
 #include <caf/json_value.hpp>
 #include <caf/net/actor_shell.hpp>
+#include <caf/net/http/lower_layer.hpp>
+#include <caf/net/http/request_header.hpp>
+#include <caf/span.hpp>
+
+#include <string>
 
 using namespace std::literals;
 
@@ -10,24 +22,48 @@ using http_status = caf::net::http::status;
 
 // --(http-server-get-begin)--
 void http_server::get(responder& res, int32_t key) {
+  // Rendered responses skip the database actors entirely.
+  auto if_none_match = res.header().field("If-None-Match");
+  if (auto cached = responses_->get(key)) {
+    auto timer = metrics::scoped_timer{metrics::histogram::http_get};
+    metrics::inc(metrics::counter::response_cache_hits);
+    respond_tagged(res.down(), if_none_match, cached->etag, cached->body);
+    return;
+  }
   auto* self = res.self();
+  auto permit = admission_->admit(traffic_class::read);
+  if (!permit) {
+    respond_overloaded(res);
+    return;
+  }
+  auto timer = metrics::stopwatch{metrics::histogram::http_get};
+  auto trace = tracing::request_trace{"http.get"};
+  // The header goes away with the responder.
+  auto tags = std::string{if_none_match};
   auto prom = std::move(res).to_promise();
-  self->mail(get_atom_v, key)
-    .request(db_actor_, 2s)
+  // Concurrent GETs for the same item share a single lookup.
+  self->mail(get_atom_v, key, trace.id())
+    .request(coalescers_->get(key), 2s)
     .then(
-      [this, prom](const item& value) mutable { //
-        respond_with_item(prom, value);
+      [prom, timer, permit, trace, tags](const std::string& body) mutable {
+        timer.stop();
+        permit.complete();
+        trace.mark("http.wait");
+        respond_tagged(prom.down(), tags, make_etag(body), body);
+        trace.finish("http.respond");
       },
-      [this, prom](const caf::error& what) mutable {
+      [this, prom, timer, permit, trace](const caf::error& what) mutable {
+        timer.stop();
+        permit.complete(what == caf::sec::request_timeout);
+        trace.mark("http.wait");
         if (what == ec::no_such_item) {
           respond_with_error(prom, "no_such_item");
-          return;
-        }
-        if (what == caf::sec::request_timeout) {
+        } else if (what == caf::sec::request_timeout) {
           respond_with_error(prom, "timeout");
-          return;
+        } else {
+          respond_with_error(prom, "unexpected_database_result");
         }
-        respond_with_error(prom, "unexpected_database_result");
+        trace.finish("http.respond");
       });
 }
 // --(http-server-get-end)--
@@ -36,7 +72,7 @@ void http_server::add(responder& res, int32_t key, const std::string& name,
                       int32_t price) {
   auto* self = res.self();
   auto prom = std::move(res).to_promise();
-  self->mail(get_atom_v, key)
+  self->mail(get_atom_v, key, tracing::no_trace)
     .request(db_actor_, 2s)
     .then(
       [this, prom](const item& value) mutable { //
@@ -48,6 +84,7 @@ void http_server::add(responder& res, int32_t key, const std::string& name,
 }
 
 void http_server::add(responder& res, int32_t key) {
+  auto trace = tracing::request_trace{"http.add"};
   auto payload = res.payload();
   if (!caf::is_valid_utf8(payload)) {
     respond_with_error(res, "invalid_payload");
@@ -66,48 +103,264 @@ void http_server::add(responder& res, int32_t key) {
     return;
   }
   auto* self = res.self();
+  auto permit = admission_->admit(traffic_class::write);
+  if (!permit) {
+    respond_overloaded(res);
+    return;
+  }
+  auto timer = metrics::stopwatch{metrics::histogram::http_add};
   auto prom = std::move(res).to_promise();
+  trace.mark("http.parse");
   self
     ->mail(add_atom_v, key, static_cast<int32_t>(price.to_integer()),
-           std::string{name.to_string()})
+           std::string{name.to_string()}, trace.id())
     .request(db_actor_, 2s)
-    .then([prom]() mutable { prom.respond(http_status::created); },
-          [this, prom](const caf::error& what) mutable {
-            respond_with_error(prom, what);
-          });
+    .then(
+      [prom, timer, permit, trace]() mutable {
+        timer.stop();
+        permit.complete();
+        trace.mark("http.wait");
+        prom.respond(http_status::created);
+        trace.finish("http.respond");
+      },
+      [this, prom, timer, permit, trace](const caf::error& what) mutable {
+        timer.stop();
+        permit.complete(what == caf::sec::request_timeout);
+        trace.mark("http.wait");
+        respond_with_error(prom, what);
+        trace.finish("http.respond");
+      });
 }
 
 void http_server::inc(responder& res, int32_t key, int32_t amount) {
   auto* self = res.self();
+  auto permit = admission_->admit(traffic_class::write);
+  if (!permit) {
+    respond_overloaded(res);
+    return;
+  }
+  auto timer = metrics::stopwatch{metrics::histogram::http_inc};
+  auto trace = tracing::request_trace{"http.inc"};
   auto prom = std::move(res).to_promise();
-  self->mail(inc_atom_v, key, amount)
+  self->mail(inc_atom_v, key, amount, trace.id())
     .request(db_actor_, 2s)
-    .then([prom](int32_t) mutable { prom.respond(http_status::no_content); },
-          [this, prom](const caf::error& what) mutable {
-            respond_with_error(prom, what);
-          });
+    .then(
+      [prom, timer, permit, trace](int32_t) mutable {
+        timer.stop();
+        permit.complete();
+        trace.mark("http.wait");
+        prom.respond(http_status::no_content);
+        trace.finish("http.respond");
+      },
+      [this, prom, timer, permit, trace](const caf::error& what) mutable {
+        timer.stop();
+        permit.complete(what == caf::sec::request_timeout);
+        trace.mark("http.wait");
+        respond_with_error(prom, what);
+        trace.finish("http.respond");
+      });
 }
 
 void http_server::dec(responder& res, int32_t key, int32_t amount) {
   auto* self = res.self();
+  auto permit = admission_->admit(traffic_class::write);
+  if (!permit) {
+    respond_overloaded(res);
+    return;
+  }
+  auto timer = metrics::stopwatch{metrics::histogram::http_dec};
+  auto trace = tracing::request_trace{"http.dec"};
   auto prom = std::move(res).to_promise();
-  self->mail(dec_atom_v, key, amount)
+  self->mail(dec_atom_v, key, amount, trace.id())
     .request(db_actor_, 2s)
-    .then([prom](int32_t) mutable { prom.respond(http_status::no_content); },
-          [this, prom](const caf::error& what) mutable {
-            respond_with_error(prom, what);
-          });
+    .then(
+      [prom, timer, permit, trace](int32_t) mutable {
+        timer.stop();
+        permit.complete();
+        trace.mark("http.wait");
+        prom.respond(http_status::no_content);
+        trace.finish("http.respond");
+      },
+      [this, prom, timer, permit, trace](const caf::error& what) mutable {
+        timer.stop();
+        permit.complete(what == caf::sec::request_timeout);
+        trace.mark("http.wait");
+        respond_with_error(prom, what);
+        trace.finish("http.respond");
+      });
 }
 
 void http_server::del(responder& res, int32_t key) {
   auto* self = res.self();
+  auto permit = admission_->admit(traffic_class::write);
+  if (!permit) {
+    respond_overloaded(res);
+    return;
+  }
+  auto timer = metrics::stopwatch{metrics::histogram::http_del};
+  auto trace = tracing::request_trace{"http.del"};
   auto prom = std::move(res).to_promise();
-  self->mail(del_atom_v, key)
+  self->mail(del_atom_v, key, trace.id())
     .request(db_actor_, 2s)
-    .then([prom]() mutable { prom.respond(http_status::no_content); },
-          [this, prom](const caf::error& what) mutable {
-            respond_with_error(prom, what);
-          });
+    .then(
+      [prom, timer, permit, trace]() mutable {
+        timer.stop();
+        permit.complete();
+        trace.mark("http.wait");
+        prom.respond(http_status::no_content);
+        trace.finish("http.respond");
+      },
+      [this, prom, timer, permit, trace](const caf::error& what) mutable {
+        timer.stop();
+        permit.complete(what == caf::sec::request_timeout);
+        trace.mark("http.wait");
+        respond_with_error(prom, what);
+        trace.finish("http.respond");
+      });
+}
+
+void http_server::batch(responder& res) {
+  auto payload = res.payload();
+  if (!caf::is_valid_utf8(payload)) {
+    respond_with_error(res, "invalid_payload");
+    return;
+  }
+  caf::json_reader reader;
+  batch_request req;
+  if (!reader.load(caf::to_string_view(payload)) || !reader.apply(req)) {
+    respond_with_error(res, "invalid_payload");
+    return;
+  }
+  auto* self = res.self();
+  auto permit = admission_->admit(traffic_class::write);
+  if (!permit) {
+    respond_overloaded(res);
+    return;
+  }
+  auto timer = metrics::stopwatch{metrics::histogram::http_batch};
+  auto prom = std::move(res).to_promise();
+  auto atomic = req.atomic;
+  self->mail(batch_atom_v, std::move(req.ops), atomic, tracing::no_trace)
+    .request(db_actor_, 2s)
+    .then(
+      [prom, atomic, timer,
+       permit](const std::vector<batch_result>& results) mutable {
+        timer.stop();
+        permit.complete();
+        prom.respond(http_status::ok, json_mime_type,
+                     batch_to_json(atomic, results));
+      },
+      [this, prom, timer, permit](const caf::error& what) mutable {
+        timer.stop();
+        permit.complete(what == caf::sec::request_timeout);
+        respond_with_error(prom, what);
+      });
+}
+
+void http_server::list(responder& res) {
+  auto query = make_item_query(res.header().query());
+  if (!query) {
+    respond_with_error(res, "invalid_query"sv);
+    return;
+  }
+  auto* self = res.self();
+  auto permit = admission_->admit(traffic_class::read);
+  if (!permit) {
+    respond_overloaded(res);
+    return;
+  }
+  auto timer = metrics::stopwatch{metrics::histogram::http_list};
+  auto prom = std::move(res).to_promise();
+  self->mail(list_atom_v, std::move(*query), tracing::no_trace)
+    .request(readers_->next(), 2s)
+    .then(
+      [this, prom, timer, permit](const item_page& page) mutable {
+        timer.stop();
+        permit.complete();
+        writer_.reset();
+        if (!writer_.apply(page)) {
+          respond_with_error(prom, "serialization_failed"sv);
+          return;
+        }
+        prom.respond(http_status::ok, json_mime_type, writer_.str());
+      },
+      [this, prom, timer, permit](const caf::error& what) mutable {
+        timer.stop();
+        permit.complete(what == caf::sec::request_timeout);
+        respond_with_error(prom, what);
+      });
+}
+
+void http_server::inventory(responder& res) {
+  // The mirror of all items is opt-in.
+  if (!inventory_) {
+    res.respond(http_status::not_found, json_mime_type,
+                R"_({"code": "inventory_disabled"})_");
+    return;
+  }
+  auto query = make_inventory_query(res.header().query());
+  if (!query) {
+    respond_with_error(res, "invalid_query"sv);
+    return;
+  }
+  auto* self = res.self();
+  auto timer = metrics::stopwatch{metrics::histogram::http_inventory};
+  auto prom = std::move(res).to_promise();
+  self->mail(stats_atom_v, *query)
+    .request(inventory_, 2s)
+    .then(
+      [this, prom, timer](const inventory_stats& stats) mutable {
+        timer.stop();
+        writer_.reset();
+        if (!writer_.apply(stats)) {
+          respond_with_error(prom, "serialization_failed"sv);
+          return;
+        }
+        prom.respond(http_status::ok, json_mime_type, writer_.str());
+      },
+      [this, prom, timer](const caf::error& what) mutable {
+        timer.stop();
+        respond_with_error(prom, what);
+      });
+}
+
+void http_server::cache_stats(responder& res) {
+  writer_.reset();
+  auto values = cache_->stats();
+  if (!writer_.apply(values)) {
+    respond_with_error(res, "serialization_failed"sv);
+    return;
+  }
+  res.respond(http_status::ok, json_mime_type, writer_.str());
+}
+
+void http_server::scrape(responder& res) {
+  res.respond(http_status::ok, "text/plain; version=0.0.4", metrics::render());
+}
+
+void http_server::respond_tagged(caf::net::http::lower_layer::server* down,
+                                 std::string_view if_none_match,
+                                 std::string_view etag, std::string_view body) {
+  // Clients that already have the current representation get no body.
+  if (etag_matches(if_none_match, etag)) {
+    metrics::inc(metrics::counter::http_not_modified);
+    down->begin_header(http_status::not_modified);
+    down->add_header_field("ETag", etag);
+    down->end_header();
+    return;
+  }
+  auto len = std::to_string(body.size());
+  down->begin_header(http_status::ok);
+  down->add_header_field("Content-Type", json_mime_type);
+  down->add_header_field("Content-Length", len);
+  down->add_header_field("ETag", etag);
+  down->end_header();
+  down->send_payload(caf::as_bytes(caf::make_span(body)));
+}
+
+void http_server::respond_overloaded(responder& res) {
+  res.respond(http_status::service_unavailable, json_mime_type,
+              R"_({"code": "overloaded"})_");
 }
 
 void http_server::respond_with_item(responder::promise& prom,
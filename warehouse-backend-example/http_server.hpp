@@ -2,10 +2,18 @@
 
 #pragma once
 
+#include "admission.hpp"
 #include "database_actor.hpp"
+#include "database_reader_pool.hpp"
+#include "inventory_actor.hpp"
+#include "item_cache.hpp"
+#include "item_coalescer.hpp"
+#include "response_cache.hpp"
+#include "metrics.hpp"
 
 #include <caf/error.hpp>
 #include <caf/json_writer.hpp>
+#include <caf/net/http/lower_layer.hpp>
 #include <caf/net/http/responder.hpp>
 #include <caf/typed_actor.hpp>
 
@@ -18,12 +26,24 @@ class http_server {
 public:
   using responder = caf::net::http::responder;
 
-  http_server(database_actor db_actor) : db_actor_(std::move(db_actor)) {
+  http_server(database_actor db_actor, database_reader_pool_ptr readers,
+              item_coalescer_pool_ptr coalescers, item_cache_ptr cache,
+              response_cache_ptr responses, inventory_actor inventory,
+              admission_control_ptr admission)
+    : db_actor_(std::move(db_actor)),
+      readers_(std::move(readers)),
+      coalescers_(std::move(coalescers)),
+      cache_(std::move(cache)),
+      responses_(std::move(responses)),
+      inventory_(std::move(inventory)),
+      admission_(std::move(admission)) {
     writer_.skip_object_type_annotation(true);
   }
 
   static constexpr std::string_view json_mime_type = "application/json";
 
+  /// Responds with an item. Answers from the response cache if possible and
+  /// honors `If-None-Match`.
   void get(responder& res, int32_t key);
 
   void add(responder& res, int32_t key, const std::string& name, int32_t price);
@@ -37,12 +57,41 @@ public:
   void del(responder& res, int32_t key);
 // --(http-server-utility-end)--
 
+  /// Applies a batch of operations. The payload must be a `batch_request`.
+  void batch(responder& res);
+
+  /// Lists items by ID or by a range of IDs. See `make_item_query` for the
+  /// query parameters. Range listings respond with at most one page plus the
+  /// ID for fetching the next page.
+  void list(responder& res);
+
+  /// Responds with totals over all items. See `make_inventory_query` for the
+  /// query parameters. Responds with status 404 if the server runs without an
+  /// inventory actor.
+  void inventory(responder& res);
+
+  /// Responds with the counters of the item cache.
+  void cache_stats(responder& res);
+
+  /// Responds with all metrics in the Prometheus text format.
+  void scrape(responder& res);
+
 private:
+  /// Responds with a rendered item and its entity tag, or with 304 if
+  /// `if_none_match` shows that the client already has it.
+  static void respond_tagged(caf::net::http::lower_layer::server* down,
+                             std::string_view if_none_match,
+                             std::string_view etag, std::string_view body);
+
+  /// Responds with 503 to a request that admission control rejected.
+  void respond_overloaded(responder& res);
+
   void respond_with_item(responder::promise& prom, const item& value);
 
   template <class Responder>
   void respond_with_error(Responder& prom, std::string_view code) {
     using status = caf::net::http::status;
+    metrics::inc(metrics::counter::http_errors);
     std::string body = R"_({"code": ")_";
     body += code;
     body += "\"}";
@@ -65,5 +114,11 @@ private:
   }
 
   database_actor db_actor_;
+  database_reader_pool_ptr readers_;
+  item_coalescer_pool_ptr coalescers_;
+  item_cache_ptr cache_;
+  response_cache_ptr responses_;
+  inventory_actor inventory_;
+  admission_control_ptr admission_;
   caf::json_writer writer_;
 };
@@ -0,0 +1,174 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "inventory.hpp"
+
+#include <caf/error.hpp>
+#include <caf/sec.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <limits>
+#include <string_view>
+
+namespace {
+
+// Upper bound for the number of histogram buckets.
+constexpr int32_t max_buckets = 64;
+
+// Number of values per block when computing the histogram. Each block fits
+// into the L1 cache, so the passes for the bucket bounds hit the cache.
+constexpr size_t histogram_block_size = 4096;
+
+bool parse_int(std::string_view str, int32_t& result) {
+  auto* first = str.data();
+  auto* last = str.data() + str.size();
+  auto [ptr, err] = std::from_chars(first, last, result);
+  return err == std::errc{} && ptr == last;
+}
+
+} // namespace
+
+caf::expected<inventory_query>
+make_inventory_query(const caf::uri::query_map& query) {
+  auto invalid = [](const char* what) {
+    return caf::make_error(caf::sec::invalid_argument, what);
+  };
+  inventory_query result;
+  for (auto [key, field] : {std::pair{"threshold", &result.threshold},
+                            std::pair{"bucket_width", &result.bucket_width},
+                            std::pair{"buckets", &result.buckets}}) {
+    if (auto i = query.find(key); i != query.end()
+                                  && !parse_int(i->second, *field))
+      return invalid("threshold, bucket_width and buckets must be integers");
+  }
+  if (result.bucket_width < 1)
+    return invalid("bucket_width must be at least 1");
+  if (result.buckets < 1 || result.buckets > max_buckets)
+    return invalid("buckets must be between 1 and 64");
+  return result;
+}
+
+void inventory_mirror::reset(const std::vector<item>& items, uint64_t seq) {
+  ids_.clear();
+  prices_.clear();
+  available_.clear();
+  rows_.clear();
+  for (const auto& value : items)
+    put(value);
+  seq_ = seq;
+}
+
+void inventory_mirror::reset(const mapped_snapshot& snapshot) {
+  ids_.clear();
+  prices_.clear();
+  available_.clear();
+  rows_.clear();
+  auto n = snapshot.size();
+  ids_.reserve(n);
+  prices_.reserve(n);
+  available_.reserve(n);
+  rows_.reserve(n);
+  for (size_t index = 0; index < n; ++index) {
+    auto rec = snapshot.at(index);
+    put(item{rec.id, rec.price, rec.available, std::string{}});
+  }
+  seq_ = 0;
+}
+
+void inventory_mirror::apply(const item_change& change) {
+  if (change.seq <= seq_)
+    return;
+  if (change.type == change_type::erased)
+    erase(change.value.id);
+  else
+    put(change.value);
+  seq_ = change.seq;
+}
+
+inventory_stats
+inventory_mirror::compute(const inventory_query& query,
+                          const aggregate_kernels& kernels) const {
+  auto n = ids_.size();
+  auto result = inventory_stats{};
+  result.seq = seq_;
+  result.items = n;
+  result.stock_value = kernels.stock_value(prices_.data(), available_.data(),
+                                           n);
+  result.below_threshold = kernels.count_below(available_.data(), n,
+                                               query.threshold);
+  // Count the values below each upper bound and take the differences.
+  // Bounds beyond the range of `int32_t` include all values.
+  auto num_bounds = static_cast<size_t>(query.buckets - 1);
+  auto below = std::vector<uint64_t>(num_bounds);
+  auto bound = [&query](size_t index) {
+    auto value = int64_t{query.bucket_width} * static_cast<int64_t>(index + 1);
+    return static_cast<int32_t>(
+      std::min<int64_t>(value, std::numeric_limits<int32_t>::max()));
+  };
+  for (size_t first = 0; first < n; first += histogram_block_size) {
+    auto count = std::min(histogram_block_size, n - first);
+    for (size_t index = 0; index < num_bounds; ++index)
+      below[index] += kernels.count_below(available_.data() + first, count,
+                                          bound(index));
+  }
+  result.histogram.resize(num_bounds + 1);
+  uint64_t prev = 0;
+  for (size_t index = 0; index < num_bounds; ++index) {
+    result.histogram[index] = below[index] - prev;
+    prev = below[index];
+  }
+  result.histogram.back() = n - prev;
+  return result;
+}
+
+size_t inventory_mirror::count_differences(
+  const inventory_mirror& other) const {
+  size_t result = 0;
+  for (size_t row = 0; row < ids_.size(); ++row) {
+    auto i = other.rows_.find(ids_[row]);
+    if (i == other.rows_.end()) {
+      ++result;
+      continue;
+    }
+    if (prices_[row] != other.prices_[i->second]
+        || available_[row] != other.available_[i->second])
+      ++result;
+  }
+  // Add the items that only exist in `other`.
+  for (auto id : other.ids_)
+    if (rows_.count(id) == 0)
+      ++result;
+  return result;
+}
+
+void inventory_mirror::put(const item& value) {
+  auto [i, added] = rows_.try_emplace(value.id,
+                                      static_cast<uint32_t>(ids_.size()));
+  if (added) {
+    ids_.push_back(value.id);
+    prices_.push_back(value.price);
+    available_.push_back(value.available);
+    return;
+  }
+  auto row = i->second;
+  prices_[row] = value.price;
+  available_[row] = value.available;
+}
+
+void inventory_mirror::erase(int32_t id) {
+  auto i = rows_.find(id);
+  if (i == rows_.end())
+    return;
+  auto row = i->second;
+  rows_.erase(i);
+  auto last = ids_.size() - 1;
+  if (row != last) {
+    ids_[row] = ids_[last];
+    prices_[row] = prices_[last];
+    available_[row] = available_[last];
+    rows_[ids_[row]] = row;
+  }
+  ids_.pop_back();
+  prices_.pop_back();
+  available_.pop_back();
+}
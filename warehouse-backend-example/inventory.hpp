@@ -0,0 +1,105 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "aggregate.hpp"
+#include "item.hpp"
+#include "snapshot_file.hpp"
+
+#include <caf/expected.hpp>
+#include <caf/uri.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/// Configures the totals of an inventory report.
+struct inventory_query {
+  /// Counts items with fewer available units than this threshold.
+  int32_t threshold = 10;
+  /// Width of each histogram bucket.
+  int32_t bucket_width = 100;
+  /// Number of histogram buckets. The last bucket has no upper bound.
+  int32_t buckets = 10;
+};
+
+template <class Inspector>
+bool inspect(Inspector& f, inventory_query& x) {
+  return f.object(x).fields(f.field("threshold", x.threshold),
+                            f.field("bucket_width", x.bucket_width),
+                            f.field("buckets", x.buckets));
+}
+
+/// Parses a query from the parameters `threshold`, `bucket_width` and
+/// `buckets`. Allows at most 64 buckets.
+caf::expected<inventory_query>
+make_inventory_query(const caf::uri::query_map& query);
+
+/// Totals over all items.
+struct inventory_stats {
+  /// The sequence number of the last change that the totals include.
+  uint64_t seq = 0;
+  /// Number of items.
+  uint64_t items = 0;
+  /// Sum of `price * available` over all items.
+  int64_t stock_value = 0;
+  /// Number of items with fewer available units than the threshold.
+  uint64_t below_threshold = 0;
+  /// Number of items per bucket of available units. Bucket `i` covers
+  /// `[i * bucket_width, (i + 1) * bucket_width)`.
+  std::vector<uint64_t> histogram;
+};
+
+template <class Inspector>
+bool inspect(Inspector& f, inventory_stats& x) {
+  return f.object(x).fields(f.field("seq", x.seq), f.field("items", x.items),
+                            f.field("stock_value", x.stock_value),
+                            f.field("below_threshold", x.below_threshold),
+                            f.field("histogram", x.histogram));
+}
+
+/// Mirrors the numeric fields of all items in columns for fast aggregation.
+/// Deleting an item moves the last row into its place.
+class inventory_mirror {
+public:
+  /// Replaces the content of the mirror.
+  void reset(const std::vector<item>& items, uint64_t seq);
+
+  /// Replaces the content of the mirror with the items of a snapshot file.
+  /// The mirror then has the sequence number 0.
+  void reset(const mapped_snapshot& snapshot);
+
+  /// Applies a committed change. Ignores changes that are not newer than the
+  /// last applied change.
+  void apply(const item_change& change);
+
+  /// Returns the number of items that differ between the two mirrors.
+  size_t count_differences(const inventory_mirror& other) const;
+
+  /// Returns the number of items.
+  size_t size() const noexcept {
+    return ids_.size();
+  }
+
+  /// Returns the sequence number of the last applied change.
+  uint64_t seq() const noexcept {
+    return seq_;
+  }
+
+  /// Computes the totals for `query` with the given kernels.
+  /// @pre `query` is valid, i.e., from `make_inventory_query`.
+  inventory_stats compute(const inventory_query& query,
+                          const aggregate_kernels& kernels) const;
+
+private:
+  void put(const item& value);
+
+  void erase(int32_t id);
+
+  uint64_t seq_ = 0;
+  std::vector<int32_t> ids_;
+  std::vector<int32_t> prices_;
+  std::vector<int32_t> available_;
+  std::unordered_map<int32_t, uint32_t> rows_;
+};
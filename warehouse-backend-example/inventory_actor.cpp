@@ -0,0 +1,157 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "inventory_actor.hpp"
+
+#include "applog.hpp"
+#include "subscription.hpp"
+
+#include <caf/actor_from_state.hpp>
+#include <caf/actor_system.hpp>
+#include <caf/error.hpp>
+#include <caf/scheduled_actor/flow.hpp>
+#include <caf/typed_response_promise.hpp>
+
+#include <optional>
+#include <utility>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+// Maximum time for reading the initial snapshot.
+constexpr auto snapshot_timeout = 60s;
+
+struct inventory_actor_state {
+  using stats_promise = caf::typed_response_promise<inventory_stats>;
+
+  inventory_actor_state(inventory_actor::pointer self_ptr,
+                        database_actor db_actor, item_events events,
+                        const aggregate_kernels* kernels_ptr,
+                        mapped_snapshot_ptr warm, caf::timespan verify_delay)
+    : self(self_ptr), db(std::move(db_actor)), kernels(kernels_ptr) {
+    events.observe_on(self)
+      .do_finally([this] { self->quit(); })
+      .for_each([this](const item_event& event) {
+        if (event != nullptr)
+          on_event(event);
+      });
+    if (!warm) {
+      load_snapshot();
+      return;
+    }
+    // Answer queries from the snapshot file right away and check it against
+    // the database later.
+    mirror.reset(*warm);
+    syncing = false;
+    self->run_delayed(verify_delay, [this] { load_snapshot(); });
+  }
+
+  inventory_actor::behavior_type make_behavior() {
+    return {
+      [this](stats_atom,
+             const inventory_query& query) -> caf::result<inventory_stats> {
+        if (!syncing)
+          return mirror.compute(query, *kernels);
+        auto prom = self->make_response_promise<inventory_stats>();
+        waiting.emplace_back(query, prom);
+        return prom;
+      },
+    };
+  }
+
+  void on_event(const item_event& event) {
+    if (loading || check)
+      backlog.push_back(event);
+    if (syncing)
+      return;
+    mirror.apply(*event);
+    if (check)
+      verify();
+  }
+
+  /// Reads the committed state of all items from the database.
+  void load_snapshot() {
+    loading = true;
+    self->mail(snapshot_atom_v, subscription_filter{})
+      .request(db, snapshot_timeout)
+      .then(
+        [this](item_snapshot& snapshot) {
+          loading = false;
+          if (syncing) {
+            start(snapshot);
+            return;
+          }
+          check = std::move(snapshot);
+          verify();
+        },
+        [this](const caf::error& what) {
+          applog::error("failed to load the inventory: {}", what);
+          self->quit(what);
+        });
+  }
+
+  /// Fills the mirror and answers all queries that arrived in the meantime.
+  void start(const item_snapshot& snapshot) {
+    mirror.reset(snapshot.items, snapshot.seq);
+    for (const auto& event : backlog)
+      mirror.apply(*event);
+    backlog.clear();
+    syncing = false;
+    for (auto& [query, prom] : waiting)
+      prom.deliver(mirror.compute(query, *kernels));
+    waiting.clear();
+  }
+
+  /// Compares the mirror to the database snapshot in `check` once the mirror
+  /// includes all changes of the snapshot. Replaces the mirror if it differs,
+  /// e.g., because the snapshot file predates the last changes.
+  void verify() {
+    if (mirror.seq() < check->seq)
+      return;
+    auto fresh = inventory_mirror{};
+    fresh.reset(check->items, check->seq);
+    for (const auto& event : backlog)
+      fresh.apply(*event);
+    backlog.clear();
+    check.reset();
+    if (auto diff = mirror.count_differences(fresh); diff > 0) {
+      applog::warning("the snapshot file differs in {} items from the "
+                      "database",
+                      diff);
+      mirror = std::move(fresh);
+      return;
+    }
+    applog::info("verified the snapshot file with {} items", mirror.size());
+  }
+
+  inventory_actor::pointer self;
+  database_actor db;
+  const aggregate_kernels* kernels;
+  inventory_mirror mirror;
+  // Indicates that the mirror has no content yet.
+  bool syncing = true;
+  // Indicates that we wait for a snapshot from the database.
+  bool loading = false;
+  // A snapshot from the database for checking a mirror that we have loaded
+  // from a snapshot file.
+  std::optional<item_snapshot> check;
+  // Events that arrived since requesting the snapshot.
+  std::vector<item_event> backlog;
+  // Queries that arrived before the snapshot.
+  std::vector<std::pair<inventory_query, stats_promise>> waiting;
+};
+
+} // namespace
+
+inventory_actor spawn_inventory_actor(caf::actor_system& sys,
+                                      database_actor db_actor,
+                                      item_events events,
+                                      const aggregate_kernels& kernels,
+                                      mapped_snapshot_ptr warm,
+                                      caf::timespan verify_delay) {
+  using caf::actor_from_state;
+  return sys.spawn(actor_from_state<inventory_actor_state>,
+                   std::move(db_actor), std::move(events), &kernels,
+                   std::move(warm), verify_delay);
+}
@@ -0,0 +1,37 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "aggregate.hpp"
+#include "database_actor.hpp"
+#include "inventory.hpp"
+#include "item.hpp"
+#include "snapshot_file.hpp"
+#include "types.hpp"
+
+#include <caf/fwd.hpp>
+#include <caf/timespan.hpp>
+#include <caf/typed_actor.hpp>
+
+struct inventory_trait {
+  using signatures = caf::type_list<
+    // Computes totals over all items.
+    caf::result<inventory_stats>(stats_atom, inventory_query)>;
+};
+
+/// An actor that answers aggregation queries from an in-memory mirror of all
+/// items.
+using inventory_actor = caf::typed_actor<inventory_trait>;
+
+/// Spawns an actor that loads a snapshot of all items from `db_actor` and then
+/// follows `events`. The actor holds back queries until the snapshot arrives
+/// and terminates when `events` ends. With a `warm` snapshot file, the actor
+/// answers queries right away and compares the file to the database after
+/// `verify_delay`. If the file turns out to be stale, the actor switches to
+/// the state of the database.
+inventory_actor spawn_inventory_actor(caf::actor_system& sys,
+                                      database_actor db_actor,
+                                      item_events events,
+                                      const aggregate_kernels& kernels,
+                                      mapped_snapshot_ptr warm = nullptr,
+                                      caf::timespan verify_delay = {});
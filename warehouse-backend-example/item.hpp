@@ -5,6 +5,7 @@
 #include <caf/async/fwd.hpp>
 
 #include <cstdint>
+#include <memory>
 #include <string>
 
 // --(item-begin)--
@@ -24,7 +25,27 @@ bool inspect(Inspector& f, item& x) {
 // --(item-end)--
 
 // --(item-events-begin)--
-using item_event = std::shared_ptr<const item>;
+/// Classifies a committed change to an item.
+enum class change_type : uint8_t {
+  /// The item is new. All fields may have changed.
+  added,
+  /// Only the available count has changed.
+  updated,
+  /// The item no longer exists.
+  erased,
+};
+
+/// A committed change to an item.
+struct item_change {
+  /// Orders all changes published by the database actor. Starts at 1.
+  uint64_t seq = 0;
+  /// Selects which fields of `value` have changed.
+  change_type type = change_type::added;
+  /// The new state of the item.
+  item value;
+};
+
+using item_event = std::shared_ptr<const item_change>;
 
 using item_events = caf::async::publisher<item_event>;
 // --(item-events-end)--
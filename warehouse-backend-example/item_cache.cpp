@@ -0,0 +1,166 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "item_cache.hpp"
+
+#include <iterator>
+
+namespace {
+
+// Rough estimate for the bookkeeping overhead of an entry, i.e., the list node
+// and the hash map node.
+constexpr size_t per_entry_overhead = 64;
+
+} // namespace
+
+std::string to_string(eviction_policy policy) {
+  switch (policy) {
+    default:
+      return "clock";
+    case eviction_policy::lru:
+      return "lru";
+  }
+}
+
+bool from_string(std::string_view name, eviction_policy& policy) {
+  if (name == "clock") {
+    policy = eviction_policy::clock;
+    return true;
+  }
+  if (name == "lru") {
+    policy = eviction_policy::lru;
+    return true;
+  }
+  return false;
+}
+
+item_cache::item_cache(size_t max_bytes, eviction_policy policy,
+                       size_t num_shards)
+  : policy_(policy) {
+  if (max_bytes == 0 || num_shards == 0)
+    return;
+  max_shard_bytes_ = max_bytes / num_shards;
+  shards_.reserve(num_shards);
+  for (size_t i = 0; i < num_shards; ++i) {
+    auto& sh = shards_.emplace_back(std::make_unique<shard>());
+    sh->hand = sh->entries.end();
+  }
+}
+
+std::optional<item> item_cache::get(int32_t id) {
+  if (!enabled())
+    return std::nullopt;
+  auto& sh = shard_for(id);
+  std::unique_lock guard{sh.mtx};
+  auto i = sh.index.find(id);
+  if (i == sh.index.end()) {
+    guard.unlock();
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return std::nullopt;
+  }
+  auto pos = i->second;
+  if (policy_ == eviction_policy::lru)
+    sh.entries.splice(sh.entries.begin(), sh.entries, pos);
+  else
+    pos->referenced = true;
+  auto result = pos->value;
+  guard.unlock();
+  hits_.fetch_add(1, std::memory_order_relaxed);
+  return result;
+}
+
+uint64_t item_cache::fill_token(int32_t id) {
+  if (!enabled())
+    return 0;
+  auto& sh = shard_for(id);
+  std::lock_guard guard{sh.mtx};
+  return sh.epoch;
+}
+
+void item_cache::fill(const item& value, uint64_t token) {
+  if (!enabled())
+    return;
+  auto& sh = shard_for(value.id);
+  std::lock_guard guard{sh.mtx};
+  // If a writer touched the shard in the meantime, `value` may be outdated.
+  if (sh.epoch != token || sh.index.count(value.id) > 0)
+    return;
+  insert(sh, value);
+}
+
+void item_cache::put(const item& value) {
+  if (!enabled())
+    return;
+  auto& sh = shard_for(value.id);
+  std::lock_guard guard{sh.mtx};
+  ++sh.epoch;
+  if (auto i = sh.index.find(value.id); i != sh.index.end())
+    remove(sh, i->second);
+  insert(sh, value);
+}
+
+void item_cache::erase(int32_t id) {
+  if (!enabled())
+    return;
+  auto& sh = shard_for(id);
+  std::lock_guard guard{sh.mtx};
+  ++sh.epoch;
+  if (auto i = sh.index.find(id); i != sh.index.end())
+    remove(sh, i->second);
+}
+
+item_cache_stats item_cache::stats() const {
+  item_cache_stats result;
+  result.hits = hits_.load(std::memory_order_relaxed);
+  result.misses = misses_.load(std::memory_order_relaxed);
+  result.evictions = evictions_.load(std::memory_order_relaxed);
+  for (auto& sh : shards_) {
+    std::lock_guard guard{sh->mtx};
+    result.entries += sh->index.size();
+    result.bytes += sh->bytes;
+  }
+  return result;
+}
+
+void item_cache::insert(shard& sh, const item& value) {
+  auto bytes = sizeof(entry) + value.name.size() + per_entry_overhead;
+  if (bytes > max_shard_bytes_)
+    return;
+  while (sh.bytes + bytes > max_shard_bytes_ && !sh.entries.empty())
+    evict(sh);
+  entry_list::iterator pos;
+  if (policy_ == eviction_policy::lru) {
+    pos = sh.entries.insert(sh.entries.begin(), entry{value, bytes, false});
+  } else {
+    // Inserting right before the hand makes the new entry the last one the
+    // hand visits.
+    pos = sh.entries.insert(sh.hand, entry{value, bytes, false});
+  }
+  sh.index.emplace(value.id, pos);
+  sh.bytes += bytes;
+}
+
+void item_cache::remove(shard& sh, entry_list::iterator pos) {
+  if (sh.hand == pos)
+    ++sh.hand;
+  sh.bytes -= pos->bytes;
+  sh.index.erase(pos->value.id);
+  sh.entries.erase(pos);
+}
+
+void item_cache::evict(shard& sh) {
+  evictions_.fetch_add(1, std::memory_order_relaxed);
+  if (policy_ == eviction_policy::lru) {
+    remove(sh, std::prev(sh.entries.end()));
+    return;
+  }
+  // Give each referenced entry a second chance.
+  for (;;) {
+    if (sh.hand == sh.entries.end())
+      sh.hand = sh.entries.begin();
+    if (!sh.hand->referenced)
+      break;
+    sh.hand->referenced = false;
+    ++sh.hand;
+  }
+  remove(sh, sh.hand);
+}
@@ -0,0 +1,132 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "item.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// Selects which entry an `item_cache` drops when exceeding its budget.
+enum class eviction_policy {
+  /// Approximates LRU with a reference bit per entry (second chance).
+  clock,
+  /// Drops the least recently used entry.
+  lru,
+};
+
+/// @relates eviction_policy
+std::string to_string(eviction_policy);
+
+/// @relates eviction_policy
+bool from_string(std::string_view, eviction_policy&);
+
+/// Counters and gauges of an `item_cache`.
+struct item_cache_stats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  uint64_t entries = 0;
+  uint64_t bytes = 0;
+};
+
+template <class Inspector>
+bool inspect(Inspector& f, item_cache_stats& x) {
+  return f.object(x).fields(f.field("hits", x.hits),
+                            f.field("misses", x.misses),
+                            f.field("evictions", x.evictions),
+                            f.field("entries", x.entries),
+                            f.field("bytes", x.bytes));
+}
+
+/// A thread-safe, size-bounded cache for items. The database actor keeps the
+/// cache coherent by storing each committed change. Readers may populate the
+/// cache after a miss via `fill_token` and `fill`.
+class item_cache {
+public:
+  /// Creates a cache that holds at most `max_bytes` of items. A budget of 0
+  /// disables the cache.
+  item_cache(size_t max_bytes, eviction_policy policy, size_t num_shards = 16);
+
+  item_cache(const item_cache&) = delete;
+
+  item_cache& operator=(const item_cache&) = delete;
+
+  /// Returns whether the cache stores any items at all.
+  bool enabled() const noexcept {
+    return !shards_.empty();
+  }
+
+  /// Retrieves an item from the cache.
+  /// @returns the item if cached, `std::nullopt` otherwise.
+  std::optional<item> get(int32_t id);
+
+  /// Returns a token for calling `fill` after reading `id` from the database.
+  /// Must be called *before* reading from the database.
+  uint64_t fill_token(int32_t id);
+
+  /// Adds `value` after reading it from the database unless the cache already
+  /// contains the item or a writer changed the cache since obtaining `token`.
+  void fill(const item& value, uint64_t token);
+
+  /// Stores the committed state of an item.
+  void put(const item& value);
+
+  /// Removes an item, e.g., after deleting it from the database.
+  void erase(int32_t id);
+
+  /// Returns a snapshot of the counters.
+  item_cache_stats stats() const;
+
+private:
+  struct entry {
+    item value;
+    size_t bytes;
+    bool referenced;
+  };
+
+  using entry_list = std::list<entry>;
+
+  struct shard {
+    std::mutex mtx;
+    // For LRU, the front is the most recently used entry. For CLOCK, the list
+    // is the ring and `hand` points to the next eviction candidate.
+    entry_list entries;
+    std::unordered_map<int32_t, entry_list::iterator> index;
+    entry_list::iterator hand;
+    size_t bytes = 0;
+    // Incremented on each write to detect races between readers and writers.
+    uint64_t epoch = 0;
+  };
+
+  shard& shard_for(int32_t id) noexcept {
+    return *shards_[static_cast<uint32_t>(id) % shards_.size()];
+  }
+
+  // All functions below require the shard lock.
+
+  void insert(shard& sh, const item& value);
+
+  void remove(shard& sh, entry_list::iterator pos);
+
+  void evict(shard& sh);
+
+  eviction_policy policy_;
+  size_t max_shard_bytes_ = 0;
+  std::vector<std::unique_ptr<shard>> shards_;
+  std::atomic<uint64_t> hits_ = 0;
+  std::atomic<uint64_t> misses_ = 0;
+  std::atomic<uint64_t> evictions_ = 0;
+};
+
+/// A smart pointer to an item cache.
+using item_cache_ptr = std::shared_ptr<item_cache>;
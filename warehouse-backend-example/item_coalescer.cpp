@@ -0,0 +1,173 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "item_coalescer.hpp"
+
+#include "applog.hpp"
+#include "item.hpp"
+#include "metrics.hpp"
+
+#include <caf/actor_from_state.hpp>
+#include <caf/actor_system.hpp>
+#include <caf/error.hpp>
+#include <caf/json_writer.hpp>
+#include <caf/typed_response_promise.hpp>
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+using namespace std::literals;
+
+namespace {
+
+// Maximum time for a single lookup on the readers.
+constexpr auto lookup_timeout = 2s;
+
+struct item_coalescer_state {
+  using clock_type = std::chrono::steady_clock;
+
+  using promise_type = caf::typed_response_promise<std::string>;
+
+  /// A response that lookups may reuse until it expires.
+  struct fresh_entry {
+    std::string body;
+    clock_type::time_point expires;
+    /// The fill token of the lookup that produced `body`.
+    uint64_t token;
+  };
+
+  /// A lookup in flight and the clients that wait for its result.
+  struct lookup_state {
+    /// The fill token at the start of the lookup.
+    uint64_t token;
+    std::vector<promise_type> waiting;
+  };
+
+  using lookup_ptr = std::shared_ptr<lookup_state>;
+
+  item_coalescer_state(item_coalescer_actor::pointer self_ptr,
+                       database_reader_pool_ptr readers_ptr,
+                       response_cache_ptr responses_ptr, database_actor writer,
+                       caf::timespan reuse_window)
+    : self(self_ptr),
+      readers(std::move(readers_ptr)),
+      responses(std::move(responses_ptr)),
+      window(reuse_window) {
+    json.skip_object_type_annotation(true);
+    // Stop if the database actor terminates.
+    self->monitor(writer, [this](const caf::error& reason) {
+      applog::debug("item coalescer lost the database actor: {}", reason);
+      self->quit(reason);
+    });
+  }
+
+  item_coalescer_actor::behavior_type make_behavior() {
+    return {
+      [this](get_atom, int32_t id, uint64_t trace) -> caf::result<std::string> {
+        // A changed token means that a writer may have changed the item
+        // since a lookup started. Results of such lookups may predate this
+        // request and thus are off limits.
+        auto token = responses->fill_token(id);
+        if (window.count() > 0) {
+          expire(clock_type::now());
+          if (auto i = fresh.find(id); i != fresh.end()) {
+            if (i->second.token == token) {
+              metrics::inc(metrics::counter::get_reused);
+              return i->second.body;
+            }
+            fresh.erase(i);
+          }
+        }
+        auto prom = self->make_response_promise<std::string>();
+        if (auto i = pending.find(id);
+            i != pending.end() && i->second->token == token) {
+          i->second->waiting.push_back(prom);
+          metrics::inc(metrics::counter::get_coalesced);
+          return prom;
+        }
+        // An outdated lookup still answers the clients that joined it.
+        auto state = std::make_shared<lookup_state>();
+        state->token = token;
+        state->waiting.push_back(prom);
+        pending[id] = state;
+        lookup(id, trace, std::move(state));
+        return prom;
+      },
+    };
+  }
+
+  /// Sends a single lookup for all clients that wait on `state`. The readers
+  /// record their work under the trace ID of the first client.
+  void lookup(int32_t id, uint64_t trace, lookup_ptr state) {
+    self->mail(get_atom_v, id, trace)
+      .request(readers->next(), lookup_timeout)
+      .then(
+        [this, id, state](const item& value) {
+          json.reset();
+          if (!json.apply(value)) {
+            deliver(id, *state, caf::make_error(caf::sec::runtime_error));
+            return;
+          }
+          auto body = std::string{json.str()};
+          // Only results that no writer has overwritten yet are reusable.
+          if (window.count() > 0
+              && responses->fill_token(id) == state->token) {
+            auto expires = clock_type::now() + window;
+            fresh[id] = fresh_entry{body, expires, state->token};
+            expiry.emplace_back(id, expires);
+          }
+          responses->fill(id, body, state->token);
+          deliver(id, *state, body);
+        },
+        [this, id, state](const caf::error& what) {
+          deliver(id, *state, what);
+        });
+  }
+
+  /// Responds to all clients that wait on `state`.
+  template <class T>
+  void deliver(int32_t id, lookup_state& state, const T& response) {
+    if (auto i = pending.find(id);
+        i != pending.end() && i->second.get() == &state)
+      pending.erase(i);
+    for (auto& prom : state.waiting)
+      prom.deliver(response);
+    state.waiting.clear();
+  }
+
+  /// Drops all responses that expired before `now`. Entries expire in the
+  /// order of insertion, because all share the same window.
+  void expire(clock_type::time_point now) {
+    while (!expiry.empty() && expiry.front().second <= now) {
+      auto [id, expires] = expiry.front();
+      expiry.pop_front();
+      // A newer response for the same item may have replaced the entry.
+      auto i = fresh.find(id);
+      if (i != fresh.end() && i->second.expires == expires)
+        fresh.erase(i);
+    }
+  }
+
+  item_coalescer_actor::pointer self;
+  database_reader_pool_ptr readers;
+  response_cache_ptr responses;
+  caf::timespan window;
+  caf::json_writer json;
+  std::unordered_map<int32_t, lookup_ptr> pending;
+  std::unordered_map<int32_t, fresh_entry> fresh;
+  std::deque<std::pair<int32_t, clock_type::time_point>> expiry;
+};
+
+} // namespace
+
+item_coalescer_actor spawn_item_coalescer(caf::actor_system& sys,
+                                          database_reader_pool_ptr readers,
+                                          response_cache_ptr responses,
+                                          database_actor writer,
+                                          caf::timespan window) {
+  using caf::actor_from_state;
+  return sys.spawn(actor_from_state<item_coalescer_state>, std::move(readers),
+                   std::move(responses), std::move(writer), window);
+}
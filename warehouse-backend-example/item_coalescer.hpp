@@ -0,0 +1,66 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "database_actor.hpp"
+#include "database_reader_pool.hpp"
+#include "response_cache.hpp"
+#include "types.hpp"
+
+#include <caf/fwd.hpp>
+#include <caf/timespan.hpp>
+#include <caf/typed_actor.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct item_coalescer_trait {
+  using signatures = caf::type_list<
+    // Retrieves an item as JSON. The last argument is a trace ID.
+    caf::result<std::string>(get_atom, int32_t, uint64_t)>;
+};
+
+/// An actor that merges concurrent lookups for the same item into a single
+/// request to the readers. Lookups that arrive while a request is in flight
+/// receive the same JSON response, unless a writer changed the item since the
+/// request started. Then, they start a new request, so that clients never see
+/// data older than their lookup.
+using item_coalescer_actor = caf::typed_actor<item_coalescer_trait>;
+
+/// Spawns an actor that looks up items via `readers` on behalf of concurrent
+/// clients and stores the rendered responses in `responses`. The actor
+/// terminates when `writer` terminates.
+/// @param window Reuses a response for lookups within this time after
+///               receiving it or until a writer changes the item. A value of
+///               0 only merges lookups that are in flight at the same time.
+item_coalescer_actor spawn_item_coalescer(caf::actor_system& sys,
+                                          database_reader_pool_ptr readers,
+                                          response_cache_ptr responses,
+                                          database_actor writer,
+                                          caf::timespan window);
+
+/// Partitions lookups by item ID over a set of coalescers, so that all lookups
+/// for the same item meet at the same coalescer.
+class item_coalescer_pool {
+public:
+  /// Creates a pool for `coalescers`.
+  /// @pre `coalescers` is not empty.
+  explicit item_coalescer_pool(std::vector<item_coalescer_actor> coalescers)
+    : coalescers_(std::move(coalescers)) {
+    // nop
+  }
+
+  /// Returns the coalescer for lookups of the item with ID `id`.
+  const item_coalescer_actor& get(int32_t id) const noexcept {
+    return coalescers_[static_cast<uint32_t>(id) % coalescers_.size()];
+  }
+
+private:
+  std::vector<item_coalescer_actor> coalescers_;
+};
+
+/// A smart pointer to a coalescer pool.
+using item_coalescer_pool_ptr = std::shared_ptr<item_coalescer_pool>;
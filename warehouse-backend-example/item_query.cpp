@@ -0,0 +1,78 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "item_query.hpp"
+
+#include <caf/error.hpp>
+#include <caf/sec.hpp>
+
+#include <charconv>
+#include <string_view>
+
+namespace {
+
+// Upper bound for the number of items per page.
+constexpr int32_t max_page_size = 1000;
+
+bool parse_int(std::string_view str, int32_t& result) {
+  auto* first = str.data();
+  auto* last = str.data() + str.size();
+  auto [ptr, err] = std::from_chars(first, last, result);
+  return err == std::errc{} && ptr == last;
+}
+
+} // namespace
+
+caf::expected<item_query> make_item_query(const caf::uri::query_map& query) {
+  auto invalid = [](const char* what) {
+    return caf::make_error(caf::sec::invalid_argument, what);
+  };
+  item_query result;
+  if (auto i = query.find("ids"); i != query.end()) {
+    std::string_view str = i->second;
+    while (!str.empty()) {
+      auto pos = str.find(',');
+      int32_t id = 0;
+      if (!parse_int(str.substr(0, pos), id))
+        return invalid("ids must be a comma-separated list of integers");
+      result.ids.push_back(id);
+      if (result.ids.size() > static_cast<size_t>(max_page_size))
+        return invalid("too many ids");
+      if (pos == std::string_view::npos)
+        break;
+      str.remove_prefix(pos + 1);
+    }
+    return result;
+  }
+  for (auto [key, field] : {std::pair{"from", &result.from},
+                            std::pair{"to", &result.to},
+                            std::pair{"limit", &result.limit}}) {
+    if (auto i = query.find(key); i != query.end()
+                                  && !parse_int(i->second, *field))
+      return invalid("from, to and limit must be integers");
+  }
+  if (result.from > result.to)
+    return invalid("from must not exceed to");
+  if (result.limit < 1 || result.limit > max_page_size)
+    return invalid("limit must be between 1 and 1000");
+  return result;
+}
+
+ec run_item_query(database& db, const item_query& query, item_page& result) {
+  if (!query.ids.empty()) {
+    if (query.ids.size() > static_cast<size_t>(max_page_size))
+      return ec::invalid_argument;
+    return db.get_many(query.ids, result.items);
+  }
+  if (query.limit < 1 || query.limit > max_page_size)
+    return ec::invalid_argument;
+  // Read one extra row to find the start of the next page.
+  if (auto err = db.range(query.from, query.to, result.items, query.limit + 1);
+      err != ec::nil)
+    return err;
+  if (result.items.size() > static_cast<size_t>(query.limit)) {
+    result.has_next = true;
+    result.next = result.items.back().id;
+    result.items.pop_back();
+  }
+  return ec::nil;
+}
@@ -0,0 +1,57 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "database.hpp"
+#include "ec.hpp"
+#include "item.hpp"
+
+#include <caf/expected.hpp>
+#include <caf/uri.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+/// Selects multiple items, either by ID or by a range of IDs.
+struct item_query {
+  /// Selects individual items. If not empty, the query ignores the range.
+  std::vector<int32_t> ids;
+  /// First ID of the range (inclusive).
+  int32_t from = std::numeric_limits<int32_t>::min();
+  /// Last ID of the range (inclusive).
+  int32_t to = std::numeric_limits<int32_t>::max();
+  /// Maximum number of items in the result.
+  int32_t limit = 100;
+};
+
+template <class Inspector>
+bool inspect(Inspector& f, item_query& x) {
+  return f.object(x).fields(f.field("ids", x.ids), f.field("from", x.from),
+                            f.field("to", x.to), f.field("limit", x.limit));
+}
+
+/// A single page of a listing.
+struct item_page {
+  std::vector<item> items;
+  /// Indicates whether `next` holds the start of the next page.
+  bool has_next = false;
+  /// The ID to pass as `from` for fetching the next page of a range.
+  int32_t next = 0;
+};
+
+template <class Inspector>
+bool inspect(Inspector& f, item_page& x) {
+  return f.object(x).fields(f.field("items", x.items),
+                            f.field("has_next", x.has_next),
+                            f.field("next", x.next));
+}
+
+/// Parses a query from the parameters `ids` (comma-separated IDs) or `from`,
+/// `to` and `limit`. Each page has at most 1000 items.
+caf::expected<item_query> make_item_query(const caf::uri::query_map& query);
+
+/// Runs `query` on `db`. Range queries read at most one row beyond `limit`
+/// and thus never load more than a page into memory.
+ec run_item_query(database& db, const item_query& query, item_page& result);
@@ -1,20 +1,33 @@
 // (c) 2024, Interance GmbH & Co KG.
 
+#include "admission.hpp"
 #include "applog.hpp"
 #include "caf/event_based_actor.hpp"
 #include "controller_actor.hpp"
 #include "database.hpp"
 #include "database_actor.hpp"
+#include "database_reader_pool.hpp"
+#include "database_router.hpp"
+#include "event_format.hpp"
+#include "event_hub.hpp"
 #include "http_server.hpp"
+#include "inventory_actor.hpp"
+#include "item_cache.hpp"
+#include "item_coalescer.hpp"
+#include "response_cache.hpp"
+#include "snapshot_file.hpp"
+#include "snapshot_writer.hpp"
+#include "subscription.hpp"
+#include "tracing.hpp"
 #include "types.hpp"
 
 #include <caf/actor_system.hpp>
 #include <caf/actor_system_config.hpp>
 #include <caf/caf_main.hpp>
 #include <caf/json_object.hpp>
-#include <caf/json_writer.hpp>
 #include <caf/net/acceptor_resource.hpp>
 #include <caf/net/http/with.hpp>
+#include <caf/net/lp/with.hpp>
 #include <caf/net/middleman.hpp>
 #include <caf/net/octet_stream/with.hpp>
 #include <caf/net/tcp_accept_socket.hpp>
@@ -24,10 +37,14 @@
 
 #include <sqlite3.h>
 
+#include <algorithm>
+#include <chrono>
 #include <csignal>
 #include <cstdlib>
+#include <limits>
 #include <string>
 #include <string_view>
+#include <vector>
 
 using namespace std::literals;
 
@@ -38,6 +55,20 @@ namespace {
 
 std::string_view default_db_file = "items.db";
 
+std::string_view default_db_journal = "rollback";
+
+std::string_view default_db_engine = "sqlite";
+
+constexpr auto default_commit_batch = size_t{64};
+
+constexpr auto default_snapshot_verify_delay = caf::timespan{5s};
+
+constexpr auto default_trace_sample = size_t{100};
+
+constexpr auto default_trace_interval = caf::timespan{1s};
+
+std::string_view default_cache_policy = "clock";
+
 constexpr auto default_port = uint16_t{8080};
 
 constexpr auto default_max_connections = size_t{128};
@@ -46,6 +77,14 @@ constexpr auto default_max_request_size = uint32_t{65'536};
 
 constexpr auto default_max_pending_frames = size_t{32};
 
+std::string_view default_events_policy = "buffer";
+
+constexpr auto default_events_max_items = size_t{65'536};
+
+constexpr auto default_events_replay = size_t{4096};
+
+constexpr auto default_cmd_window = size_t{1};
+
 constexpr std::string_view json_mime_type = "application/json";
 
 std::atomic<bool> shutdown_flag;
@@ -58,49 +97,47 @@ struct config : caf::actor_system_config {
   config() {
     opt_group{custom_options_, "global"}
       .add<std::string>("db-file,d", "path to the database file")
+      .add<std::string>("db-engine", "storage engine: sqlite or memory")
+      .add<std::string>("db-journal", "SQLite journal mode: rollback or wal")
+      .add<caf::timespan>("commit-window", "max. delay for a shared commit")
+      .add<size_t>("commit-batch", "max. number of mutations per commit")
+      .add<size_t>("db-readers", "number of read-only connections for GETs")
+      .add<caf::timespan>("get-reuse-window",
+                          "max. age of a GET response for reuse")
+      .add<size_t>("db-shards", "number of database files for the items")
+      .add<std::string>("snapshot-file", "path to the item snapshot file")
+      .add<caf::timespan>("snapshot-interval", "delay between snapshots")
+      .add<caf::timespan>("snapshot-verify-delay",
+                          "delay for checking a loaded snapshot")
+      .add<bool>("inventory", "mirror all items for /inventory/stats")
+      .add<std::string>("trace-file", "path for writing sampled traces")
+      .add<size_t>("trace-sample", "trace one in this many requests")
+      .add<caf::timespan>("trace-interval", "delay between writing traces")
+      .add<size_t>("admission-max", "max. concurrent DB requests (0: off)")
+      .add<size_t>("admission-min", "min. concurrency limit under overload")
+      .add<caf::timespan>("admission-latency",
+                          "DB latency that signals an overload")
+      .add<size_t>("cache-size", "memory budget of the item cache in bytes")
+      .add<std::string>("cache-policy", "cache eviction policy: clock or lru")
+      .add<size_t>("response-cache-size",
+                   "memory budget for rendered GET responses in bytes")
       .add<uint16_t>("http-port,p", "port to listen for HTTP connections")
       .add<size_t>("max-connections,m", "limit for concurrent clients")
       .add<size_t>("max-request-size,r", "limit for single request size")
       .add<uint16_t>("cmd-port,P", "port to listen for (JSON) commands")
-      .add<std::string>("cmd-addr,A", "bind address for the controller");
+      .add<std::string>("cmd-addr,A", "bind address for the controller")
+      .add<size_t>("cmd-window", "max. commands sent ahead per client")
+      .add<uint16_t>("bin-port", "port to listen for (binary) commands")
+      .add<std::string>("events-policy", "slow subscribers: buffer or conflate")
+      .add<size_t>("events-buffer", "max. pending events per subscriber")
+      .add<size_t>("events-max-items", "max. conflated events per subscriber")
+      .add<size_t>("events-replay", "number of recent events for resuming");
     opt_group{custom_options_, "tls"}
       .add<std::string>("key-file,k", "path to the private key file")
       .add<std::string>("cert-file,c", "path to the certificate file");
   }
 };
 
-// --(ws-worker-part1-begin)--
-// The actor for handling a single WebSocket connection.
-void ws_worker(caf::event_based_actor* self,
-               caf::net::accept_event<ws::frame> new_conn, item_events events) {
-  using frame = ws::frame;
-  auto [pull, push] = new_conn.data();
-  // We ignore whatever the client may send to us.
-  pull.observe_on(self)
-    .do_finally([] { applog::info("WebSocket client disconnected"); })
-    .subscribe(std::ignore);
-  // --(ws-worker-part1-end)--
-  // --(ws-worker-part2-begin)--
-  // Send all events as JSON objects to the client.
-  auto writer = std::make_shared<caf::json_writer>();
-  writer->skip_object_type_annotation(true);
-  events.observe_on(self)
-    .filter([](const item_event& item) { return item != nullptr; })
-    .map([writer](const item_event& item) {
-      writer->reset();
-      if (!writer->apply(*item)) {
-        applog::error("failed to serialize an item event: {}",
-                      writer->get_error());
-        return frame{};
-      }
-      return frame{writer->str()};
-    })
-    .filter([](const frame& item) { return !item.empty(); })
-    .on_backpressure_buffer(default_max_pending_frames)
-    .subscribe(push);
-}
-// --(ws-worker-part2-end)--
-
 } // namespace
 
 int caf_main(caf::actor_system& sys, const config& cfg) {
@@ -109,13 +146,209 @@ int caf_main(caf::actor_system& sys, const config& cfg) {
   signal(SIGINT, set_shutdown_flag);
   // Database setup.
   auto db_file = caf::get_or(cfg, "db-file", default_db_file);
-  auto db = std::make_shared<database>(db_file);
-  if (auto err = db->open()) {
-    sys.println("Failed to open the SQLite database: {}", err);
+  auto engine = storage_engine::sqlite;
+  if (auto name = caf::get_or(cfg, "db-engine", default_db_engine);
+      !from_string(name, engine)) {
+    sys.println("*** invalid storage engine: {}", name);
+    return EXIT_FAILURE;
+  }
+  auto db_opts = database_options{};
+  if (auto journal = caf::get_or(cfg, "db-journal", default_db_journal);
+      journal == "wal") {
+    db_opts.wal = true;
+  } else if (journal != "rollback") {
+    sys.println("*** invalid journal mode: {}", journal);
+    return EXIT_FAILURE;
+  }
+  auto num_shards = caf::get_or(cfg, "db-shards", size_t{1});
+  if (num_shards == 0) {
+    sys.println("*** db-shards must be at least 1");
+    return EXIT_FAILURE;
+  }
+  // Optionally let mutations share commits.
+  auto policy = commit_policy{};
+  policy.window = caf::get_or(cfg, "commit-window", caf::timespan{0});
+  policy.max_batch = caf::get_or(cfg, "commit-batch", default_commit_batch);
+  if (policy.max_batch == 0) {
+    sys.println("*** commit-batch must be at least 1");
+    return EXIT_FAILURE;
+  }
+  // Both controllers limit how many commands each client may send ahead.
+  auto cmd_window = caf::get_or(cfg, "cmd-window", default_cmd_window);
+  if (cmd_window == 0) {
+    sys.println("*** cmd-window must be at least 1");
+    return EXIT_FAILURE;
+  }
+  // Optionally cache items in memory. The cache is disabled by default.
+  auto eviction = eviction_policy::clock;
+  if (auto name = caf::get_or(cfg, "cache-policy", default_cache_policy);
+      !from_string(name, eviction)) {
+    sys.println("*** invalid cache policy: {}", name);
+    return EXIT_FAILURE;
+  }
+  auto cache_size = caf::get_or(cfg, "cache-size", size_t{0});
+  auto cache = std::make_shared<item_cache>(cache_size, eviction);
+  // Optionally keep the rendered JSON of hot items for GET requests. Also
+  // disabled by default.
+  auto responses = std::make_shared<response_cache>(
+    caf::get_or(cfg, "response-cache-size", size_t{0}));
+  // Optionally trace a sample of all requests. The file uses the Chrome trace
+  // format, which Perfetto and chrome://tracing can open.
+  auto trace_file = caf::get_as<std::string>(cfg, "trace-file");
+  if (trace_file) {
+    auto every = caf::get_or(cfg, "trace-sample", default_trace_sample);
+    auto interval = caf::get_or(cfg, "trace-interval", default_trace_interval);
+    if (every == 0 || every > std::numeric_limits<uint32_t>::max()) {
+      sys.println("*** trace-sample must be between 1 and {}",
+                  std::numeric_limits<uint32_t>::max());
+      return EXIT_FAILURE;
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(interval);
+    if (!tracing::start_writer(*trace_file, static_cast<uint32_t>(every),
+                               std::max(ms, std::chrono::milliseconds{1}))) {
+      sys.println("*** unable to open the trace file {}", *trace_file);
+      return EXIT_FAILURE;
+    }
+  }
+  // Optionally shed requests while the database actors cannot keep up. Reads
+  // and writes each have their own concurrency limit.
+  auto admission_cfg = admission_config{};
+  admission_cfg.max_limit = caf::get_or(cfg, "admission-max",
+                                        admission_cfg.max_limit);
+  admission_cfg.min_limit = caf::get_or(cfg, "admission-min",
+                                        admission_cfg.min_limit);
+  if (auto latency = caf::get_as<caf::timespan>(cfg, "admission-latency"))
+    admission_cfg.target_latency = *latency;
+  admission_cfg.commit_window = policy.window;
+  if (admission_cfg.max_limit > 0
+      && admission_cfg.min_limit > admission_cfg.max_limit) {
+    sys.println("*** admission-min must not exceed admission-max");
     return EXIT_FAILURE;
   }
-  sys.println("Database contains {} items", db->count());
-  auto [db_actor, events] = spawn_database_actor(sys, db);
+  // Admit a full window of commands per client from the start.
+  admission_cfg.initial_limit = std::max(admission_cfg.initial_limit,
+                                         cmd_window);
+  auto admission = std::make_shared<admission_control>(admission_cfg);
+  // Optionally start from a snapshot file instead of scanning the database.
+  // If enabled, the inventory actor checks the snapshot against the database
+  // later.
+  auto snapshot_file = caf::get_as<std::string>(cfg, "snapshot-file");
+  auto warm = mapped_snapshot_ptr{};
+  if (snapshot_file) {
+    if (auto snapshot = mapped_snapshot::open(*snapshot_file))
+      warm = std::move(*snapshot);
+    else
+      sys.println("Ignoring the snapshot file {}: {}", *snapshot_file,
+                  snapshot.error());
+  }
+  // Spin up one database actor per shard. Shard `i` stores its items in
+  // `<db-file>.<i>`. With more than one shard, a router partitions the items
+  // by ID and sits in front of the database actors. The memory engine uses
+  // the file for its append-only log.
+  auto shards = std::vector<database_shard>{};
+  for (size_t i = 0; i < num_shards; ++i) {
+    auto file = std::string{db_file};
+    if (num_shards > 1)
+      file += '.' + std::to_string(i);
+    auto db = make_database(engine, file, db_opts);
+    if (auto err = db->open()) {
+      sys.println("Failed to open the database {}: {}", file, err);
+      for (auto& shard : shards)
+        anon_send_exit(shard.first, caf::exit_reason::user_shutdown);
+      return EXIT_FAILURE;
+    }
+    // Counting the items scans the whole table, which the snapshot avoids.
+    if (!warm)
+      sys.println("Database {} contains {} items", file, db->count());
+    shards.push_back(
+      spawn_database_actor(sys, db, cache, responses, policy));
+  }
+  auto [db_actor, events] = num_shards == 1
+                              ? std::move(shards.front())
+                              : spawn_database_router(sys, std::move(shards));
+  // Optionally mirror all items in memory for aggregation queries. Loading
+  // the mirror without a snapshot file reads all items on the database actor,
+  // so the mirror is off by default.
+  auto inventory = inventory_actor{};
+  if (warm)
+    sys.println("Snapshot {} contains {} items", *snapshot_file, warm->size());
+  if (caf::get_or(cfg, "inventory", false)) {
+    auto& kernels = default_kernels();
+    sys.println("Aggregation kernels: {}", to_string(kernels.level));
+    auto verify_delay = caf::get_or(cfg, "snapshot-verify-delay",
+                                    default_snapshot_verify_delay);
+    inventory = spawn_inventory_actor(sys, db_actor, events, kernels,
+                                      std::move(warm), verify_delay);
+  }
+  // Optionally write the snapshot file periodically. Without an interval,
+  // the server only writes it at shutdown.
+  if (auto interval = caf::get_as<caf::timespan>(cfg, "snapshot-interval");
+      snapshot_file && interval && interval->count() > 0)
+    spawn_snapshot_writer(sys, db_actor, *snapshot_file, *interval);
+  // Configure how to deal with WebSocket clients that fall behind.
+  auto sub_policy = subscriber_policy{};
+  if (auto name = caf::get_or(cfg, "events-policy", default_events_policy);
+      !from_string(name, sub_policy.mode)) {
+    sys.println("*** invalid events policy: {}", name);
+    anon_send_exit(db_actor, caf::exit_reason::user_shutdown);
+    return EXIT_FAILURE;
+  }
+  sub_policy.max_pending = caf::get_or(cfg, "events-buffer",
+                                       default_max_pending_frames);
+  sub_policy.max_items = caf::get_or(cfg, "events-max-items",
+                                     default_events_max_items);
+  auto replay = caf::get_or(cfg, "events-replay", default_events_replay);
+  if (sub_policy.max_pending == 0) {
+    sys.println("*** events-buffer must be at least 1");
+    anon_send_exit(db_actor, caf::exit_reason::user_shutdown);
+    return EXIT_FAILURE;
+  }
+  // Optionally serve reads from a pool of read-only connections. Without a
+  // pool, the database actor also answers all reads.
+  auto readers = std::make_shared<database_reader_pool>(db_actor);
+  if (auto num_readers = caf::get_or(cfg, "db-readers", size_t{0});
+      num_readers > 0) {
+    if (num_shards > 1) {
+      sys.println("*** db-readers requires db-shards=1");
+      anon_send_exit(db_actor, caf::exit_reason::user_shutdown);
+      return EXIT_FAILURE;
+    }
+    if (engine != storage_engine::sqlite) {
+      sys.println("*** db-readers requires db-engine=sqlite");
+      anon_send_exit(db_actor, caf::exit_reason::user_shutdown);
+      return EXIT_FAILURE;
+    }
+    if (!db_opts.wal) {
+      sys.println("*** db-readers requires db-journal=wal");
+      anon_send_exit(db_actor, caf::exit_reason::user_shutdown);
+      return EXIT_FAILURE;
+    }
+    auto reader_hdls = std::vector<database_reader_actor>{};
+    for (size_t i = 0; i < num_readers; ++i) {
+      auto reader_opts = db_opts;
+      reader_opts.read_only = true;
+      auto reader_db = make_database(engine, std::string{db_file},
+                                     reader_opts);
+      if (auto err = reader_db->open()) {
+        sys.println("Failed to open a read-only connection: {}", err);
+        anon_send_exit(db_actor, caf::exit_reason::user_shutdown);
+        return EXIT_FAILURE;
+      }
+      reader_hdls.push_back(
+        spawn_database_reader(sys, reader_db, cache, db_actor));
+    }
+    readers = std::make_shared<database_reader_pool>(std::move(reader_hdls));
+  }
+  // Let concurrent GETs for the same item share a single lookup. One
+  // coalescer per reader keeps as many lookups in flight as there are
+  // readers.
+  auto reuse_window = caf::get_or(cfg, "get-reuse-window", caf::timespan{0});
+  auto coalescer_hdls = std::vector<item_coalescer_actor>{};
+  for (size_t i = 0; i < readers->size(); ++i)
+    coalescer_hdls.push_back(
+      spawn_item_coalescer(sys, readers, responses, db_actor, reuse_window));
+  auto coalescers
+    = std::make_shared<item_coalescer_pool>(std::move(coalescer_hdls));
   // --(ctrl-server-begin)--
   // Spin up the controller if configured.
   if (auto cmd_port = caf::get_as<uint16_t>(cfg, "cmd-port")) {
@@ -127,8 +360,10 @@ int caf_main(caf::actor_system& sys, const config& cfg) {
           // Stop the server if our database actor terminates.
           .monitor(db_actor)
           // When started, run our worker actor to handle incoming connections.
-          .start([&sys, db_actor = db_actor](auto events) {
-            spawn_controller_actor(sys, db_actor, std::move(events));
+          .start([&sys, db_actor = db_actor, admission,
+                  window = cmd_window](auto events) {
+            spawn_controller_actor(sys, db_actor, admission, std::move(events),
+                                   window);
           });
     if (!cmd_server) {
       sys.println("*** failed to start command server: {}", cmd_server.error());
@@ -136,6 +371,25 @@ int caf_main(caf::actor_system& sys, const config& cfg) {
     }
   }
   // --(ctrl-server-end)--
+  // Spin up the controller for the binary protocol if configured. It shares
+  // the bind address and the window with the JSON controller.
+  if (auto bin_port = caf::get_as<uint16_t>(cfg, "bin-port")) {
+    auto addr = caf::get_or(cfg, "cmd-addr", "0.0.0.0"sv);
+    auto bin_server
+      = caf::net::lp::with(sys)
+          .accept(*bin_port, addr)
+          .monitor(db_actor)
+          .start([&sys, db_actor = db_actor, admission,
+                  window = cmd_window](auto events) {
+            spawn_binary_controller_actor(sys, db_actor, admission,
+                                          std::move(events), window);
+          });
+    if (!bin_server) {
+      sys.println("*** failed to start binary command server: {}",
+                  bin_server.error());
+      return EXIT_FAILURE;
+    }
+  }
   // --(http-server-config-begin)--
   // Read the configuration for the web server.
   auto port = caf::get_or(cfg, "http-port", default_port);
@@ -154,7 +408,9 @@ int caf_main(caf::actor_system& sys, const config& cfg) {
   // --(http-server-part1-begin)--
   // Start the HTTP server.
   namespace ssl = caf::net::ssl;
-  auto impl = std::make_shared<http_server>(db_actor);
+  auto impl = std::make_shared<http_server>(db_actor, readers, coalescers,
+                                            cache, responses, inventory,
+                                            admission);
   auto server
     = caf::net::http::with(sys)
         // Optionally enable TLS.
@@ -203,19 +459,79 @@ int caf_main(caf::actor_system& sys, const config& cfg) {
                  applog::debug("DELETE /item/{}", key);
                  impl->del(res, key);
                })
+        // Route for listing items, either with `?ids=1,2,3` or with
+        // `?from=<id>&to=<id>&limit=<n>`. Range listings return pages of at
+        // most 1000 items and the ID for the next page.
+        .route("/items", http::method::get,
+               [impl](http::responder& res) {
+                 applog::debug("GET /items");
+                 impl->list(res);
+               })
+        // Route for applying multiple operations in one transaction. The
+        // payload must be a JSON object with the fields "ops" (an array of
+        // objects with "type", "id" and "amount") and optionally "atomic".
+        .route("/items/batch", http::method::post,
+               [impl](http::responder& res) {
+                 applog::debug("POST /items/batch, body: {}", res.body());
+                 impl->batch(res);
+               })
+        // Route for totals over all items, e.g.,
+        // `/inventory/stats?threshold=5&bucket_width=50&buckets=20`. Requires
+        // the `inventory` option.
+        .route("/inventory/stats", http::method::get,
+               [impl](http::responder& res) {
+                 applog::debug("GET /inventory/stats");
+                 impl->inventory(res);
+               })
+        // Route for reading the counters of the item cache.
+        .route("/cache/stats", http::method::get,
+               [impl](http::responder& res) {
+                 applog::debug("GET /cache/stats");
+                 impl->cache_stats(res);
+               })
+        // Route for scraping all metrics in the Prometheus text format.
+        .route("/metrics", http::method::get,
+               [impl](http::responder& res) {
+                 applog::debug("GET /metrics");
+                 impl->scrape(res);
+               })
         // --(http-server-part2-end)--
         // --(http-server-part3-begin)--
         // WebSocket route for subscribing to item events.
         .route("/events", http::method::get,
                ws::switch_protocol()
-                 .on_request([](ws::acceptor<>& acc) { acc.accept(); })
-                 .on_start([&sys, ev = events](auto res) {
-                   // Spawn a server for the WebSocket connection that simply
-                   // spawns new workers for each incoming connection.
-                   sys.spawn([res, ev](caf::event_based_actor* self) {
-                     res.observe_on(self).for_each([self, ev](auto new_conn) {
+                 // Clients may select items and the encoding with the query,
+                 // e.g., `/events?ids=1,2&ranges=100-199&snapshot=true` or
+                 // `/events?format=delta&batch=10`. Clients resume a stream
+                 // with `/events?since=<epoch>:<seq>`.
+                 .on_request([](ws::acceptor<subscription_filter,
+                                             stream_options>& acc) {
+                   const auto& query = acc.header().query();
+                   auto filter = make_subscription_filter(query);
+                   if (!filter) {
+                     acc.reject(filter.error());
+                     return;
+                   }
+                   auto opts = make_stream_options(query);
+                   if (!opts) {
+                     acc.reject(opts.error());
+                     return;
+                   }
+                   acc.accept(std::move(*filter), *opts);
+                 })
+                 .on_start([&sys, ev = events, db_actor = db_actor,
+                            sub_policy, replay](auto res) {
+                   // Spawn a server for the WebSocket connections. Its event
+                   // hub serializes each event once for all clients.
+                   sys.spawn([res, ev, db_actor, sub_policy,
+                              replay](caf::event_based_actor* self) {
+                     auto hub = std::make_shared<event_hub>(self, db_actor,
+                                                            sub_policy, replay);
+                     hub->start(ev);
+                     res.observe_on(self).for_each([hub](auto new_conn) {
                        applog::info("WebSocket client connected");
-                       self->spawn(ws_worker, new_conn, ev);
+                       auto [pull, push, filter, opts] = new_conn.data();
+                       hub->subscribe(pull, push, filter, opts);
                      });
                    });
                  }))
@@ -234,7 +550,13 @@ int caf_main(caf::actor_system& sys, const config& cfg) {
     std::this_thread::sleep_for(250ms);
   sys.println("*** shutting down");
   server->dispose();
+  if (snapshot_file) {
+    if (auto err = save_snapshot(sys, db_actor, *snapshot_file);
+        err != ec::nil)
+      sys.println("Failed to write the snapshot file: {}", to_string(err));
+  }
   anon_send_exit(db_actor, caf::exit_reason::user_shutdown);
+  tracing::stop_writer();
   return EXIT_SUCCESS;
 }
 
@@ -0,0 +1,517 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "memory_database.hpp"
+
+#include <caf/sec.hpp>
+
+#include <array>
+#include <cstring>
+#include <limits>
+#include <string_view>
+#include <utility>
+
+namespace {
+
+// Identifies log files of the memory engine, e.g., to reject SQLite files.
+constexpr std::string_view log_magic = "WHLOG002";
+
+// Each commit writes its records as one frame: the size of the records and
+// their CRC-32, followed by the records. Replaying the log stops at the first
+// incomplete frame, so a commit is either complete or missing after a crash.
+constexpr size_t frame_header_size = 8;
+
+// Tags for the two types of log records. A put record stores the full state
+// of an item: id, price, available, name size and the name. An erase record
+// only stores the ID. All integers use the byte order of the machine.
+constexpr char put_tag = 'P';
+
+constexpr char erase_tag = 'E';
+
+// Size of the chunks for writing the compacted log.
+constexpr size_t write_chunk_size = 65'536;
+
+uint32_t hash(int32_t id) noexcept {
+  // Finalizer of MurmurHash3. Spreads consecutive IDs over all slots.
+  auto x = static_cast<uint32_t>(id);
+  x ^= x >> 16;
+  x *= 0x85eb'ca6bu;
+  x ^= x >> 13;
+  x *= 0xc2b2'ae35u;
+  x ^= x >> 16;
+  return x;
+}
+
+/// Computes the CRC-32 (IEEE 802.3) of `bytes`.
+uint32_t crc32(std::string_view bytes) noexcept {
+  static constexpr auto table = [] {
+    auto result = std::array<uint32_t, 256>{};
+    for (uint32_t i = 0; i < 256; ++i) {
+      auto x = i;
+      for (int bit = 0; bit < 8; ++bit)
+        x = (x & 1) != 0 ? 0xedb8'8320u ^ (x >> 1) : x >> 1;
+      result[i] = x;
+    }
+    return result;
+  }();
+  auto crc = 0xffff'ffffu;
+  for (auto ch : bytes)
+    crc = table[(crc ^ static_cast<uint8_t>(ch)) & 0xff] ^ (crc >> 8);
+  return crc ^ 0xffff'ffffu;
+}
+
+template <class T>
+void append_int(std::string& buf, T value) {
+  char tmp[sizeof(T)];
+  std::memcpy(tmp, &value, sizeof(T));
+  buf.append(tmp, sizeof(T));
+}
+
+template <class T>
+bool read_int(std::string_view& input, T& value) {
+  if (input.size() < sizeof(T))
+    return false;
+  std::memcpy(&value, input.data(), sizeof(T));
+  input.remove_prefix(sizeof(T));
+  return true;
+}
+
+void append_put(std::string& buf, int32_t id, int32_t price,
+                int32_t available, const std::string& name) {
+  buf += put_tag;
+  append_int(buf, id);
+  append_int(buf, price);
+  append_int(buf, available);
+  append_int(buf, static_cast<uint32_t>(name.size()));
+  buf += name;
+}
+
+bool write_all(std::FILE* file, std::string_view buf) {
+  return std::fwrite(buf.data(), 1, buf.size(), file) == buf.size();
+}
+
+/// Writes `records` as a single frame.
+bool write_frame(std::FILE* file, std::string_view records) {
+  auto header = std::string{};
+  append_int(header, static_cast<uint32_t>(records.size()));
+  append_int(header, crc32(records));
+  return write_all(file, header) && write_all(file, records);
+}
+
+} // namespace
+
+memory_database::memory_database(std::string log_file)
+  : log_file_(std::move(log_file)), index_(16, npos) {
+  // nop
+}
+
+memory_database::~memory_database() {
+  // Changes of an unfinished transaction never reach the log.
+  if (log_ != nullptr)
+    std::fclose(log_);
+}
+
+caf::error memory_database::open() {
+  if (log_ != nullptr)
+    return make_error(caf::sec::runtime_error, "database already open");
+  if (auto err = replay(log_file_))
+    return err;
+  if (auto err = compact())
+    return err;
+  log_ = std::fopen(log_file_.c_str(), "ab");
+  if (log_ == nullptr)
+    return make_error(caf::sec::runtime_error, "could not open log file");
+  return caf::error{};
+}
+
+int memory_database::count() {
+  return static_cast<int>(ids_.size());
+}
+
+std::optional<item> memory_database::get(int32_t id) {
+  if (auto row = find(id); row != npos)
+    return row_to_item(row);
+  return std::nullopt;
+}
+
+ec memory_database::range(int32_t first, int32_t last,
+                          std::vector<item>& result, int limit) {
+  if (first > last)
+    return ec::nil;
+  auto i = ordered_ids_.lower_bound(first);
+  for (; i != ordered_ids_.end() && *i <= last && limit != 0; ++i) {
+    result.push_back(row_to_item(find(*i)));
+    if (limit > 0)
+      --limit;
+  }
+  return ec::nil;
+}
+
+ec memory_database::get_many(const std::vector<int32_t>& ids,
+                             std::vector<item>& result) {
+  for (auto id : ids)
+    if (auto row = find(id); row != npos)
+      result.push_back(row_to_item(row));
+  return ec::nil;
+}
+
+ec memory_database::insert(const item& new_item) {
+  if (log_ == nullptr)
+    return ec::database_inaccessible;
+  if (find(new_item.id) != npos)
+    return ec::key_already_exists;
+  add_row(new_item);
+  undo_.push_back({new_item.id, std::nullopt});
+  log_put(new_item);
+  return finish_mutation();
+}
+
+ec memory_database::inc(int32_t id, int32_t amount, item& updated) {
+  if (amount <= 0)
+    return ec::invalid_argument;
+  if (log_ == nullptr)
+    return ec::database_inaccessible;
+  auto row = find(id);
+  if (row == npos)
+    return ec::no_such_item;
+  if (available_[row] > std::numeric_limits<int32_t>::max() - amount)
+    return ec::invalid_argument;
+  undo_.push_back({id, row_to_item(row)});
+  available_[row] += amount;
+  updated = row_to_item(row);
+  log_put(updated);
+  return finish_mutation();
+}
+
+ec memory_database::dec(int32_t id, int32_t amount, item& updated) {
+  if (amount <= 0)
+    return ec::invalid_argument;
+  if (log_ == nullptr)
+    return ec::database_inaccessible;
+  auto row = find(id);
+  if (row == npos)
+    return ec::no_such_item;
+  undo_.push_back({id, row_to_item(row)});
+  available_[row] = available_[row] < amount ? 0 : available_[row] - amount;
+  updated = row_to_item(row);
+  log_put(updated);
+  return finish_mutation();
+}
+
+ec memory_database::del(int32_t id, item& removed) {
+  if (log_ == nullptr)
+    return ec::database_inaccessible;
+  auto row = find(id);
+  if (row == npos)
+    return ec::no_such_item;
+  removed = row_to_item(row);
+  undo_.push_back({id, removed});
+  remove_row(row);
+  log_erase(id);
+  return finish_mutation();
+}
+
+ec memory_database::begin() {
+  if (log_ == nullptr || in_transaction_)
+    return ec::database_inaccessible;
+  in_transaction_ = true;
+  return ec::nil;
+}
+
+ec memory_database::commit() {
+  if (!in_transaction_)
+    return ec::database_inaccessible;
+  // On error, the transaction remains active until the caller rolls back.
+  if (auto err = flush_pending(); err != ec::nil)
+    return err;
+  in_transaction_ = false;
+  implicit_transaction_ = false;
+  undo_.clear();
+  savepoints_.clear();
+  return ec::nil;
+}
+
+ec memory_database::rollback() {
+  if (!in_transaction_)
+    return ec::database_inaccessible;
+  revert(0);
+  pending_.clear();
+  savepoints_.clear();
+  in_transaction_ = false;
+  implicit_transaction_ = false;
+  return ec::nil;
+}
+
+ec memory_database::savepoint() {
+  if (log_ == nullptr)
+    return ec::database_inaccessible;
+  if (!in_transaction_) {
+    in_transaction_ = true;
+    implicit_transaction_ = true;
+  }
+  savepoints_.push_back({undo_.size(), pending_.size()});
+  return ec::nil;
+}
+
+ec memory_database::release_savepoint() {
+  if (savepoints_.empty())
+    return ec::database_inaccessible;
+  savepoints_.pop_back();
+  if (!savepoints_.empty() || !implicit_transaction_)
+    return ec::nil;
+  // Releasing the outermost savepoint ends a transaction that it started.
+  if (auto err = commit(); err != ec::nil) {
+    (void) rollback();
+    return err;
+  }
+  return ec::nil;
+}
+
+ec memory_database::rollback_to_savepoint() {
+  if (savepoints_.empty())
+    return ec::database_inaccessible;
+  auto marker = savepoints_.back();
+  revert(marker.undo_size);
+  pending_.resize(marker.pending_size);
+  return release_savepoint();
+}
+
+uint32_t memory_database::find(int32_t id) const noexcept {
+  auto mask = index_.size() - 1;
+  for (auto pos = hash(id) & mask;; pos = (pos + 1) & mask) {
+    auto row = index_[pos];
+    if (row == npos || ids_[row] == id)
+      return row;
+  }
+}
+
+size_t memory_database::slot_of(uint32_t row) const noexcept {
+  auto mask = index_.size() - 1;
+  auto pos = hash(ids_[row]) & mask;
+  while (index_[pos] != row)
+    pos = (pos + 1) & mask;
+  return pos;
+}
+
+item memory_database::row_to_item(uint32_t row) const {
+  return item{ids_[row], prices_[row], available_[row], names_[row]};
+}
+
+void memory_database::add_row(const item& value) {
+  // Keep the load factor at or below 50% for short probe sequences.
+  if ((ids_.size() + 1) * 2 > index_.size())
+    grow_index();
+  auto row = static_cast<uint32_t>(ids_.size());
+  ids_.push_back(value.id);
+  prices_.push_back(value.price);
+  available_.push_back(value.available);
+  names_.push_back(value.name);
+  ordered_ids_.insert(value.id);
+  auto mask = index_.size() - 1;
+  auto pos = hash(value.id) & mask;
+  while (index_[pos] != npos)
+    pos = (pos + 1) & mask;
+  index_[pos] = row;
+}
+
+void memory_database::set_row(uint32_t row, const item& value) {
+  prices_[row] = value.price;
+  available_[row] = value.available;
+  names_[row] = value.name;
+}
+
+void memory_database::remove_row(uint32_t row) {
+  // Remove the row from the index by shifting back all entries of the probe
+  // sequence that may no longer be reachable otherwise. This avoids
+  // tombstones.
+  auto mask = index_.size() - 1;
+  auto hole = slot_of(row);
+  for (auto pos = (hole + 1) & mask; index_[pos] != npos;
+       pos = (pos + 1) & mask) {
+    auto home = hash(ids_[index_[pos]]) & mask;
+    if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+      index_[hole] = index_[pos];
+      hole = pos;
+    }
+  }
+  index_[hole] = npos;
+  ordered_ids_.erase(ids_[row]);
+  // Fill the gap in the columns with the last row.
+  auto last = static_cast<uint32_t>(ids_.size() - 1);
+  if (row != last) {
+    index_[slot_of(last)] = row;
+    ids_[row] = ids_[last];
+    prices_[row] = prices_[last];
+    available_[row] = available_[last];
+    names_[row] = std::move(names_[last]);
+  }
+  ids_.pop_back();
+  prices_.pop_back();
+  available_.pop_back();
+  names_.pop_back();
+}
+
+void memory_database::grow_index() {
+  index_.assign(index_.size() * 2, npos);
+  auto mask = index_.size() - 1;
+  for (uint32_t row = 0; row < ids_.size(); ++row) {
+    auto pos = hash(ids_[row]) & mask;
+    while (index_[pos] != npos)
+      pos = (pos + 1) & mask;
+    index_[pos] = row;
+  }
+}
+
+void memory_database::log_put(const item& value) {
+  append_put(pending_, value.id, value.price, value.available, value.name);
+}
+
+void memory_database::log_erase(int32_t id) {
+  pending_ += erase_tag;
+  append_int(pending_, id);
+}
+
+caf::error memory_database::replay(const std::string& file) {
+  // A missing file simply means that we start with an empty database.
+  auto* in = std::fopen(file.c_str(), "rb");
+  if (in == nullptr)
+    return caf::error{};
+  auto buf = std::string{};
+  char chunk[write_chunk_size];
+  while (auto n = std::fread(chunk, 1, sizeof(chunk), in))
+    buf.append(chunk, n);
+  auto failed = std::ferror(in) != 0;
+  std::fclose(in);
+  if (failed)
+    return make_error(caf::sec::runtime_error, "could not read log file");
+  if (buf.empty())
+    return caf::error{};
+  auto input = std::string_view{buf};
+  if (input.substr(0, log_magic.size()) != log_magic)
+    return make_error(caf::sec::runtime_error, "not a memory database log");
+  input.remove_prefix(log_magic.size());
+  while (input.size() >= frame_header_size) {
+    auto size = uint32_t{0};
+    auto checksum = uint32_t{0};
+    auto header = input;
+    read_int(header, size);
+    read_int(header, checksum);
+    // A crash may leave an incomplete frame at the end, which we discard. A
+    // broken frame anywhere else means that the file is corrupted.
+    auto frame_end = frame_header_size + size;
+    if (input.size() < frame_end)
+      break;
+    auto records = header.substr(0, size);
+    if (crc32(records) != checksum) {
+      if (input.size() == frame_end)
+        break;
+      return make_error(caf::sec::runtime_error, "corrupted log file");
+    }
+    if (apply_records(records) != size)
+      return make_error(caf::sec::runtime_error, "corrupted log file");
+    input.remove_prefix(frame_end);
+  }
+  return caf::error{};
+}
+
+size_t memory_database::apply_records(std::string_view input) {
+  auto total = input.size();
+  auto consumed = size_t{0};
+  while (!input.empty()) {
+    auto tag = input.front();
+    input.remove_prefix(1);
+    auto value = item{};
+    if (!read_int(input, value.id))
+      break;
+    if (tag == erase_tag) {
+      if (auto row = find(value.id); row != npos)
+        remove_row(row);
+      consumed = total - input.size();
+      continue;
+    }
+    if (tag != put_tag)
+      break;
+    auto name_size = uint32_t{0};
+    if (!read_int(input, value.price) || !read_int(input, value.available)
+        || !read_int(input, name_size) || input.size() < name_size)
+      break;
+    value.name = std::string{input.substr(0, name_size)};
+    input.remove_prefix(name_size);
+    if (auto row = find(value.id); row != npos)
+      set_row(row, value);
+    else
+      add_row(value);
+    consumed = total - input.size();
+  }
+  return consumed;
+}
+
+caf::error memory_database::compact() {
+  // Write to a temporary file first, so that a crash never leaves us without
+  // a complete log.
+  auto tmp_file = log_file_ + ".tmp";
+  auto* out = std::fopen(tmp_file.c_str(), "wb");
+  if (out == nullptr)
+    return make_error(caf::sec::runtime_error, "could not write log file");
+  auto ok = write_all(out, log_magic);
+  auto buf = std::string{};
+  for (uint32_t row = 0; row < ids_.size() && ok; ++row) {
+    append_put(buf, ids_[row], prices_[row], available_[row], names_[row]);
+    if (buf.size() >= write_chunk_size) {
+      ok = write_frame(out, buf);
+      buf.clear();
+    }
+  }
+  if (ok && !buf.empty())
+    ok = write_frame(out, buf);
+  ok = ok && std::fflush(out) == 0;
+  ok = std::fclose(out) == 0 && ok;
+  if (!ok || std::rename(tmp_file.c_str(), log_file_.c_str()) != 0) {
+    std::remove(tmp_file.c_str());
+    return make_error(caf::sec::runtime_error, "could not write log file");
+  }
+  return caf::error{};
+}
+
+ec memory_database::flush_pending() {
+  if (log_ == nullptr)
+    return ec::database_inaccessible;
+  if (pending_.empty())
+    return ec::nil;
+  if (!write_frame(log_, pending_) || std::fflush(log_) != 0) {
+    // The log may end with a partial frame now. Refuse all further
+    // mutations instead of appending to it.
+    std::fclose(log_);
+    log_ = nullptr;
+    return ec::database_inaccessible;
+  }
+  pending_.clear();
+  return ec::nil;
+}
+
+ec memory_database::finish_mutation() {
+  if (in_transaction_)
+    return ec::nil;
+  auto err = flush_pending();
+  if (err != ec::nil) {
+    revert(0);
+    pending_.clear();
+  }
+  undo_.clear();
+  return err;
+}
+
+void memory_database::revert(size_t size) {
+  while (undo_.size() > size) {
+    auto& entry = undo_.back();
+    auto row = find(entry.id);
+    if (entry.before) {
+      if (row == npos)
+        add_row(*entry.before);
+      else
+        set_row(row, *entry.before);
+    } else if (row != npos) {
+      remove_row(row);
+    }
+    undo_.pop_back();
+  }
+}
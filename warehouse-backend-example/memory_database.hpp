@@ -0,0 +1,157 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "database.hpp"
+#include "ec.hpp"
+#include "item.hpp"
+
+#include <caf/error.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Keeps all items in memory and appends each committed change to a log file.
+///
+/// The items live in one vector per field (structure of arrays), so that
+/// scans over prices or counts touch contiguous memory. An open-addressing
+/// hash table with linear probing maps IDs to rows. Deleting an item moves the
+/// last row into its place, so the rows have no particular order. An ordered
+/// set of all IDs serves range queries.
+///
+/// On `open`, the database replays the log and then rewrites it with one
+/// record per item. Commits write their records as one frame with a checksum
+/// and flush them to the operating system, i.e., committed changes survive a
+/// crash of the process but not necessarily a crash of the machine. Replaying
+/// discards an incomplete frame at the end of the log, so a crash never leaves
+/// a partial transaction behind.
+class memory_database : public database {
+public:
+  explicit memory_database(std::string log_file);
+
+  memory_database(const memory_database&) = delete;
+
+  memory_database& operator=(const memory_database&) = delete;
+
+  ~memory_database() override;
+
+  caf::error open() override;
+
+  int count() override;
+
+  std::optional<item> get(int32_t id) override;
+
+  ec range(int32_t first, int32_t last, std::vector<item>& result,
+           int limit = -1) override;
+
+  ec get_many(const std::vector<int32_t>& ids,
+              std::vector<item>& result) override;
+
+  ec insert(const item& new_item) override;
+
+  ec inc(int32_t id, int32_t amount, item& updated) override;
+
+  ec dec(int32_t id, int32_t amount, item& updated) override;
+
+  ec del(int32_t id, item& removed) override;
+
+  ec begin() override;
+
+  ec commit() override;
+
+  ec rollback() override;
+
+  ec savepoint() override;
+
+  ec release_savepoint() override;
+
+  ec rollback_to_savepoint() override;
+
+private:
+  /// Marks an empty slot in the index.
+  static constexpr uint32_t npos = UINT32_MAX;
+
+  /// Restores the state of a single item when rolling back.
+  struct undo_entry {
+    int32_t id;
+    /// The state before the change or `std::nullopt` if the item was new.
+    std::optional<item> before;
+  };
+
+  /// Remembers where a savepoint starts in the undo log and in the pending
+  /// log records.
+  struct savepoint_marker {
+    size_t undo_size;
+    size_t pending_size;
+  };
+
+  /// Returns the row of the item with given ID or `npos`.
+  uint32_t find(int32_t id) const noexcept;
+
+  /// Returns the index slot that points to `row`.
+  size_t slot_of(uint32_t row) const noexcept;
+
+  /// Reads all fields of a row.
+  item row_to_item(uint32_t row) const;
+
+  /// Appends a row for a new item.
+  void add_row(const item& value);
+
+  /// Overwrites all fields of a row.
+  void set_row(uint32_t row, const item& value);
+
+  /// Removes a row by moving the last row into its place.
+  void remove_row(uint32_t row);
+
+  /// Doubles the capacity of the index and re-inserts all rows.
+  void grow_index();
+
+  /// Adds a log record that stores the current state of `value`.
+  void log_put(const item& value);
+
+  /// Adds a log record that removes the item with given ID.
+  void log_erase(int32_t id);
+
+  /// Replays a log file into memory.
+  caf::error replay(const std::string& file);
+
+  /// Applies log records to the items in memory.
+  /// @returns the number of bytes in complete records.
+  size_t apply_records(std::string_view input);
+
+  /// Rewrites the log with one record per item.
+  caf::error compact();
+
+  /// Writes all pending log records to the file.
+  ec flush_pending();
+
+  /// Commits a mutation right away unless a transaction is active.
+  ec finish_mutation();
+
+  /// Reverts all changes until the undo log has `size` entries.
+  void revert(size_t size);
+
+  std::string log_file_;
+  std::FILE* log_ = nullptr;
+  // One vector per field of `item`.
+  std::vector<int32_t> ids_;
+  std::vector<int32_t> prices_;
+  std::vector<int32_t> available_;
+  std::vector<std::string> names_;
+  // Maps IDs to rows. The size is always a power of two.
+  std::vector<uint32_t> index_;
+  // All IDs in ascending order.
+  std::set<int32_t> ordered_ids_;
+  // Log records that wait for the end of the current transaction.
+  std::string pending_;
+  std::vector<undo_entry> undo_;
+  std::vector<savepoint_marker> savepoints_;
+  bool in_transaction_ = false;
+  // Indicates that the transaction started with a savepoint.
+  bool implicit_transaction_ = false;
+};
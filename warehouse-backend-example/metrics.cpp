@@ -0,0 +1,338 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "metrics.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace metrics {
+
+namespace {
+
+constexpr size_t num_counters
+  = static_cast<size_t>(counter::http_not_modified) + 1;
+
+constexpr size_t num_gauges
+  = static_cast<size_t>(gauge::admission_write_in_flight) + 1;
+
+constexpr size_t num_histograms = static_cast<size_t>(histogram::ws_backlog)
+                                  + 1;
+
+// Number of buckets with an upper bound. Bucket `i` counts the values up to
+// `2^(min_exp + i)` and one more bucket counts all larger values.
+constexpr size_t num_buckets = 24;
+
+/// A family of metrics that share a name, e.g., all routes of the HTTP
+/// latency histogram.
+struct family_info {
+  std::string_view name;
+  std::string_view help;
+  std::string_view type;
+};
+
+constexpr family_info counter_families[] = {
+  {"warehouse_http_errors_total", "HTTP requests with an error response.",
+   "counter"},
+  {"warehouse_controller_errors_total", "Failed commands on command ports.",
+   "counter"},
+  {"warehouse_ws_overflows_total",
+   "WebSocket subscribers dropped for falling behind.", "counter"},
+  {"warehouse_admission_read_shed_total",
+   "Reads rejected by admission control.", "counter"},
+  {"warehouse_admission_write_shed_total",
+   "Writes rejected by admission control.", "counter"},
+  {"warehouse_get_coalesced_total",
+   "Item lookups that joined a lookup already in flight.", "counter"},
+  {"warehouse_get_reused_total",
+   "Item lookups answered within the freshness window.", "counter"},
+  {"warehouse_response_cache_hits_total",
+   "GET requests answered from the response cache.", "counter"},
+  {"warehouse_http_not_modified_total",
+   "GET requests answered with 304 Not Modified.", "counter"},
+};
+
+static_assert(std::size(counter_families) == num_counters);
+
+constexpr family_info gauge_families[] = {
+  {"warehouse_db_mailbox_depth",
+   "Messages waiting in the mailboxes of the database actors.", "gauge"},
+  {"warehouse_controller_in_flight",
+   "Commands waiting for the database actor.", "gauge"},
+  {"warehouse_ws_subscribers", "Connected WebSocket subscribers.", "gauge"},
+  {"warehouse_admission_read_limit", "Concurrency limit for reads.", "gauge"},
+  {"warehouse_admission_read_in_flight",
+   "Admitted reads that wait for a result.", "gauge"},
+  {"warehouse_admission_write_limit", "Concurrency limit for writes.",
+   "gauge"},
+  {"warehouse_admission_write_in_flight",
+   "Admitted writes that wait for a result.", "gauge"},
+};
+
+static_assert(std::size(gauge_families) == num_gauges);
+
+constexpr family_info histogram_families[] = {
+  {"warehouse_db_statement_seconds",
+   "Time the database actors spend on a request or commit.", "histogram"},
+  {"warehouse_http_request_seconds",
+   "Time from receiving an HTTP request until responding.", "histogram"},
+  {"warehouse_controller_command_seconds",
+   "Time from parsing a command until receiving its result.", "histogram"},
+  {"warehouse_ws_backlog_frames",
+   "Frames waiting for a WebSocket subscriber when delivering an event.",
+   "histogram"},
+};
+
+/// Describes a single histogram.
+struct histogram_info {
+  /// Index into `histogram_families`.
+  size_t family;
+  /// The label set, e.g., `op="get"`, or an empty string.
+  std::string_view labels;
+  /// Exponent for the upper bound of the first bucket.
+  int min_exp;
+  /// Converts recorded values to the unit of the metric.
+  double scale;
+};
+
+constexpr int ns_min_exp = 10; // ~1us
+
+constexpr double ns_scale = 1e-9;
+
+constexpr histogram_info histogram_infos[] = {
+  {0, R"(op="get")", ns_min_exp, ns_scale},
+  {0, R"(op="list")", ns_min_exp, ns_scale},
+  {0, R"(op="add")", ns_min_exp, ns_scale},
+  {0, R"(op="inc")", ns_min_exp, ns_scale},
+  {0, R"(op="dec")", ns_min_exp, ns_scale},
+  {0, R"(op="del")", ns_min_exp, ns_scale},
+  {0, R"(op="batch")", ns_min_exp, ns_scale},
+  {0, R"(op="snapshot")", ns_min_exp, ns_scale},
+  {0, R"(op="commit")", ns_min_exp, ns_scale},
+  {1, R"(route="get")", ns_min_exp, ns_scale},
+  {1, R"(route="add")", ns_min_exp, ns_scale},
+  {1, R"(route="inc")", ns_min_exp, ns_scale},
+  {1, R"(route="dec")", ns_min_exp, ns_scale},
+  {1, R"(route="del")", ns_min_exp, ns_scale},
+  {1, R"(route="batch")", ns_min_exp, ns_scale},
+  {1, R"(route="list")", ns_min_exp, ns_scale},
+  {1, R"(route="inventory")", ns_min_exp, ns_scale},
+  {2, R"(protocol="json")", ns_min_exp, ns_scale},
+  {2, R"(protocol="binary")", ns_min_exp, ns_scale},
+  {3, "", 0, 1.0},
+};
+
+static_assert(std::size(histogram_infos) == num_histograms);
+
+/// The cells of a histogram in one shard.
+struct histogram_cells {
+  std::atomic<uint64_t> buckets[num_buckets + 1];
+  std::atomic<uint64_t> sum;
+};
+
+/// The metrics of one thread. Only the owning thread writes to a shard, so
+/// updates need no read-modify-write instructions. Readers may see slightly
+/// outdated values.
+struct alignas(64) shard {
+  std::atomic<uint64_t> counters[num_counters];
+  std::atomic<int64_t> gauges[num_gauges];
+  histogram_cells histograms[num_histograms];
+};
+
+template <class T>
+void bump(std::atomic<T>& cell, T amount) noexcept {
+  cell.store(cell.load(std::memory_order_relaxed) + amount,
+             std::memory_order_relaxed);
+}
+
+/// Owns all shards. Threads that terminate return their shard for reuse,
+/// which keeps its values.
+class registry {
+public:
+  shard* acquire() {
+    std::lock_guard guard{mtx_};
+    if (!idle_.empty()) {
+      auto* result = idle_.back();
+      idle_.pop_back();
+      return result;
+    }
+    return shards_.emplace_back(std::make_unique<shard>()).get();
+  }
+
+  void release(shard* ptr) {
+    std::lock_guard guard{mtx_};
+    idle_.push_back(ptr);
+  }
+
+  /// Calls `fn` for each shard while blocking new threads from acquiring a
+  /// shard.
+  template <class F>
+  void for_each(F&& fn) {
+    std::lock_guard guard{mtx_};
+    for (auto& ptr : shards_)
+      fn(*ptr);
+  }
+
+private:
+  std::mutex mtx_;
+  std::vector<std::unique_ptr<shard>> shards_;
+  std::vector<shard*> idle_;
+};
+
+registry& global_registry() {
+  // Never destroyed, because threads may still release shards during static
+  // destruction.
+  static auto* instance = new registry;
+  return *instance;
+}
+
+/// Binds a shard to the current thread.
+struct shard_handle {
+  shard_handle() : ptr(global_registry().acquire()) {
+    // nop
+  }
+
+  ~shard_handle() {
+    global_registry().release(ptr);
+  }
+
+  shard* ptr;
+};
+
+shard& local_shard() {
+  thread_local shard_handle handle;
+  return *handle.ptr;
+}
+
+size_t bucket_index(uint64_t value, int min_exp) noexcept {
+  if (value <= (uint64_t{1} << min_exp))
+    return 0;
+  // The smallest `b` with `value <= 2^b` is the bit width of `value - 1`.
+  auto width = 64 - __builtin_clzll(value - 1);
+  auto index = static_cast<size_t>(width - min_exp);
+  return index < num_buckets ? index : num_buckets;
+}
+
+void append_header(std::string& out, const family_info& info) {
+  out += "# HELP ";
+  out += info.name;
+  out += ' ';
+  out += info.help;
+  out += "\n# TYPE ";
+  out += info.name;
+  out += ' ';
+  out += info.type;
+  out += '\n';
+}
+
+void append_double(std::string& out, double value) {
+  char buf[32];
+  auto n = std::snprintf(buf, sizeof(buf), "%.9g", value);
+  out.append(buf, static_cast<size_t>(n));
+}
+
+/// Appends a sample like `name_suffix{labels,extra} value`.
+void append_sample(std::string& out, std::string_view name,
+                   std::string_view suffix, std::string_view labels,
+                   std::string_view extra, const std::string& value) {
+  out += name;
+  out += suffix;
+  if (!labels.empty() || !extra.empty()) {
+    out += '{';
+    out += labels;
+    if (!labels.empty() && !extra.empty())
+      out += ',';
+    out += extra;
+    out += '}';
+  }
+  out += ' ';
+  out += value;
+  out += '\n';
+}
+
+} // namespace
+
+void inc(counter id, uint64_t amount) noexcept {
+  bump(local_shard().counters[static_cast<size_t>(id)], amount);
+}
+
+void add(gauge id, int64_t delta) noexcept {
+  bump(local_shard().gauges[static_cast<size_t>(id)], delta);
+}
+
+void observe(histogram id, uint64_t value) noexcept {
+  auto index = static_cast<size_t>(id);
+  auto& cells = local_shard().histograms[index];
+  bump(cells.buckets[bucket_index(value, histogram_infos[index].min_exp)],
+       uint64_t{1});
+  bump(cells.sum, value);
+}
+
+std::string render() {
+  // Merge all shards first.
+  uint64_t counters[num_counters] = {};
+  int64_t gauges[num_gauges] = {};
+  uint64_t buckets[num_histograms][num_buckets + 1] = {};
+  uint64_t sums[num_histograms] = {};
+  global_registry().for_each([&](const shard& sh) {
+    for (size_t i = 0; i < num_counters; ++i)
+      counters[i] += sh.counters[i].load(std::memory_order_relaxed);
+    for (size_t i = 0; i < num_gauges; ++i)
+      gauges[i] += sh.gauges[i].load(std::memory_order_relaxed);
+    for (size_t i = 0; i < num_histograms; ++i) {
+      const auto& cells = sh.histograms[i];
+      for (size_t j = 0; j <= num_buckets; ++j)
+        buckets[i][j] += cells.buckets[j].load(std::memory_order_relaxed);
+      sums[i] += cells.sum.load(std::memory_order_relaxed);
+    }
+  });
+  auto out = std::string{};
+  for (size_t i = 0; i < num_counters; ++i) {
+    append_header(out, counter_families[i]);
+    append_sample(out, counter_families[i].name, "", "", "",
+                  std::to_string(counters[i]));
+  }
+  for (size_t i = 0; i < num_gauges; ++i) {
+    append_header(out, gauge_families[i]);
+    append_sample(out, gauge_families[i].name, "", "", "",
+                  std::to_string(gauges[i]));
+  }
+  auto family = std::size(histogram_families);
+  for (size_t i = 0; i < num_histograms; ++i) {
+    const auto& info = histogram_infos[i];
+    const auto& fam = histogram_families[info.family];
+    if (info.family != family) {
+      family = info.family;
+      append_header(out, fam);
+    }
+    // Prometheus expects cumulative bucket counts.
+    uint64_t total = 0;
+    auto le = std::string{};
+    for (size_t j = 0; j <= num_buckets; ++j) {
+      total += buckets[i][j];
+      le = "le=\"";
+      if (j < num_buckets)
+        append_double(le, static_cast<double>(uint64_t{1}
+                                              << (info.min_exp + j))
+                            * info.scale);
+      else
+        le += "+Inf";
+      le += '"';
+      append_sample(out, fam.name, "_bucket", info.labels, le,
+                    std::to_string(total));
+    }
+    auto sum = std::string{};
+    append_double(sum, static_cast<double>(sums[i]) * info.scale);
+    append_sample(out, fam.name, "_sum", info.labels, "", sum);
+    append_sample(out, fam.name, "_count", info.labels, "",
+                  std::to_string(total));
+  }
+  return out;
+}
+
+} // namespace metrics
@@ -0,0 +1,135 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+// Process-wide metrics in the Prometheus text format. Each thread updates its
+// own shard of counters, gauges and histograms without locks or shared cache
+// lines. Rendering the metrics merges all shards.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace metrics {
+
+/// Identifies a monotonic counter.
+enum class counter {
+  /// Number of HTTP requests that failed with an error response.
+  http_errors,
+  /// Number of commands on the command ports that failed.
+  controller_errors,
+  /// Number of WebSocket subscribers dropped for falling behind.
+  ws_overflows,
+  /// Number of reads rejected by admission control.
+  admission_read_shed,
+  /// Number of writes rejected by admission control.
+  admission_write_shed,
+  /// Number of item lookups that joined a lookup already in flight.
+  get_coalesced,
+  /// Number of item lookups answered within the freshness window.
+  get_reused,
+  /// Number of GET requests answered from the response cache.
+  response_cache_hits,
+  /// Number of cached GET responses that only confirmed the client's copy.
+  http_not_modified,
+};
+
+/// Identifies a gauge. Gauges move by deltas, so each thread reports its own
+/// share and rendering adds up all shares.
+enum class gauge {
+  /// Number of messages waiting in the mailboxes of the database actors.
+  db_mailbox_depth,
+  /// Number of commands that wait for the database actor.
+  controller_in_flight,
+  /// Number of connected WebSocket subscribers.
+  ws_subscribers,
+  /// Current concurrency limit for reads.
+  admission_read_limit,
+  /// Number of admitted reads that wait for a result.
+  admission_read_in_flight,
+  /// Current concurrency limit for writes.
+  admission_write_limit,
+  /// Number of admitted writes that wait for a result.
+  admission_write_in_flight,
+};
+
+/// Identifies a histogram. Latency histograms record nanoseconds.
+enum class histogram {
+  db_get,
+  db_list,
+  db_add,
+  db_inc,
+  db_dec,
+  db_del,
+  db_batch,
+  db_snapshot,
+  db_commit,
+  http_get,
+  http_add,
+  http_inc,
+  http_dec,
+  http_del,
+  http_batch,
+  http_list,
+  http_inventory,
+  cmd_json,
+  cmd_binary,
+  /// Frames that wait for a WebSocket subscriber when delivering an event.
+  ws_backlog,
+};
+
+/// Increments a counter.
+void inc(counter id, uint64_t amount = 1) noexcept;
+
+/// Moves a gauge by `delta`.
+void add(gauge id, int64_t delta) noexcept;
+
+/// Adds a value to a histogram.
+void observe(histogram id, uint64_t value) noexcept;
+
+/// Renders all metrics in the Prometheus text format.
+std::string render();
+
+/// Measures the time from its construction until calling `stop`. Copies
+/// share the start time, so asynchronous callbacks may capture a copy.
+class stopwatch {
+public:
+  using clock_type = std::chrono::steady_clock;
+
+  explicit stopwatch(histogram id) noexcept
+    : id_(id), start_(clock_type::now()) {
+    // nop
+  }
+
+  /// Adds the elapsed time to the histogram.
+  void stop() const noexcept {
+    auto elapsed = clock_type::now() - start_;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+    observe(id_, static_cast<uint64_t>(ns.count()));
+  }
+
+private:
+  histogram id_;
+  clock_type::time_point start_;
+};
+
+/// Adds the time from its construction until its destruction to a histogram.
+class scoped_timer {
+public:
+  explicit scoped_timer(histogram id) noexcept : watch_(id) {
+    // nop
+  }
+
+  scoped_timer(const scoped_timer&) = delete;
+
+  scoped_timer& operator=(const scoped_timer&) = delete;
+
+  ~scoped_timer() {
+    watch_.stop();
+  }
+
+private:
+  stopwatch watch_;
+};
+
+} // namespace metrics
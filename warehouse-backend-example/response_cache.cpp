@@ -0,0 +1,121 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "response_cache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+
+namespace {
+
+// Rough estimate for the bookkeeping overhead of an entry, i.e., the list node
+// and the hash map node.
+constexpr size_t per_entry_overhead = 64;
+
+/// Appends `value` in hexadecimal notation.
+void append_hex(std::string& out, uint64_t value) {
+  char buf[17];
+  auto n = std::snprintf(buf, sizeof(buf), "%llx",
+                         static_cast<unsigned long long>(value));
+  out.append(buf, static_cast<size_t>(n));
+}
+
+} // namespace
+
+response_cache::response_cache(size_t max_bytes, size_t num_shards) {
+  // The shards also track invalidations when storing no responses.
+  num_shards = std::max(num_shards, size_t{1});
+  max_shard_bytes_ = max_bytes / num_shards;
+  shards_.reserve(num_shards);
+  for (size_t i = 0; i < num_shards; ++i)
+    shards_.emplace_back(std::make_unique<shard>());
+}
+
+std::optional<cached_response> response_cache::get(int32_t id) {
+  if (!enabled())
+    return std::nullopt;
+  auto& sh = shard_for(id);
+  std::lock_guard guard{sh.mtx};
+  auto i = sh.index.find(id);
+  if (i == sh.index.end())
+    return std::nullopt;
+  auto pos = i->second;
+  sh.entries.splice(sh.entries.begin(), sh.entries, pos);
+  return pos->value;
+}
+
+uint64_t response_cache::fill_token(int32_t id) {
+  auto& sh = shard_for(id);
+  std::lock_guard guard{sh.mtx};
+  return sh.epoch;
+}
+
+void response_cache::fill(int32_t id, std::string body, uint64_t token) {
+  if (!enabled())
+    return;
+  auto bytes = sizeof(entry) + body.size() + per_entry_overhead;
+  if (bytes > max_shard_bytes_)
+    return;
+  auto etag = make_etag(body);
+  auto& sh = shard_for(id);
+  std::lock_guard guard{sh.mtx};
+  // If a writer touched the shard in the meantime, `body` may be outdated.
+  if (sh.epoch != token || sh.index.count(id) > 0)
+    return;
+  while (sh.bytes + bytes > max_shard_bytes_ && !sh.entries.empty())
+    remove(sh, std::prev(sh.entries.end()));
+  auto value = cached_response{std::move(etag), std::move(body)};
+  sh.entries.push_front(entry{id, std::move(value), bytes});
+  sh.index.emplace(id, sh.entries.begin());
+  sh.bytes += bytes;
+}
+
+void response_cache::invalidate(int32_t id) {
+  auto& sh = shard_for(id);
+  std::lock_guard guard{sh.mtx};
+  ++sh.epoch;
+  if (auto i = sh.index.find(id); i != sh.index.end())
+    remove(sh, i->second);
+}
+
+void response_cache::remove(shard& sh, entry_list::iterator pos) {
+  sh.bytes -= pos->bytes;
+  sh.index.erase(pos->id);
+  sh.entries.erase(pos);
+}
+
+std::string make_etag(std::string_view body) {
+  // FNV-1a (64 bit) is plenty for telling versions of the same item apart.
+  auto hash = uint64_t{0xcbf2'9ce4'8422'2325};
+  for (auto ch : body) {
+    hash ^= static_cast<uint8_t>(ch);
+    hash *= uint64_t{0x100'0000'01b3};
+  }
+  auto result = std::string{};
+  result.reserve(18);
+  result += '"';
+  append_hex(result, hash);
+  result += '"';
+  return result;
+}
+
+bool etag_matches(std::string_view if_none_match, std::string_view etag) {
+  // The field is either `*` or a comma-separated list of entity tags, each
+  // optionally prefixed with `W/`. A weak comparison suffices for GET.
+  while (!if_none_match.empty()) {
+    auto sep = if_none_match.find(',');
+    auto tag = if_none_match.substr(0, sep);
+    while (!tag.empty() && (tag.front() == ' ' || tag.front() == '\t'))
+      tag.remove_prefix(1);
+    while (!tag.empty() && (tag.back() == ' ' || tag.back() == '\t'))
+      tag.remove_suffix(1);
+    if (tag.substr(0, 2) == "W/")
+      tag.remove_prefix(2);
+    if (tag == "*" || tag == etag)
+      return true;
+    if (sep == std::string_view::npos)
+      break;
+    if_none_match.remove_prefix(sep + 1);
+  }
+  return false;
+}
@@ -0,0 +1,99 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// The rendered JSON body of an item and its entity tag.
+struct cached_response {
+  /// A quoted entity tag for the `ETag` header field.
+  std::string etag;
+  /// The JSON representation of the item.
+  std::string body;
+};
+
+/// A thread-safe, size-bounded cache for the rendered JSON bodies of items.
+/// Each entry stores the entity tag of its body (see `make_etag`). The
+/// database actors invalidate entries for each change. Even with a budget
+/// of 0, the cache keeps counting invalidations, so that readers may detect
+/// changes that raced with a lookup via `fill_token`.
+class response_cache {
+public:
+  /// Creates a cache that holds at most `max_bytes` of responses. A budget of
+  /// 0 disables the cache.
+  explicit response_cache(size_t max_bytes, size_t num_shards = 16);
+
+  response_cache(const response_cache&) = delete;
+
+  response_cache& operator=(const response_cache&) = delete;
+
+  /// Returns whether the cache stores any responses at all.
+  bool enabled() const noexcept {
+    return max_shard_bytes_ > 0;
+  }
+
+  /// Retrieves the response for an item.
+  /// @returns the response if cached, `std::nullopt` otherwise.
+  std::optional<cached_response> get(int32_t id);
+
+  /// Returns a token for calling `fill` after reading `id` from the database.
+  /// Must be called *before* reading from the database. The token changes
+  /// whenever a writer invalidates `id`, but may also change for other IDs.
+  uint64_t fill_token(int32_t id);
+
+  /// Adds the rendered `body` of the item with ID `id` unless a writer
+  /// invalidated any entry of the same shard since obtaining `token`.
+  void fill(int32_t id, std::string body, uint64_t token);
+
+  /// Drops the response for an item after changing or deleting it.
+  void invalidate(int32_t id);
+
+private:
+  struct entry {
+    int32_t id;
+    cached_response value;
+    size_t bytes;
+  };
+
+  using entry_list = std::list<entry>;
+
+  struct shard {
+    std::mutex mtx;
+    // The front is the most recently used entry.
+    entry_list entries;
+    std::unordered_map<int32_t, entry_list::iterator> index;
+    size_t bytes = 0;
+    // Incremented on each invalidation to detect races with readers.
+    uint64_t epoch = 0;
+  };
+
+  shard& shard_for(int32_t id) noexcept {
+    return *shards_[static_cast<uint32_t>(id) % shards_.size()];
+  }
+
+  // Requires the shard lock.
+  void remove(shard& sh, entry_list::iterator pos);
+
+  size_t max_shard_bytes_ = 0;
+  std::vector<std::unique_ptr<shard>> shards_;
+};
+
+/// A smart pointer to a response cache.
+using response_cache_ptr = std::shared_ptr<response_cache>;
+
+/// Returns a quoted entity tag for the rendered `body` of an item. The tag only
+/// depends on the body, so it survives evictions and restarts of the server.
+std::string make_etag(std::string_view body);
+
+/// Checks whether the value of an `If-None-Match` header field matches
+/// `etag`, i.e., whether a client already has the current representation.
+bool etag_matches(std::string_view if_none_match, std::string_view etag);
@@ -0,0 +1,173 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "snapshot_file.hpp"
+
+#include <caf/error.hpp>
+#include <caf/sec.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+namespace {
+
+// Identifies snapshot files and their layout version.
+constexpr std::string_view snapshot_magic = "WHSNAP01";
+
+// Layout of the header: magic (8 bytes), record size (4 bytes), reserved
+// (4 bytes), number of records (8 bytes) and arena size (8 bytes). All
+// integers use the byte order of the machine.
+struct header {
+  char magic[8];
+  uint32_t record_size;
+  uint32_t reserved;
+  uint64_t num_records;
+  uint64_t arena_size;
+};
+
+static_assert(sizeof(header) == 32);
+
+// Size of the chunks for writing a snapshot.
+constexpr size_t write_chunk_size = 65'536;
+
+template <class T>
+void append_pod(std::string& buf, const T& value) {
+  char tmp[sizeof(T)];
+  std::memcpy(tmp, &value, sizeof(T));
+  buf.append(tmp, sizeof(T));
+}
+
+bool write_all(std::FILE* file, const std::string& buf) {
+  return std::fwrite(buf.data(), 1, buf.size(), file) == buf.size();
+}
+
+} // namespace
+
+ec write_snapshot_file(const std::string& path,
+                       const std::vector<item>& items) {
+  auto tmp_path = path + ".tmp";
+  auto* out = std::fopen(tmp_path.c_str(), "wb");
+  if (out == nullptr)
+    return ec::database_inaccessible;
+  auto hdr = header{};
+  std::memcpy(hdr.magic, snapshot_magic.data(), sizeof(hdr.magic));
+  hdr.record_size = sizeof(mapped_snapshot::record);
+  hdr.num_records = items.size();
+  for (const auto& value : items)
+    hdr.arena_size += value.name.size();
+  auto buf = std::string{};
+  append_pod(buf, hdr);
+  auto ok = hdr.arena_size <= std::numeric_limits<uint32_t>::max();
+  // Records first, then the arena.
+  uint32_t offset = 0;
+  for (size_t i = 0; i < items.size() && ok; ++i) {
+    const auto& value = items[i];
+    auto rec = mapped_snapshot::record{};
+    rec.id = value.id;
+    rec.price = value.price;
+    rec.available = value.available;
+    rec.name_offset = offset;
+    rec.name_size = static_cast<uint32_t>(value.name.size());
+    offset += rec.name_size;
+    append_pod(buf, rec);
+    if (buf.size() >= write_chunk_size) {
+      ok = write_all(out, buf);
+      buf.clear();
+    }
+  }
+  for (size_t i = 0; i < items.size() && ok; ++i) {
+    buf += items[i].name;
+    if (buf.size() >= write_chunk_size) {
+      ok = write_all(out, buf);
+      buf.clear();
+    }
+  }
+  ok = ok && write_all(out, buf) && std::fflush(out) == 0;
+  ok = std::fclose(out) == 0 && ok;
+  if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    std::remove(tmp_path.c_str());
+    return ec::database_inaccessible;
+  }
+  return ec::nil;
+}
+
+mapped_snapshot::~mapped_snapshot() {
+#ifndef _WIN32
+  if (addr_ != nullptr)
+    munmap(addr_, file_size_);
+#endif
+}
+
+caf::expected<mapped_snapshot_ptr>
+mapped_snapshot::open(const std::string& path) {
+#ifdef _WIN32
+  static_cast<void>(path);
+  return caf::make_error(caf::sec::runtime_error,
+                         "snapshot files require mmap");
+#else
+  auto fail = [](const char* what) {
+    return caf::make_error(caf::sec::runtime_error, what);
+  };
+  auto fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return fail("could not open snapshot file");
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < 0
+      || static_cast<size_t>(info.st_size) < sizeof(header)) {
+    ::close(fd);
+    return fail("snapshot file too small");
+  }
+  auto file_size = static_cast<size_t>(info.st_size);
+  auto* addr = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after closing the file descriptor.
+  ::close(fd);
+  if (addr == MAP_FAILED)
+    return fail("could not map snapshot file");
+  // Take ownership of the mapping before checking anything else.
+  auto result = std::shared_ptr<mapped_snapshot>{new mapped_snapshot};
+  result->addr_ = addr;
+  result->file_size_ = file_size;
+  auto* bytes = static_cast<const std::byte*>(addr);
+  header hdr;
+  std::memcpy(&hdr, bytes, sizeof(header));
+  if (std::string_view{hdr.magic, sizeof(hdr.magic)} != snapshot_magic
+      || hdr.record_size != sizeof(record))
+    return fail("not a snapshot file");
+  auto max_records = (file_size - sizeof(header)) / sizeof(record);
+  if (hdr.num_records > max_records
+      || hdr.arena_size
+           != file_size - sizeof(header) - hdr.num_records * sizeof(record))
+    return fail("truncated snapshot file");
+  result->size_ = hdr.num_records;
+  result->records_ = bytes + sizeof(header);
+  result->arena_ = reinterpret_cast<const char*>(
+    result->records_ + hdr.num_records * sizeof(record));
+  result->arena_size_ = hdr.arena_size;
+  return mapped_snapshot_ptr{std::move(result)};
+#endif
+}
+
+mapped_snapshot::record mapped_snapshot::at(size_t index) const noexcept {
+  record result;
+  std::memcpy(&result, records_ + index * sizeof(record), sizeof(record));
+  return result;
+}
+
+std::string_view mapped_snapshot::name(const record& rec) const noexcept {
+  if (rec.name_offset > arena_size_
+      || rec.name_size > arena_size_ - rec.name_offset)
+    return {};
+  return {arena_ + rec.name_offset, rec.name_size};
+}
+
+item mapped_snapshot::get(size_t index) const {
+  auto rec = at(index);
+  return item{rec.id, rec.price, rec.available, std::string{name(rec)}};
+}
@@ -0,0 +1,80 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "ec.hpp"
+#include "item.hpp"
+
+#include <caf/expected.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Writes `items` to a snapshot file. The file starts with a 32-byte header,
+/// followed by one fixed-width record per item and an arena with all names.
+/// Writes to a temporary file first and then replaces `path`, so readers
+/// never see a partial snapshot.
+/// @pre `items` is sorted by ID.
+/// @returns `ec::nil` on success, an error code otherwise.
+ec write_snapshot_file(const std::string& path, const std::vector<item>& items);
+
+/// A read-only, memory-mapped snapshot file.
+class mapped_snapshot {
+public:
+  /// A single item in the file.
+  struct record {
+    int32_t id;
+    int32_t price;
+    int32_t available;
+    /// Position of the name in the arena.
+    uint32_t name_offset;
+    uint32_t name_size;
+  };
+
+  static_assert(sizeof(record) == 20);
+
+  mapped_snapshot(const mapped_snapshot&) = delete;
+
+  mapped_snapshot& operator=(const mapped_snapshot&) = delete;
+
+  ~mapped_snapshot();
+
+  /// Maps the file at `path` and checks its header. Does not read any record,
+  /// so the cost does not depend on the number of items.
+  static caf::expected<std::shared_ptr<const mapped_snapshot>>
+  open(const std::string& path);
+
+  /// Returns the number of items.
+  size_t size() const noexcept {
+    return size_;
+  }
+
+  /// Returns the record at `index`.
+  /// @pre `index < size()`
+  record at(size_t index) const noexcept;
+
+  /// Returns the name of an item. Returns an empty string for names that
+  /// point beyond the arena.
+  std::string_view name(const record& rec) const noexcept;
+
+  /// Returns the item at `index`, including its name.
+  /// @pre `index < size()`
+  item get(size_t index) const;
+
+private:
+  mapped_snapshot() = default;
+
+  void* addr_ = nullptr;
+  size_t file_size_ = 0;
+  size_t size_ = 0;
+  const std::byte* records_ = nullptr;
+  const char* arena_ = nullptr;
+  size_t arena_size_ = 0;
+};
+
+/// A smart pointer to a mapped snapshot.
+using mapped_snapshot_ptr = std::shared_ptr<const mapped_snapshot>;
@@ -0,0 +1,106 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "snapshot_writer.hpp"
+
+#include "applog.hpp"
+#include "snapshot_file.hpp"
+#include "subscription.hpp"
+#include "types.hpp"
+
+#include <caf/actor_from_state.hpp>
+#include <caf/actor_system.hpp>
+#include <caf/error.hpp>
+#include <caf/event_based_actor.hpp>
+#include <caf/scoped_actor.hpp>
+
+using namespace std::literals;
+
+namespace {
+
+// Maximum time for reading the state of all items.
+constexpr auto snapshot_timeout = 60s;
+
+/// Writes a snapshot file after each interval.
+struct snapshot_writer_state {
+  snapshot_writer_state(caf::event_based_actor* self_ptr,
+                        database_actor db_actor, std::string file_path,
+                        caf::timespan write_interval)
+    : self(self_ptr),
+      db(std::move(db_actor)),
+      path(std::move(file_path)),
+      interval(write_interval) {
+    // Stop if the database actor terminates.
+    self->monitor(db, [this](const caf::error& reason) {
+      applog::debug("snapshot writer lost the database actor: {}", reason);
+      self->quit(reason);
+    });
+  }
+
+  caf::behavior make_behavior() {
+    schedule();
+    return {
+      // Writes a snapshot right away, in addition to the periodic writes.
+      [this](snapshot_atom) { write(false); },
+    };
+  }
+
+  void schedule() {
+    self->run_delayed(interval, [this] { write(true); });
+  }
+
+  void write(bool periodic) {
+    self->mail(snapshot_atom_v, subscription_filter{})
+      .request(db, snapshot_timeout)
+      .then(
+        [this, periodic](const item_snapshot& snapshot) {
+          if (auto err = write_snapshot_file(path, snapshot.items);
+              err != ec::nil)
+            applog::error("failed to write the snapshot file: {}",
+                          to_string(err));
+          else
+            applog::debug("wrote {} items to the snapshot file",
+                          snapshot.items.size());
+          if (periodic)
+            schedule();
+        },
+        [this, periodic](const caf::error& what) {
+          applog::error("failed to read a snapshot: {}", what);
+          if (periodic)
+            schedule();
+        });
+  }
+
+  caf::event_based_actor* self;
+  database_actor db;
+  std::string path;
+  caf::timespan interval;
+};
+
+} // namespace
+
+caf::actor spawn_snapshot_writer(caf::actor_system& sys,
+                                 database_actor db_actor, std::string path,
+                                 caf::timespan interval) {
+  // Note: writing the file blocks, so the writer runs in its own thread.
+  using caf::actor_from_state;
+  using caf::detached;
+  return sys.spawn<detached>(actor_from_state<snapshot_writer_state>,
+                             std::move(db_actor), std::move(path), interval);
+}
+
+ec save_snapshot(caf::actor_system& sys, const database_actor& db_actor,
+                 const std::string& path) {
+  auto result = ec::nil;
+  caf::scoped_actor self{sys};
+  self->mail(snapshot_atom_v, subscription_filter{})
+    .request(db_actor, snapshot_timeout)
+    .receive(
+      [&result, &path](const item_snapshot& snapshot) {
+        result = write_snapshot_file(path, snapshot.items);
+      },
+      [&result](const caf::error& what) {
+        applog::error("failed to read a snapshot: {}", what);
+        result = ec::database_inaccessible;
+      });
+  return result;
+}
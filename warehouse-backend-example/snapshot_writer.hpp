@@ -0,0 +1,25 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "database_actor.hpp"
+#include "ec.hpp"
+
+#include <caf/actor.hpp>
+#include <caf/fwd.hpp>
+#include <caf/timespan.hpp>
+
+#include <string>
+
+/// Spawns a detached actor that writes the committed state of all items to a
+/// snapshot file at `path` every `interval`. The actor terminates when
+/// `db_actor` terminates.
+caf::actor spawn_snapshot_writer(caf::actor_system& sys,
+                                 database_actor db_actor, std::string path,
+                                 caf::timespan interval);
+
+/// Writes the committed state of all items to a snapshot file at `path` and
+/// blocks until done.
+/// @returns `ec::nil` on success, an error code otherwise.
+ec save_snapshot(caf::actor_system& sys, const database_actor& db_actor,
+                 const std::string& path);
@@ -0,0 +1,336 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "sqlite_database.hpp"
+
+#include <caf/sec.hpp>
+
+#include <sqlite3.h>
+
+#include <utility>
+
+namespace {
+
+constexpr const char* count_query = "SELECT COUNT(*) FROM items";
+
+constexpr const char* get_query = R"_(
+  SELECT id, name, price, available
+  FROM items WHERE id = ?
+)_";
+
+constexpr const char* range_query = R"_(
+  SELECT id, name, price, available
+  FROM items WHERE id BETWEEN ? AND ?
+  ORDER BY id LIMIT ?
+)_";
+
+constexpr const char* insert_query = R"_(
+  INSERT INTO items (id, name, price, available)
+  VALUES (?, ?, ?, ?)
+)_";
+
+// Skip the update if the count would no longer fit into 32 bits.
+constexpr const char* inc_query = R"_(
+  UPDATE items
+  SET available = available + ?
+  WHERE id = ? AND available <= 2147483647 - ?
+  RETURNING id, name, price, available
+)_";
+
+// Decrement `amount` but never go below 0.
+constexpr const char* dec_query = R"_(
+  UPDATE items
+  SET available = CASE WHEN available < ? THEN 0 ELSE available - ? END
+  WHERE id = ?
+  RETURNING id, name, price, available
+)_";
+
+constexpr const char* del_query = R"_(
+  DELETE FROM items WHERE id = ?
+  RETURNING id, name, price, available
+)_";
+
+// First SQLite version with support for `RETURNING`.
+constexpr int min_sqlite_version = 3'035'000;
+
+// Acquire the write lock right away to avoid lock upgrades in the middle of a
+// transaction.
+constexpr const char* begin_query = "BEGIN IMMEDIATE";
+
+constexpr const char* commit_query = "COMMIT";
+
+constexpr const char* rollback_query = "ROLLBACK";
+
+constexpr const char* savepoint_query = "SAVEPOINT batch";
+
+constexpr const char* release_query = "RELEASE batch";
+
+constexpr const char* rollback_to_query = "ROLLBACK TO batch";
+
+/// Resets a prepared statement when leaving the scope, making it ready for the
+/// next call.
+class stmt_guard {
+public:
+  explicit stmt_guard(sqlite3_stmt* stmt) : stmt_(stmt) {
+    // nop
+  }
+
+  stmt_guard(const stmt_guard&) = delete;
+
+  stmt_guard& operator=(const stmt_guard&) = delete;
+
+  ~stmt_guard() {
+    sqlite3_reset(stmt_);
+  }
+
+private:
+  sqlite3_stmt* stmt_;
+};
+
+/// Reads an item from the current row of a statement that selects or returns
+/// `id, name, price, available`.
+void read_item(sqlite3_stmt* stmt, item& result) {
+  result.id = sqlite3_column_int(stmt, 0);
+  result.name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+  result.price = sqlite3_column_int(stmt, 2);
+  result.available = sqlite3_column_int(stmt, 3);
+}
+
+/// Steps a mutation with a `RETURNING` clause that affects at most one row.
+ec step_returning(sqlite3_stmt* stmt, item& result) {
+  switch (sqlite3_step(stmt)) {
+    case SQLITE_ROW:
+      read_item(stmt, result);
+      // Run the statement to completion before the guard resets it.
+      if (sqlite3_step(stmt) != SQLITE_DONE)
+        return ec::database_inaccessible;
+      return ec::nil;
+    case SQLITE_DONE:
+      return ec::no_such_item;
+    default:
+      return ec::database_inaccessible;
+  }
+}
+
+/// Runs a statement without parameters or results.
+ec run_once(sqlite3_stmt* stmt) {
+  if (stmt == nullptr)
+    return ec::database_inaccessible;
+  stmt_guard guard{stmt};
+  if (sqlite3_step(stmt) != SQLITE_DONE)
+    return ec::database_inaccessible;
+  return ec::nil;
+}
+
+} // namespace
+
+sqlite_database::~sqlite_database() {
+  for (auto* stmt : {count_stmt_, get_stmt_, range_stmt_, insert_stmt_,
+                     inc_stmt_, dec_stmt_, del_stmt_, begin_stmt_,
+                     commit_stmt_, rollback_stmt_, savepoint_stmt_,
+                     release_stmt_, rollback_to_stmt_})
+    sqlite3_finalize(stmt); // Passing nullptr is a harmless no-op.
+  if (db_ != nullptr)
+    sqlite3_close(db_);
+}
+
+caf::error sqlite_database::open() {
+  if (sqlite3_libversion_number() < min_sqlite_version)
+    return make_error(caf::sec::runtime_error, "requires SQLite 3.35+");
+  // Open the database file.
+  auto flags = opts_.read_only ? SQLITE_OPEN_READONLY
+                               : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+  if (sqlite3_open_v2(db_file_.c_str(), &db_, flags, nullptr) != SQLITE_OK)
+    return make_error(caf::sec::runtime_error, "could not open database");
+  // Read-only connections rely on the writer for setting up the database.
+  if (!opts_.read_only) {
+    if (auto err = init_schema())
+      return err;
+  }
+  // Prepare all statements once. They live as long as the connection.
+  std::pair<const char*, sqlite3_stmt**> statements[] = {
+    {count_query, &count_stmt_},   {get_query, &get_stmt_},
+    {range_query, &range_stmt_},
+    {insert_query, &insert_stmt_}, {inc_query, &inc_stmt_},
+    {dec_query, &dec_stmt_},       {del_query, &del_stmt_},
+    {begin_query, &begin_stmt_},   {commit_query, &commit_stmt_},
+    {rollback_query, &rollback_stmt_}, {savepoint_query, &savepoint_stmt_},
+    {release_query, &release_stmt_},   {rollback_to_query, &rollback_to_stmt_},
+  };
+  for (auto [query, stmt] : statements) {
+    if (sqlite3_prepare_v3(db_, query, -1, SQLITE_PREPARE_PERSISTENT, stmt,
+                           nullptr)
+        != SQLITE_OK)
+      return make_error(caf::sec::runtime_error, sqlite3_errmsg(db_));
+  }
+  return caf::error{};
+}
+
+caf::error sqlite_database::init_schema() {
+  // Select the journal mode. SQLite stores WAL mode in the database file, so
+  // we always set the mode explicitly.
+  const char* journal_mode = opts_.wal ? "PRAGMA journal_mode=WAL"
+                                       : "PRAGMA journal_mode=DELETE";
+  if (sqlite3_exec(db_, journal_mode, nullptr, nullptr, nullptr) != SQLITE_OK)
+    return make_error(caf::sec::runtime_error, sqlite3_errmsg(db_));
+  // Create the table if it does not exist.
+  const char* create_table = "CREATE TABLE IF NOT EXISTS items ("
+                             "id INTEGER PRIMARY KEY,"
+                             "name TEXT NOT NULL,"
+                             "price INTEGER NOT NULL,"
+                             "available INTEGER NOT NULL)";
+  char* err_msg = nullptr;
+  if (sqlite3_exec(db_, create_table, nullptr, nullptr, &err_msg)
+      != SQLITE_OK) {
+    auto msg = std::string{err_msg};
+    sqlite3_free(err_msg);
+    return make_error(caf::sec::runtime_error, std::move(msg));
+  }
+  return caf::error{};
+}
+
+int sqlite_database::count() {
+  if (count_stmt_ == nullptr)
+    return 0;
+  stmt_guard guard{count_stmt_};
+  if (sqlite3_step(count_stmt_) != SQLITE_ROW)
+    return 0;
+  return sqlite3_column_int(count_stmt_, 0);
+}
+
+std::optional<item> sqlite_database::get(int32_t id) {
+  if (get_stmt_ == nullptr)
+    return std::nullopt;
+  stmt_guard guard{get_stmt_};
+  if (sqlite3_bind_int(get_stmt_, 1, id) != SQLITE_OK)
+    return std::nullopt;
+  if (sqlite3_step(get_stmt_) != SQLITE_ROW)
+    return std::nullopt;
+  item result;
+  read_item(get_stmt_, result);
+  return result;
+}
+
+ec sqlite_database::range(int32_t first, int32_t last,
+                          std::vector<item>& result, int limit) {
+  if (range_stmt_ == nullptr)
+    return ec::database_inaccessible;
+  stmt_guard guard{range_stmt_};
+  if (sqlite3_bind_int(range_stmt_, 1, first) != SQLITE_OK
+      || sqlite3_bind_int(range_stmt_, 2, last) != SQLITE_OK
+      || sqlite3_bind_int(range_stmt_, 3, limit) != SQLITE_OK)
+    return ec::database_inaccessible;
+  for (;;) {
+    switch (sqlite3_step(range_stmt_)) {
+      case SQLITE_ROW:
+        read_item(range_stmt_, result.emplace_back());
+        break;
+      case SQLITE_DONE:
+        return ec::nil;
+      default:
+        return ec::database_inaccessible;
+    }
+  }
+}
+
+ec sqlite_database::get_many(const std::vector<int32_t>& ids,
+                             std::vector<item>& result) {
+  if (get_stmt_ == nullptr)
+    return ec::database_inaccessible;
+  for (auto id : ids) {
+    stmt_guard guard{get_stmt_};
+    if (sqlite3_bind_int(get_stmt_, 1, id) != SQLITE_OK)
+      return ec::database_inaccessible;
+    switch (sqlite3_step(get_stmt_)) {
+      case SQLITE_ROW:
+        read_item(get_stmt_, result.emplace_back());
+        break;
+      case SQLITE_DONE:
+        break;
+      default:
+        return ec::database_inaccessible;
+    }
+  }
+  return ec::nil;
+}
+
+ec sqlite_database::insert(const item& new_item) {
+  if (insert_stmt_ == nullptr)
+    return ec::database_inaccessible;
+  stmt_guard guard{insert_stmt_};
+  if (sqlite3_bind_int(insert_stmt_, 1, new_item.id) != SQLITE_OK
+      || sqlite3_bind_text(insert_stmt_, 2, new_item.name.c_str(), -1,
+                           SQLITE_STATIC)
+           != SQLITE_OK
+      || sqlite3_bind_int(insert_stmt_, 3, new_item.price) != SQLITE_OK
+      || sqlite3_bind_int(insert_stmt_, 4, new_item.available) != SQLITE_OK)
+    return ec::database_inaccessible;
+  if (sqlite3_step(insert_stmt_) != SQLITE_DONE)
+    return ec::key_already_exists;
+  return ec::nil;
+}
+
+ec sqlite_database::inc(int32_t id, int32_t amount, item& updated) {
+  if (amount <= 0)
+    return ec::invalid_argument;
+  if (inc_stmt_ == nullptr)
+    return ec::database_inaccessible;
+  stmt_guard guard{inc_stmt_};
+  if (sqlite3_bind_int(inc_stmt_, 1, amount) != SQLITE_OK
+      || sqlite3_bind_int(inc_stmt_, 2, id) != SQLITE_OK
+      || sqlite3_bind_int(inc_stmt_, 3, amount) != SQLITE_OK)
+    return ec::database_inaccessible;
+  auto err = step_returning(inc_stmt_, updated);
+  // Tell an overflow apart from a missing item.
+  if (err == ec::no_such_item && get(id))
+    return ec::invalid_argument;
+  return err;
+}
+
+ec sqlite_database::dec(int32_t id, int32_t amount, item& updated) {
+  if (amount <= 0)
+    return ec::invalid_argument;
+  if (dec_stmt_ == nullptr)
+    return ec::database_inaccessible;
+  stmt_guard guard{dec_stmt_};
+  if (sqlite3_bind_int(dec_stmt_, 1, amount) != SQLITE_OK
+      || sqlite3_bind_int(dec_stmt_, 2, amount) != SQLITE_OK
+      || sqlite3_bind_int(dec_stmt_, 3, id) != SQLITE_OK)
+    return ec::database_inaccessible;
+  return step_returning(dec_stmt_, updated);
+}
+
+ec sqlite_database::del(int32_t id, item& removed) {
+  if (del_stmt_ == nullptr)
+    return ec::database_inaccessible;
+  stmt_guard guard{del_stmt_};
+  if (sqlite3_bind_int(del_stmt_, 1, id) != SQLITE_OK)
+    return ec::database_inaccessible;
+  return step_returning(del_stmt_, removed);
+}
+
+ec sqlite_database::begin() {
+  return run_once(begin_stmt_);
+}
+
+ec sqlite_database::commit() {
+  return run_once(commit_stmt_);
+}
+
+ec sqlite_database::rollback() {
+  return run_once(rollback_stmt_);
+}
+
+ec sqlite_database::savepoint() {
+  return run_once(savepoint_stmt_);
+}
+
+ec sqlite_database::release_savepoint() {
+  return run_once(release_stmt_);
+}
+
+ec sqlite_database::rollback_to_savepoint() {
+  // Rolling back to a savepoint keeps it open, so we release it afterwards.
+  if (auto err = run_once(rollback_to_stmt_); err != ec::nil)
+    return err;
+  return run_once(release_stmt_);
+}
@@ -0,0 +1,93 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "database.hpp"
+#include "ec.hpp"
+#include "item.hpp"
+
+#include <caf/error.hpp>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+extern "C" {
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+} // extern "C"
+
+/// Stores items in an SQLite database file.
+class sqlite_database : public database {
+public:
+  sqlite_database(std::string db_file, database_options opts = {})
+    : db_file_(std::move(db_file)), opts_(opts) {
+    // nop
+  }
+
+  sqlite_database(const sqlite_database&) = delete;
+
+  sqlite_database& operator=(const sqlite_database&) = delete;
+
+  ~sqlite_database() override;
+
+  /// Opens the database file, creates the table if it does not exist and
+  /// prepares all statements for the lifetime of the connection.
+  /// @note Requires SQLite 3.35 or newer for `RETURNING` clauses.
+  caf::error open() override;
+
+  int count() override;
+
+  std::optional<item> get(int32_t id) override;
+
+  ec range(int32_t first, int32_t last, std::vector<item>& result,
+           int limit = -1) override;
+
+  ec get_many(const std::vector<int32_t>& ids,
+              std::vector<item>& result) override;
+
+  ec insert(const item& new_item) override;
+
+  ec inc(int32_t id, int32_t amount, item& updated) override;
+
+  ec dec(int32_t id, int32_t amount, item& updated) override;
+
+  ec del(int32_t id, item& removed) override;
+
+  ec begin() override;
+
+  ec commit() override;
+
+  ec rollback() override;
+
+  ec savepoint() override;
+
+  ec release_savepoint() override;
+
+  ec rollback_to_savepoint() override;
+
+private:
+  /// Selects the journal mode and creates the table if it does not exist.
+  caf::error init_schema();
+
+  std::string db_file_;
+  database_options opts_;
+  sqlite3* db_ = nullptr;
+  // Prepared statements. Each member function only resets, binds and steps.
+  sqlite3_stmt* count_stmt_ = nullptr;
+  sqlite3_stmt* get_stmt_ = nullptr;
+  sqlite3_stmt* range_stmt_ = nullptr;
+  sqlite3_stmt* insert_stmt_ = nullptr;
+  sqlite3_stmt* inc_stmt_ = nullptr;
+  sqlite3_stmt* dec_stmt_ = nullptr;
+  sqlite3_stmt* del_stmt_ = nullptr;
+  sqlite3_stmt* begin_stmt_ = nullptr;
+  sqlite3_stmt* commit_stmt_ = nullptr;
+  sqlite3_stmt* rollback_stmt_ = nullptr;
+  sqlite3_stmt* savepoint_stmt_ = nullptr;
+  sqlite3_stmt* release_stmt_ = nullptr;
+  sqlite3_stmt* rollback_to_stmt_ = nullptr;
+};
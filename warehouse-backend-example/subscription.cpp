@@ -0,0 +1,201 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "subscription.hpp"
+
+#include <caf/error.hpp>
+#include <caf/sec.hpp>
+
+#include <algorithm>
+#include <charconv>
+
+namespace {
+
+// Limits the number of IDs plus ranges per filter.
+constexpr size_t max_filter_entries = 4096;
+
+bool parse_int(std::string_view str, int32_t& result) {
+  auto* first = str.data();
+  auto* last = str.data() + str.size();
+  auto [ptr, err] = std::from_chars(first, last, result);
+  return err == std::errc{} && ptr == last;
+}
+
+/// Calls `fn` for each non-empty element of a comma-separated list.
+template <class F>
+bool for_each_element(std::string_view str, F&& fn) {
+  while (!str.empty()) {
+    auto pos = str.find(',');
+    auto element = str.substr(0, pos);
+    if (!element.empty() && !fn(element))
+      return false;
+    if (pos == std::string_view::npos)
+      break;
+    str.remove_prefix(pos + 1);
+  }
+  return true;
+}
+
+bool parse_range(std::string_view str, id_range& result) {
+  // Skip the first character to allow a negative start of the range.
+  auto pos = str.find('-', 1);
+  if (pos == std::string_view::npos)
+    return false;
+  return parse_int(str.substr(0, pos), result.first)
+         && parse_int(str.substr(pos + 1), result.last)
+         && result.first <= result.last;
+}
+
+/// Sorts and merges ranges and drops IDs that are covered by a range. Each
+/// item then matches at most one entry of the filter.
+void normalize(subscription_filter& filter) {
+  auto& ranges = filter.ranges;
+  std::sort(ranges.begin(), ranges.end(),
+            [](const id_range& x, const id_range& y) {
+              return x.first < y.first;
+            });
+  auto merged = std::vector<id_range>{};
+  for (const auto& range : ranges) {
+    if (!merged.empty()
+        && static_cast<int64_t>(range.first)
+             <= static_cast<int64_t>(merged.back().last) + 1)
+      merged.back().last = std::max(merged.back().last, range.last);
+    else
+      merged.push_back(range);
+  }
+  ranges = std::move(merged);
+  auto& ids = filter.ids;
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  auto covered = [&ranges](int32_t id) {
+    auto i = std::upper_bound(ranges.begin(), ranges.end(), id,
+                              [](int32_t x, const id_range& range) {
+                                return x < range.first;
+                              });
+    return i != ranges.begin() && id <= std::prev(i)->last;
+  };
+  ids.erase(std::remove_if(ids.begin(), ids.end(), covered), ids.end());
+}
+
+} // namespace
+
+bool subscription_filter::matches(int32_t id) const noexcept {
+  if (matches_all())
+    return true;
+  if (std::binary_search(ids.begin(), ids.end(), id))
+    return true;
+  auto i = std::upper_bound(ranges.begin(), ranges.end(), id,
+                            [](int32_t x, const id_range& range) {
+                              return x < range.first;
+                            });
+  return i != ranges.begin() && id <= std::prev(i)->last;
+}
+
+caf::expected<subscription_filter>
+make_subscription_filter(const caf::uri::query_map& query) {
+  auto invalid = [](const char* what) {
+    return caf::make_error(caf::sec::invalid_argument, what);
+  };
+  subscription_filter result;
+  size_t entries = 0;
+  if (auto i = query.find("ids"); i != query.end()) {
+    auto ok = for_each_element(i->second, [&](std::string_view str) {
+      int32_t id = 0;
+      if (!parse_int(str, id) || ++entries > max_filter_entries)
+        return false;
+      result.ids.push_back(id);
+      return true;
+    });
+    if (!ok)
+      return invalid("invalid or too many ids");
+  }
+  if (auto i = query.find("ranges"); i != query.end()) {
+    auto ok = for_each_element(i->second, [&](std::string_view str) {
+      id_range range;
+      if (!parse_range(str, range) || ++entries > max_filter_entries)
+        return false;
+      result.ranges.push_back(range);
+      return true;
+    });
+    if (!ok)
+      return invalid("invalid or too many ranges");
+  }
+  if (auto i = query.find("snapshot"); i != query.end()) {
+    if (i->second == "true")
+      result.snapshot = true;
+    else if (i->second != "false")
+      return invalid("snapshot must be true or false");
+  }
+  normalize(result);
+  return result;
+}
+
+void subscription_table::add(subscriber_id sub,
+                             const subscription_filter& filter) {
+  if (filter.matches_all()) {
+    all_.push_back(sub);
+    return;
+  }
+  for (auto id : filter.ids)
+    by_id_[id].push_back(sub);
+  for (const auto& range : filter.ranges)
+    ranges_.push_back(range_entry{range, sub});
+  if (!filter.ranges.empty())
+    rebuild_pieces();
+}
+
+void subscription_table::remove(subscriber_id sub,
+                                const subscription_filter& filter) {
+  auto erase = [sub](std::vector<subscriber_id>& subs) {
+    subs.erase(std::remove(subs.begin(), subs.end(), sub), subs.end());
+  };
+  if (filter.matches_all()) {
+    erase(all_);
+    return;
+  }
+  for (auto id : filter.ids) {
+    if (auto i = by_id_.find(id); i != by_id_.end()) {
+      erase(i->second);
+      if (i->second.empty())
+        by_id_.erase(i);
+    }
+  }
+  if (filter.ranges.empty())
+    return;
+  ranges_.erase(std::remove_if(ranges_.begin(), ranges_.end(),
+                               [sub](const range_entry& entry) {
+                                 return entry.sub == sub;
+                               }),
+                ranges_.end());
+  rebuild_pieces();
+}
+
+void subscription_table::rebuild_pieces() {
+  // Sweep over all boundaries in ascending order. Each range enters the set of
+  // active subscribers at its first ID and leaves it after its last ID.
+  struct boundary {
+    int64_t pos;
+    bool enter;
+    subscriber_id sub;
+  };
+  auto boundaries = std::vector<boundary>{};
+  boundaries.reserve(ranges_.size() * 2);
+  for (const auto& entry : ranges_) {
+    boundaries.push_back({entry.range.first, true, entry.sub});
+    boundaries.push_back({int64_t{entry.range.last} + 1, false, entry.sub});
+  }
+  std::sort(boundaries.begin(), boundaries.end(),
+            [](const boundary& x, const boundary& y) { return x.pos < y.pos; });
+  pieces_.clear();
+  auto active = std::vector<subscriber_id>{};
+  for (auto i = boundaries.begin(); i != boundaries.end();) {
+    auto pos = i->pos;
+    for (; i != boundaries.end() && i->pos == pos; ++i) {
+      if (i->enter)
+        active.push_back(i->sub);
+      else
+        active.erase(std::find(active.begin(), active.end(), i->sub));
+    }
+    // Empty pieces end the piece before them.
+    pieces_.emplace(pos, active);
+  }
+}
@@ -0,0 +1,122 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#pragma once
+
+#include "item.hpp"
+
+#include <caf/expected.hpp>
+#include <caf/uri.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// An inclusive range of item IDs.
+struct id_range {
+  int32_t first = 0;
+  int32_t last = 0;
+};
+
+template <class Inspector>
+bool inspect(Inspector& f, id_range& x) {
+  return f.object(x).fields(f.field("first", x.first),
+                            f.field("last", x.last));
+}
+
+/// Selects the items an event subscriber is interested in.
+struct subscription_filter {
+  /// Individual item IDs.
+  std::vector<int32_t> ids;
+  /// Ranges of item IDs.
+  std::vector<id_range> ranges;
+  /// Requests the current state of all matching items before any event.
+  bool snapshot = false;
+
+  /// Returns whether the filter selects all items.
+  bool matches_all() const noexcept {
+    return ids.empty() && ranges.empty();
+  }
+
+  /// Returns whether the filter selects the item with the given ID.
+  /// @pre The filter is normalized, i.e., from `make_subscription_filter`.
+  bool matches(int32_t id) const noexcept;
+};
+
+template <class Inspector>
+bool inspect(Inspector& f, subscription_filter& x) {
+  return f.object(x).fields(f.field("ids", x.ids),
+                            f.field("ranges", x.ranges),
+                            f.field("snapshot", x.snapshot));
+}
+
+/// Parses a filter from the query of a WebSocket upgrade request. Accepts the
+/// parameters `ids` (comma-separated IDs), `ranges` (comma-separated ranges
+/// in the form `first-last`) and `snapshot` (`true` or `false`). Without
+/// `ids` and `ranges`, the filter selects all items.
+caf::expected<subscription_filter>
+make_subscription_filter(const caf::uri::query_map& query);
+
+/// The current state of a set of items and the sequence number of the last
+/// change it includes.
+struct item_snapshot {
+  uint64_t seq = 0;
+  std::vector<item> items;
+};
+
+template <class Inspector>
+bool inspect(Inspector& f, item_snapshot& x) {
+  return f.object(x).fields(f.field("seq", x.seq), f.field("items", x.items));
+}
+
+/// Maps item IDs to subscribers. Lookups cost a hash map access for individual
+/// IDs plus a binary search over the elementary intervals of all ranges, i.e.,
+/// the pieces between any two consecutive range boundaries. Each piece lists
+/// all subscribers whose ranges cover it, so a lookup only visits matches.
+/// Adding or removing a subscriber with ranges rebuilds the pieces.
+class subscription_table {
+public:
+  using subscriber_id = size_t;
+
+  /// Adds a subscriber with the given filter.
+  void add(subscriber_id sub, const subscription_filter& filter);
+
+  /// Removes a subscriber that was added with the given filter.
+  void remove(subscriber_id sub, const subscription_filter& filter);
+
+  /// Calls `fn` once for each subscriber that is interested in `id`.
+  template <class F>
+  void for_each_match(int32_t id, F&& fn) const {
+    for (auto sub : all_)
+      fn(sub);
+    if (auto i = by_id_.find(id); i != by_id_.end())
+      for (auto sub : i->second)
+        fn(sub);
+    // A subscriber with overlapping ranges or with an ID inside one of its
+    // ranges still receives each event only once, because
+    // `make_subscription_filter` normalizes the filter.
+    if (auto i = pieces_.upper_bound(id); i != pieces_.begin())
+      for (auto sub : std::prev(i)->second)
+        fn(sub);
+  }
+
+private:
+  struct range_entry {
+    id_range range;
+    subscriber_id sub;
+  };
+
+  /// Recomputes `pieces_` from `ranges_`.
+  void rebuild_pieces();
+
+  std::vector<subscriber_id> all_;
+  std::unordered_map<int32_t, std::vector<subscriber_id>> by_id_;
+  std::vector<range_entry> ranges_;
+  // Maps the first ID of each elementary interval to the subscribers that
+  // cover it. An interval ends where the next one starts. The keys are 64-bit,
+  // because an interval may start right after INT32_MAX.
+  std::map<int64_t, std::vector<subscriber_id>> pieces_;
+};
@@ -0,0 +1,236 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+#include "tracing.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tracing {
+
+namespace {
+
+/// Number of spans per ring. Rings that fill up between two writes drop new
+/// spans.
+constexpr size_t ring_size = 4096;
+
+struct span {
+  const char* name;
+  uint64_t trace_id;
+  int64_t begin;
+  int64_t end;
+};
+
+/// A single-producer, single-consumer queue of spans. Only the owning thread
+/// pushes and only the writer pops.
+struct alignas(64) ring {
+  explicit ring(size_t tid) : tid(tid) {
+    // nop
+  }
+
+  void push(const span& value) noexcept {
+    auto pos = head.load(std::memory_order_relaxed);
+    if (pos - tail.load(std::memory_order_acquire) == ring_size)
+      return;
+    slots[pos % ring_size] = value;
+    head.store(pos + 1, std::memory_order_release);
+  }
+
+  template <class F>
+  void drain(F&& fn) {
+    auto pos = tail.load(std::memory_order_relaxed);
+    auto last = head.load(std::memory_order_acquire);
+    for (; pos != last; ++pos)
+      fn(slots[pos % ring_size]);
+    tail.store(last, std::memory_order_release);
+  }
+
+  const size_t tid;
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
+  span slots[ring_size];
+};
+
+/// Owns all rings. Threads that terminate return their ring for reuse. The
+/// writer still drains spans that a thread recorded before terminating.
+class registry {
+public:
+  ring* acquire() {
+    std::lock_guard guard{mtx_};
+    if (!idle_.empty()) {
+      auto* result = idle_.back();
+      idle_.pop_back();
+      return result;
+    }
+    return rings_.emplace_back(std::make_unique<ring>(rings_.size() + 1))
+      .get();
+  }
+
+  void release(ring* ptr) {
+    std::lock_guard guard{mtx_};
+    idle_.push_back(ptr);
+  }
+
+  template <class F>
+  void for_each(F&& fn) {
+    std::lock_guard guard{mtx_};
+    for (auto& ptr : rings_)
+      fn(*ptr);
+  }
+
+private:
+  std::mutex mtx_;
+  std::vector<std::unique_ptr<ring>> rings_;
+  std::vector<ring*> idle_;
+};
+
+registry& global_registry() {
+  // Never destroyed, because threads may still release rings during static
+  // destruction.
+  static auto* instance = new registry;
+  return *instance;
+}
+
+/// Binds a ring to the current thread.
+struct ring_handle {
+  ring_handle() : ptr(global_registry().acquire()) {
+    // nop
+  }
+
+  ~ring_handle() {
+    global_registry().release(ptr);
+  }
+
+  ring* ptr;
+};
+
+ring& local_ring() {
+  thread_local ring_handle handle;
+  return *handle.ptr;
+}
+
+/// Traces one in `sample_every` requests. Tracing is off while 0.
+std::atomic<uint32_t> sample_every{0};
+
+std::atomic<uint64_t> next_trace_id{1};
+
+/// Returns `true` for one in `sample_every` calls with the same counter.
+bool take_sample(uint32_t& skipped) noexcept {
+  auto every = sample_every.load(std::memory_order_relaxed);
+  if (every == 0 || ++skipped < every)
+    return false;
+  skipped = 0;
+  return true;
+}
+
+/// Drains all rings into a file after each interval.
+class writer {
+public:
+  writer(std::FILE* out, std::chrono::milliseconds interval)
+    : out_(out), interval_(interval), origin_(now()) {
+    std::fputs("[", out_);
+    thread_ = std::thread{[this] { run(); }};
+  }
+
+  ~writer() {
+    {
+      std::lock_guard guard{mtx_};
+      stopping_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+    flush();
+    // The closing bracket is optional in the Chrome trace format, so files
+    // of a crashed server remain readable.
+    std::fputs("\n]\n", out_);
+    std::fclose(out_);
+  }
+
+private:
+  void run() {
+    std::unique_lock guard{mtx_};
+    while (!cv_.wait_for(guard, interval_, [this] { return stopping_; })) {
+      guard.unlock();
+      flush();
+      guard.lock();
+    }
+  }
+
+  void flush() {
+    global_registry().for_each([this](ring& buf) {
+      buf.drain([this, tid = buf.tid](const span& x) { write(tid, x); });
+    });
+    std::fflush(out_);
+  }
+
+  /// Writes a complete event. Timestamps are microseconds since starting the
+  /// writer. Span names are literals that never need escaping.
+  void write(size_t tid, const span& x) {
+    auto ts = static_cast<double>(x.begin - origin_) / 1000.0;
+    auto dur = static_cast<double>(x.end - x.begin) / 1000.0;
+    std::fprintf(out_,
+                 "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+                 "\"dur\":%.3f,\"pid\":1,\"tid\":%zu,"
+                 "\"args\":{\"trace_id\":%llu}}",
+                 first_ ? "" : ",", x.name, ts, dur, tid,
+                 static_cast<unsigned long long>(x.trace_id));
+    first_ = false;
+  }
+
+  std::FILE* out_;
+  std::chrono::milliseconds interval_;
+  int64_t origin_;
+  bool first_ = true;
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+std::mutex writer_mtx;
+
+std::unique_ptr<writer> global_writer;
+
+} // namespace
+
+bool enabled() noexcept {
+  return sample_every.load(std::memory_order_relaxed) != 0;
+}
+
+uint64_t sample() noexcept {
+  thread_local uint32_t skipped = 0;
+  if (!take_sample(skipped))
+    return 0;
+  return next_trace_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+void record(const char* name, uint64_t trace_id, int64_t begin,
+            int64_t end) noexcept {
+  local_ring().push(span{name, trace_id, begin, end});
+}
+
+bool start_writer(const std::string& path, uint32_t every,
+                  std::chrono::milliseconds interval) {
+  std::lock_guard guard{writer_mtx};
+  if (global_writer || every == 0)
+    return false;
+  auto* out = std::fopen(path.c_str(), "w");
+  if (out == nullptr)
+    return false;
+  global_writer = std::make_unique<writer>(out, interval);
+  sample_every.store(every, std::memory_order_relaxed);
+  return true;
+}
+
+void stop_writer() {
+  std::lock_guard guard{writer_mtx};
+  sample_every.store(0, std::memory_order_relaxed);
+  global_writer.reset();
+}
+
+} // namespace tracing
@@ -0,0 +1,127 @@
+// (c) 2024, Interance GmbH & Co KG.
+
+// Sampled tracing of requests. Each thread records spans into its own ring
+// buffer without locks. A background thread drains all rings and appends the
+// spans to a file in the Chrome trace format, which Perfetto and
+// chrome://tracing open directly.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace tracing {
+
+/// Returns the time on the steady clock in nanoseconds.
+inline int64_t now() noexcept {
+  auto t = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+}
+
+/// Returns whether tracing is active, i.e., whether a writer runs.
+bool enabled() noexcept;
+
+/// Decides whether to trace the next request on this thread. Picks one in
+/// `sample_every` requests.
+/// @returns a new trace ID or `no_trace` if the request is not sampled.
+uint64_t sample() noexcept;
+
+/// The trace ID of requests that are not sampled.
+constexpr uint64_t no_trace = 0;
+
+/// Records a span on the current thread. Drops the span if the ring of the
+/// thread is full.
+/// @param name A string with static storage duration.
+void record(const char* name, uint64_t trace_id, int64_t begin,
+            int64_t end) noexcept;
+
+/// Starts the background writer, which appends all recorded spans to the file
+/// at `path` after each `interval`. Samples one in `sample_every` requests.
+/// @returns `false` if the file cannot be opened or a writer already runs.
+bool start_writer(const std::string& path, uint32_t sample_every,
+                  std::chrono::milliseconds interval);
+
+/// Stops the writer after writing all remaining spans.
+void stop_writer();
+
+/// Records the stages of a sampled request. Copies carry the trace ID and the
+/// end of the last stage, so asynchronous callbacks may continue the trace.
+/// All member functions do nothing for requests that are not sampled.
+class request_trace {
+public:
+  request_trace() = default;
+
+  /// Starts a trace for a request named `name` if the request is sampled.
+  /// @param name A string with static storage duration.
+  explicit request_trace(const char* name) noexcept : id_(sample()) {
+    if (id_ != 0) {
+      name_ = name;
+      start_ = last_ = now();
+    }
+  }
+
+  /// Returns the trace ID or 0 if the request is not sampled.
+  uint64_t id() const noexcept {
+    return id_;
+  }
+
+  /// Ends the current stage and records it as `stage`.
+  /// @param stage A string with static storage duration.
+  void mark(const char* stage) noexcept {
+    if (id_ == 0)
+      return;
+    auto t = now();
+    record(stage, id_, last_, t);
+    last_ = t;
+  }
+
+  /// Ends the last stage, records it as `stage` and records a span for the
+  /// whole request.
+  /// @param stage A string with static storage duration.
+  void finish(const char* stage) noexcept {
+    if (id_ == 0)
+      return;
+    auto t = now();
+    record(stage, id_, last_, t);
+    record(name_, id_, start_, t);
+  }
+
+private:
+  uint64_t id_ = 0;
+  const char* name_ = nullptr;
+  int64_t start_ = 0;
+  int64_t last_ = 0;
+};
+
+/// Records a span from its construction until its destruction, e.g., for
+/// the work of an actor on a single message. Actors receive the trace ID with
+/// the message, so the span shows up next to the stages of the request.
+/// Records nothing for requests that are not sampled.
+class scoped_span {
+public:
+  /// @param name A string with static storage duration.
+  scoped_span(const char* name, uint64_t trace_id) noexcept {
+    if (trace_id != no_trace) {
+      name_ = name;
+      trace_id_ = trace_id;
+      start_ = now();
+    }
+  }
+
+  scoped_span(const scoped_span&) = delete;
+
+  scoped_span& operator=(const scoped_span&) = delete;
+
+  ~scoped_span() {
+    if (name_ != nullptr)
+      record(name_, trace_id_, start_, now());
+  }
+
+private:
+  const char* name_ = nullptr;
+  uint64_t trace_id_ = no_trace;
+  int64_t start_ = 0;
+};
+
+} // namespace tracing
@@ -5,14 +5,35 @@
 #include <caf/type_id.hpp>
 
 #include <cstdint>
+#include <vector>
 
 class item;
 enum class ec : uint8_t;
+enum class op_type : uint8_t;
+struct batch_op;
+struct batch_result;
+struct inventory_query;
+struct inventory_stats;
+struct item_page;
+struct item_query;
+struct item_snapshot;
+struct subscription_filter;
 
 CAF_BEGIN_TYPE_ID_BLOCK(warehouse_backend, first_custom_type_id)
 
   CAF_ADD_TYPE_ID(warehouse_backend, (ec))
   CAF_ADD_TYPE_ID(warehouse_backend, (item))
+  CAF_ADD_TYPE_ID(warehouse_backend, (op_type))
+  CAF_ADD_TYPE_ID(warehouse_backend, (batch_op))
+  CAF_ADD_TYPE_ID(warehouse_backend, (batch_result))
+  CAF_ADD_TYPE_ID(warehouse_backend, (std::vector<batch_op>))
+  CAF_ADD_TYPE_ID(warehouse_backend, (std::vector<batch_result>))
+  CAF_ADD_TYPE_ID(warehouse_backend, (item_page))
+  CAF_ADD_TYPE_ID(warehouse_backend, (item_query))
+  CAF_ADD_TYPE_ID(warehouse_backend, (item_snapshot))
+  CAF_ADD_TYPE_ID(warehouse_backend, (subscription_filter))
+  CAF_ADD_TYPE_ID(warehouse_backend, (inventory_query))
+  CAF_ADD_TYPE_ID(warehouse_backend, (inventory_stats))
 
   // Used to retrieve an item from the database.
   CAF_ADD_ATOM(warehouse_backend, get_atom)
@@ -29,6 +50,18 @@ CAF_BEGIN_TYPE_ID_BLOCK(warehouse_backend, first_custom_type_id)
   // Used to delete an item from the database.
   CAF_ADD_ATOM(warehouse_backend, del_atom)
 
+  // Used to apply multiple operations with a single request.
+  CAF_ADD_ATOM(warehouse_backend, batch_atom)
+
+  // Used to retrieve multiple items from the database.
+  CAF_ADD_ATOM(warehouse_backend, list_atom)
+
+  // Used to read the current state of items for a new event subscriber.
+  CAF_ADD_ATOM(warehouse_backend, snapshot_atom)
+
+  // Used to compute totals over all items.
+  CAF_ADD_ATOM(warehouse_backend, stats_atom)
+
   // Used to signal a system shutdown to the control loop.
   CAF_ADD_ATOM(warehouse_backend, shutdown_atom)
 